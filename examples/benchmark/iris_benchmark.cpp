@@ -0,0 +1,663 @@
+/// @file iris_benchmark.cpp
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "iris_mobile_v2.h"
+#include "iris_mobile_v2_capture.h"
+#include "iris_image_record.h"
+#include "iris_engine_v3.h"
+#include "buffer_pool.h"
+#include "gallery_slab.h"
+#include "image_source.h"
+#include "ire3_gallery_matcher.h"
+#include "latency_stats.h"
+#include "utils.h"
+
+#define BUFFER_SIZE (1000 * 1000)
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Benchmark configuration, set from the command line.
+ */
+struct Options {
+  std::string image;
+  int width = 640;
+  int height = 480;
+  int32_t nom_res = 200;
+  int32_t cam_res = 4000;
+  uint32_t num_eyes = 1;
+  int ire3_nom_res = 150;
+  int ire3_quality = 4;
+  std::size_t threads = 1;
+  std::size_t iterations = 100;
+  std::size_t warmup = 5;
+  unsigned int jp2_target = 20000;
+  std::size_t gallery_size = 10000;
+  std::string filter;
+  std::string output;
+};
+
+/**
+ * @brief Latency distribution and throughput of one benchmark.
+ */
+struct Result {
+  std::string name;
+  std::size_t threads = 0;
+  std::size_t errors = 0;
+  double seconds = 0;
+  LatencyStats latency;
+};
+
+/**
+ * @brief Per-thread fixture: prepares the engine state once, then `run` is
+ * timed for every iteration.
+ */
+struct Fixture {
+  virtual ~Fixture() = default;
+  /// Untimed preparation, false if the fixture can not be used.
+  virtual bool setup() = 0;
+  /// The timed operation, false on engine error.
+  virtual bool run() = 0;
+  /// Untimed bookkeeping after every operation.
+  virtual void after() {}
+};
+
+/**
+ * @brief Runs a fixture made by `factory` on every thread and times `run`
+ * concurrently.
+ *
+ * All threads start the timed loop at the same moment, throughput is the
+ * total number of operations over the wall time of the slowest thread.
+ */
+Result run_benchmark(const std::string &name, const Options &options,
+                     const std::function<std::unique_ptr<Fixture>()> &factory) {
+  Result result;
+  result.name = name;
+  result.threads = options.threads;
+  std::vector<LatencyStats> latencies(options.threads);
+  std::atomic<std::size_t> errors{0};
+  std::atomic<std::size_t> ready{0};
+  std::atomic<bool> failed{false};
+  std::mutex mutex;
+  std::condition_variable go;
+  bool started = false;
+  Clock::time_point start;
+
+  std::vector<std::thread> threads;
+  for (std::size_t t = 0; t < options.threads; ++t) {
+    threads.emplace_back([&, t] {
+      auto fixture = factory();
+      if (!fixture->setup())
+        failed = true;
+      for (std::size_t i = 0; i < options.warmup && !failed; ++i) {
+        fixture->run();
+        fixture->after();
+      }
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (++ready == options.threads) {
+          started = true;
+          start = Clock::now();
+          go.notify_all();
+        }
+        go.wait(lock, [&] { return started; });
+      }
+      if (failed)
+        return;
+      for (std::size_t i = 0; i < options.iterations; ++i) {
+        auto before = Clock::now();
+        bool ok = fixture->run();
+        latencies[t].add(
+            std::chrono::duration<double, std::milli>(Clock::now() - before)
+                .count());
+        if (!ok)
+          ++errors;
+        fixture->after();
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  result.seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  for (const auto &l : latencies)
+    result.latency.merge(l);
+  result.errors = failed ? (std::size_t)-1 : errors.load();
+  return result;
+}
+
+/**
+ * @brief Input image of the configured size shared by all fixtures.
+ */
+struct Image {
+  std::vector<uint8_t> pixels;
+  int width = 0;
+  int height = 0;
+};
+
+/**
+ * @brief Loads the input image and fits it to the configured size by center
+ * cropping or edge padding. Without an input image, noise is generated.
+ */
+bool load_image(const Options &options, Image &image) {
+  image.width = options.width;
+  image.height = options.height;
+  image.pixels.resize((std::size_t)image.width * image.height);
+  if (options.image.empty()) {
+    std::mt19937 rng(1);
+    for (auto &p : image.pixels)
+      p = (uint8_t)rng();
+    return true;
+  }
+  MappedImage file;
+  if (!file.open_pgm(options.image))
+    return false;
+  const ImageView &source = file.view();
+  int dx = (source.width - image.width) / 2;
+  int dy = (source.height - image.height) / 2;
+  for (int y = 0; y < image.height; ++y)
+    for (int x = 0; x < image.width; ++x) {
+      int sx = std::min(std::max(x + dx, 0), source.width - 1);
+      int sy = std::min(std::max(y + dy, 0), source.height - 1);
+      image.pixels[(std::size_t)y * image.width + x] = source.row(sy)[sx];
+    }
+  return true;
+}
+
+/**
+ * @brief irm2 context in one of the three operation modes.
+ */
+class Irm2Fixture : public Fixture {
+public:
+  enum class Mode { Enroll, Identify, Capture, Kind7 };
+
+  Irm2Fixture(const Options &options, const Image &image, Mode mode)
+      : options(options), image(image), mode(mode) {
+    s = {sizeof(s),      image.width, image.height,   options.cam_res,
+         options.nom_res, NULL,       NULL,           NULL,
+         NULL,           IRM2_FLAG_NONE, NULL,        image.width};
+  }
+
+  bool setup() override {
+    std::size_t size = mode == Mode::Capture || mode == Mode::Kind7
+                           ? IRM2_GET_CAPTURE_CONTEXT_SIZE(image.width,
+                                                           image.height)
+                           : IRM2_GET_CONTEXT_SIZE(1, image.width,
+                                                   image.height);
+    context = BufferPool::local().acquire(size);
+    if (mode == Mode::Identify) {
+      // Enroll from the same image; with a bounded number of frames so a
+      // synthetic image can still be benchmarked.
+      if (!init_enrollment())
+        return false;
+      irm2_enrollment_info enr_info = {0};
+      for (int i = 0; i < 1000 && enr_info.overall_progress != 100; ++i) {
+        irm2_on_frame(context.data(), image.pixels.data(), 0);
+        irm2_get_enrollment_info(context.data(), &enr_info, sizeof(enr_info));
+        if (enr_info.step_progress == 100 && enr_info.overall_progress != 100)
+          irm2_continue_enrollment(context.data());
+      }
+      irm2_get_template(context.data(), iris_template, IRM2_TEMPLATE_SIZE);
+    }
+    if (!init())
+      return false;
+    if (mode == Mode::Kind7)
+      for (int i = 0; i < 1000; ++i)
+        if (irm2_on_frame(context.data(), image.pixels.data(), 0) == 0)
+          break;
+    return true;
+  }
+
+  bool run() override {
+    if (mode == Mode::Kind7)
+      return irm2_get_kind7_image(context.data(), IRM2_EYE_UNDEF,
+                                  IRM2_CROPPED_WIDTH, IRM2_CROPPED_HEIGHT,
+                                  cropped) == 0;
+    last_rc = irm2_on_frame(context.data(), image.pixels.data(), 0);
+    // Non-zero on_frame codes report progress, not errors.
+    return true;
+  }
+
+  void after() override {
+    if (mode == Mode::Enroll) {
+      irm2_enrollment_info enr_info = {0};
+      irm2_get_enrollment_info(context.data(), &enr_info, sizeof(enr_info));
+      // Keep the context in the enrollment state for the next iteration.
+      if (enr_info.overall_progress == 100)
+        init();
+      else if (enr_info.step_progress == 100)
+        irm2_continue_enrollment(context.data());
+    } else if (mode == Mode::Capture && last_rc == 0) {
+      init();
+    }
+  }
+
+private:
+  bool init_enrollment() {
+    return irm2_init_enrollment(context.data(), context.size(),
+                                options.num_eyes, &s) == 0;
+  }
+
+  bool init() {
+    if (mode == Mode::Enroll)
+      return init_enrollment();
+    if (mode == Mode::Identify) {
+      const uint8_t *templates[] = {iris_template};
+      return irm2_init_identification(context.data(), context.size(),
+                                      templates, 1, 100, &s) == 0;
+    }
+    irm2_capture_settings cs = {sizeof(irm2_capture_settings), -1, 10, -1, -1,
+                                -1, -1, -1, -1};
+    return irm2_init_capture(context.data(), context.size(), options.num_eyes,
+                             &s, &cs) == 0;
+  }
+
+  const Options &options;
+  const Image &image;
+  Mode mode;
+  int last_rc = 0;
+  irm2_settings s;
+  PooledBuffer context;
+  uint8_t iris_template[IRM2_TEMPLATE_SIZE] = {0};
+  uint8_t cropped[IRM2_CROPPED_WIDTH * IRM2_CROPPED_HEIGHT];
+};
+
+/**
+ * @brief ire3 extraction, deserialization or comparison.
+ */
+class Ire3Fixture : public Fixture {
+public:
+  enum class Mode { Extract, Deserialize, Compare };
+
+  Ire3Fixture(const Options &options, const Image &image, Mode mode)
+      : image(image), mode(mode) {
+    settings = {sizeof(settings), options.ire3_nom_res, options.ire3_quality};
+  }
+
+  bool setup() override {
+    if (ire3_get_max_features_size(&features_size) != IRE3_STATUS_OK ||
+        ire3_get_extraction_working_set_size(&working_set_size, &settings) !=
+            IRE3_STATUS_OK ||
+        ire3_get_deserialized_features_size(&des_size) != IRE3_STATUS_OK)
+      return false;
+    working_set = BufferPool::local().acquire(working_set_size);
+    features = BufferPool::local().acquire(features_size);
+    des_ftr = BufferPool::local().acquire(des_size);
+    if (mode == Mode::Extract)
+      return true;
+    return extract() && deserialize();
+  }
+
+  bool run() override {
+    switch (mode) {
+    case Mode::Extract:
+      return extract();
+    case Mode::Deserialize:
+      return deserialize();
+    default:
+      int score = 0;
+      return ire3_compare(des_ftr.data(), des_ftr.data(), &settings, &score) ==
+             IRE3_STATUS_OK;
+    }
+  }
+
+private:
+  bool extract() {
+    ire3_eye_info eye_info;
+    return ire3_extract_features(image.pixels.data(), image.width,
+                                 image.height, features.data(), features_size,
+                                 &feature_size, &eye_info, sizeof(eye_info),
+                                 working_set.data(), working_set_size,
+                                 &settings) == IRE3_STATUS_OK;
+  }
+
+  bool deserialize() {
+    return ire3_deserialize_features(features.data(), feature_size,
+                                     des_ftr.data(),
+                                     des_size) == IRE3_STATUS_OK;
+  }
+
+  const Image &image;
+  Mode mode;
+  ire3_settings settings;
+  size_t features_size = 0, working_set_size = 0, des_size = 0;
+  size_t feature_size = 0;
+  PooledBuffer working_set, features, des_ftr;
+};
+
+/**
+ * @brief One 1:N scan of a probe against a gallery of deserialized ire3
+ * features, in one of the gallery memory layouts.
+ *
+ * `Pointers` is the layout of galleries built from individually allocated
+ * records: the records are scattered between other allocations and the
+ * gallery order does not follow their addresses, as after users were
+ * deleted and enrolled again. The slab layouts store the records back to
+ * back in a @ref SlabGallery, scanned with and without prefetching.
+ */
+class GalleryScanFixture : public Fixture {
+public:
+  enum class Layout { Pointers, Slab, SlabPrefetch };
+
+  GalleryScanFixture(const Options &options, const Image &image,
+                     Layout layout)
+      : options(options), image(image), layout(layout), pool(1) {
+    settings = {sizeof(settings), options.ire3_nom_res, options.ire3_quality};
+  }
+
+  bool setup() override {
+    size_t features_size = 0, working_set_size = 0, feature_size = 0;
+    ire3_eye_info eye_info;
+    if (ire3_get_max_features_size(&features_size) != IRE3_STATUS_OK ||
+        ire3_get_extraction_working_set_size(&working_set_size, &settings) !=
+            IRE3_STATUS_OK ||
+        ire3_get_deserialized_features_size(&des_size) != IRE3_STATUS_OK)
+      return false;
+    std::vector<uint8_t> working_set(working_set_size), features(features_size);
+    probe.resize(des_size);
+    if (ire3_extract_features(image.pixels.data(), image.width, image.height,
+                              features.data(), features_size, &feature_size,
+                              &eye_info, sizeof(eye_info), working_set.data(),
+                              working_set_size, &settings) != IRE3_STATUS_OK ||
+        ire3_deserialize_features(features.data(), feature_size, probe.data(),
+                                  des_size) != IRE3_STATUS_OK)
+      return false;
+
+    std::mt19937 rng(1);
+    if (layout == Layout::Pointers) {
+      std::uniform_int_distribution<std::size_t> filler_size(64, 4096);
+      for (std::size_t i = 0; i < options.gallery_size; ++i) {
+        owned.emplace_back(new uint8_t[des_size]);
+        std::memcpy(owned.back().get(), probe.data(), des_size);
+        fillers.emplace_back(new uint8_t[filler_size(rng)]);
+        records.push_back(owned.back().get());
+      }
+      std::shuffle(records.begin(), records.end(), rng);
+    } else {
+      slab.reset(new SlabGallery(des_size));
+      for (std::size_t i = 0; i < options.gallery_size; ++i)
+        slab->add(probe.data(), (uint32_t)i);
+    }
+    search.top_k = 5;
+    search.chunk_size = options.gallery_size;
+    search.prefetch_distance =
+        layout == Layout::SlabPrefetch ? GALLERY_PREFETCH_DISTANCE : 0;
+    return true;
+  }
+
+  bool run() override {
+    GalleryMatcher matcher(pool, settings);
+    SearchStats stats;
+    if (layout == Layout::Pointers)
+      matcher.search(probe.data(), records, des_size, search, &stats);
+    else
+      matcher.search(probe.data(), *slab, search, &stats);
+    return stats.failures == 0;
+  }
+
+private:
+  const Options &options;
+  const Image &image;
+  Layout layout;
+  ThreadPool pool;
+  ire3_settings settings;
+  SearchOptions search;
+  size_t des_size = 0;
+  std::vector<uint8_t> probe;
+  std::vector<std::unique_ptr<uint8_t[]>> owned, fillers;
+  std::vector<const uint8_t *> records;
+  std::unique_ptr<SlabGallery> slab;
+};
+
+/**
+ * @brief JPEG2000 packing or unpacking of an IIR kind7 record.
+ */
+class IirFixture : public Fixture {
+public:
+  IirFixture(const Options &options, const Image &image, bool pack)
+      : options(options), image(image), pack(pack) {}
+
+  bool setup() override {
+    // A kind7 sized crop of the input image.
+    int width = std::min(image.width, IRM2_CROPPED_WIDTH);
+    int height = std::min(image.height, IRM2_CROPPED_HEIGHT);
+    crop.assign(IRM2_CROPPED_WIDTH * IRM2_CROPPED_HEIGHT, 0);
+    for (int y = 0; y < height; ++y)
+      memcpy(&crop[(std::size_t)y * IRM2_CROPPED_WIDTH],
+             &image.pixels[(std::size_t)y * image.width], width);
+    packed.resize(BUFFER_SIZE);
+    unpacked.resize(BUFFER_SIZE);
+    return do_pack();
+  }
+
+  bool run() override {
+    if (pack)
+      return do_pack();
+    IirInfo ii;
+    memset(&ii, 0, sizeof(ii));
+    uint32_t unpacked_size = 0;
+    return iirUnpack(packed.data(), packed_size, &ii, BUFFER_SIZE,
+                     unpacked.data(), &unpacked_size) == 0;
+  }
+
+private:
+  bool do_pack() {
+    IirInfo ii;
+    memset(&ii, 0, sizeof(ii));
+    memcpy(ii.ich.FormatId, "IIR\0", 4);
+    ii.IirType = IIR_2011;
+    ii.NumberOfIrises = 1;
+    ii.NumberOfEyes = 1;
+    ii.EyeLabel = EYE_UNDEF;
+    memset(ii.CaptureDateAndTime, 0xff, 9);
+    ii.CaptureDeviceTechnology = 1;
+    ii.CaptureDeviceVendorID = 0x0057;
+    ii.RepresentationNumber = 1;
+    ii.ImageType = Iir2011_IMAGEFORMAT_MONO_JPEG2000;
+    ii.ImageFormat = Iir2011_IMAGEFORMAT_MONO_JPEG2000;
+    ii.Width = IRM2_CROPPED_WIDTH;
+    ii.Height = IRM2_CROPPED_HEIGHT;
+    ii.BitDepth = 8;
+    ii.RollAngle = -1;
+    ii.RollUncertainty = -1;
+    char *fmtname = (char *)"jp2";
+    return iirPack(crop.data(), ii.Width, ii.Height, 8, ii.Width * ii.Height,
+                   &ii, fmtname, options.jp2_target, packed.data(),
+                   &packed_size) == 0;
+  }
+
+  const Options &options;
+  const Image &image;
+  bool pack;
+  std::vector<uint8_t> crop, packed, unpacked;
+  uint32_t packed_size = 0;
+};
+
+std::string json_escape(const std::string &text) {
+  std::string escaped;
+  for (char c : text) {
+    if (c == '"' || c == '\\')
+      escaped += '\\';
+    escaped += c;
+  }
+  return escaped;
+}
+
+/**
+ * @brief Writes the results as JSON.
+ */
+void write_json(std::ostream &out, const Options &options,
+                const std::vector<Result> &results) {
+  out << "{\n  \"config\": {\"image\": \"" << json_escape(options.image)
+      << "\", \"width\": " << options.width
+      << ", \"height\": " << options.height
+      << ", \"nom_res\": " << options.nom_res
+      << ", \"cam_res\": " << options.cam_res
+      << ", \"eyes\": " << options.num_eyes
+      << ", \"ire3_nom_res\": " << options.ire3_nom_res
+      << ", \"ire3_quality\": " << options.ire3_quality
+      << ", \"threads\": " << options.threads
+      << ", \"iterations\": " << options.iterations
+      << ", \"gallery\": " << options.gallery_size
+      << ", \"warmup\": " << options.warmup << "},\n  \"results\": [";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    const Result &r = results[i];
+    out << (i ? "," : "") << "\n    {\"name\": \"" << r.name
+        << "\", \"threads\": " << r.threads
+        << ", \"samples\": " << r.latency.count();
+    if (r.errors == (std::size_t)-1)
+      out << ", \"setup_failed\": true";
+    else
+      out << ", \"errors\": " << r.errors;
+    out << ", \"mean_ms\": " << r.latency.mean()
+        << ", \"p50_ms\": " << r.latency.percentile(50)
+        << ", \"p95_ms\": " << r.latency.percentile(95)
+        << ", \"p99_ms\": " << r.latency.percentile(99)
+        << ", \"max_ms\": " << r.latency.max() << ", \"ops_per_s\": "
+        << (r.seconds > 0 ? r.latency.count() / r.seconds : 0) << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+/**
+ * @brief Parses `--name value` pairs into the options.
+ */
+bool parse_options(int argc, char *argv[], Options &o) {
+  for (int i = 1; i < argc; i += 2) {
+    std::string name = argv[i];
+    if (i + 1 >= argc)
+      return false;
+    std::string value = argv[i + 1];
+    if (name == "--image")
+      o.image = value;
+    else if (name == "--width")
+      o.width = std::stoi(value);
+    else if (name == "--height")
+      o.height = std::stoi(value);
+    else if (name == "--nom-res")
+      o.nom_res = std::stoi(value);
+    else if (name == "--cam-res")
+      o.cam_res = std::stoi(value);
+    else if (name == "--eyes")
+      o.num_eyes = std::stoul(value);
+    else if (name == "--ire3-nom-res")
+      o.ire3_nom_res = std::stoi(value);
+    else if (name == "--ire3-quality")
+      o.ire3_quality = std::stoi(value);
+    else if (name == "--threads")
+      o.threads = std::max(1ul, std::stoul(value));
+    else if (name == "--iterations")
+      o.iterations = std::stoul(value);
+    else if (name == "--warmup")
+      o.warmup = std::stoul(value);
+    else if (name == "--jp2-target")
+      o.jp2_target = std::stoul(value);
+    else if (name == "--gallery")
+      o.gallery_size = std::stoul(value);
+    else if (name == "--filter")
+      o.filter = value;
+    else if (name == "--output")
+      o.output = value;
+    else
+      return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Entry point of the benchmark.
+ *
+ * Measures latency percentiles and throughput of the iris-mobile hot paths
+ * and prints them as JSON. Run without arguments to use a synthetic
+ * 640x480 image; see @ref parse_options for the accepted flags.
+ */
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parse_options(argc, argv, options)) {
+    std::cerr
+        << "Usage: " << argv[0]
+        << " [--image file.pgm] [--width W] [--height H] [--nom-res N]"
+           " [--cam-res N] [--eyes N] [--ire3-nom-res N] [--ire3-quality N]"
+           " [--threads N] [--iterations N] [--warmup N] [--jp2-target N]"
+           " [--gallery N]"
+           " [--filter substring] [--output file.json]\n";
+    return 1;
+  }
+  Image image;
+  if (!load_image(options, image)) {
+    std::cerr << "Can not read " << options.image << "\n";
+    return 1;
+  }
+
+  using Irm2 = Irm2Fixture::Mode;
+  using Ire3 = Ire3Fixture::Mode;
+  using Layout = GalleryScanFixture::Layout;
+  const std::vector<std::pair<std::string,
+                              std::function<std::unique_ptr<Fixture>()>>>
+      benchmarks = {
+          {"irm2_on_frame/enroll",
+           [&] { return std::make_unique<Irm2Fixture>(options, image,
+                                                      Irm2::Enroll); }},
+          {"irm2_on_frame/identify",
+           [&] { return std::make_unique<Irm2Fixture>(options, image,
+                                                      Irm2::Identify); }},
+          {"irm2_on_frame/capture",
+           [&] { return std::make_unique<Irm2Fixture>(options, image,
+                                                      Irm2::Capture); }},
+          {"irm2_get_kind7_image",
+           [&] { return std::make_unique<Irm2Fixture>(options, image,
+                                                      Irm2::Kind7); }},
+          {"ire3_extract_features",
+           [&] { return std::make_unique<Ire3Fixture>(options, image,
+                                                      Ire3::Extract); }},
+          {"ire3_deserialize_features",
+           [&] { return std::make_unique<Ire3Fixture>(options, image,
+                                                      Ire3::Deserialize); }},
+          {"ire3_compare",
+           [&] { return std::make_unique<Ire3Fixture>(options, image,
+                                                      Ire3::Compare); }},
+          {"gallery_scan/pointers",
+           [&] { return std::make_unique<GalleryScanFixture>(
+                     options, image, Layout::Pointers); }},
+          {"gallery_scan/slab",
+           [&] { return std::make_unique<GalleryScanFixture>(
+                     options, image, Layout::Slab); }},
+          {"gallery_scan/slab_prefetch",
+           [&] { return std::make_unique<GalleryScanFixture>(
+                     options, image, Layout::SlabPrefetch); }},
+          {"iirPack/jp2",
+           [&] { return std::make_unique<IirFixture>(options, image, true); }},
+          {"iirUnpack/jp2",
+           [&] { return std::make_unique<IirFixture>(options, image, false); }},
+      };
+
+  std::vector<Result> results;
+  for (const auto &b : benchmarks) {
+    if (b.first.find(options.filter) == std::string::npos)
+      continue;
+    std::cerr << "Running " << b.first << "\n";
+    results.push_back(run_benchmark(b.first, options, b.second));
+  }
+
+  if (options.output.empty()) {
+    write_json(std::cout, options, results);
+  } else {
+    std::ofstream out(options.output);
+    write_json(out, options, results);
+  }
+  return 0;
+}
@@ -0,0 +1,457 @@
+/// @file async_writer.h
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "buffer_pool.h"
+#include "mapped_file.h"
+
+/// Bytes the queue holds before @ref AsyncWriter::write applies
+/// backpressure.
+#define ASYNC_WRITER_QUEUE_BYTES (64 * 1024 * 1024)
+/// Files the queue holds before @ref AsyncWriter::write applies
+/// backpressure.
+#define ASYNC_WRITER_QUEUE_FILES (256)
+/// Most files written between two syncs.
+#define ASYNC_WRITER_BATCH (32)
+/// Magic of every entry of an artifact container.
+#define ARTIFACT_ENTRY_MAGIC "IART"
+
+/**
+ * @brief Header of a file stored in an artifact container, followed by the
+ * name and `size` bytes of data. Numbers are in host byte order.
+ */
+struct ArtifactEntryHeader {
+  char magic[4];
+  uint32_t name_size;
+  uint64_t size;
+};
+
+struct AsyncWriterOptions {
+  std::size_t max_queue_bytes = ASYNC_WRITER_QUEUE_BYTES;
+  std::size_t max_queue_files = ASYNC_WRITER_QUEUE_FILES;
+  std::size_t batch = ASYNC_WRITER_BATCH;
+  /// fsync every batch before the files count as written.
+  bool sync = true;
+  /// Drop files instead of blocking the caller while the queue is full.
+  bool drop_when_full = false;
+  /// Append every file to this container instead of creating files.
+  std::string container;
+};
+
+struct AsyncWriterStats {
+  std::size_t queued = 0;
+  std::size_t written = 0;
+  std::size_t failed = 0;
+  std::size_t dropped = 0;
+  uint64_t bytes = 0;
+  std::size_t batches = 0;
+  std::size_t syncs = 0;
+  /// Calls of @ref AsyncWriter::write which waited for room, and how long.
+  std::size_t blocked = 0;
+  double blocked_ms = 0;
+  double max_blocked_ms = 0;
+  /// High-water marks of the queue.
+  std::size_t max_queue_files = 0;
+  std::size_t max_queue_bytes = 0;
+  /// Time the writer thread spent writing and syncing.
+  double write_ms = 0;
+};
+
+inline std::ostream &operator<<(std::ostream &out, const AsyncWriterStats &s) {
+  return out << "Async writer: " << s.written << "/" << s.queued
+             << " files written (" << s.failed << " failed, " << s.dropped
+             << " dropped), " << s.bytes << " bytes in " << s.batches
+             << " batches, " << s.syncs << " syncs, " << s.write_ms
+             << " ms writing; " << s.blocked << " writes blocked for "
+             << s.blocked_ms << " ms (max " << s.max_blocked_ms
+             << " ms); queue peak " << s.max_queue_files << " files / "
+             << s.max_queue_bytes << " bytes";
+}
+
+/**
+ * @brief Writes output files on a background thread.
+ *
+ * The caller hands over a buffer with @ref write and goes on; a dedicated
+ * thread writes the queued files in batches of up to `batch`, syncing each
+ * batch once. The queue is bounded in files and bytes: a full queue blocks
+ * the caller, or drops the file with `drop_when_full`, and both show up in
+ * @ref stats. With `container` set, files are appended to one container
+ * file as @ref ArtifactEntryHeader entries instead of being created one by
+ * one; @ref read_artifacts reads them back.
+ *
+ * Thread-safe; any number of threads may write.
+ */
+class AsyncWriter {
+public:
+  explicit AsyncWriter(const AsyncWriterOptions &options = {})
+      : options(options), worker([this] { run(); }) {}
+
+  ~AsyncWriter() { close(); }
+
+  AsyncWriter(const AsyncWriter &) = delete;
+  AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+  /**
+   * @brief Queues the first `size` bytes of a buffer, taking it over.
+   *
+   * @return false if the file was dropped or the writer is closed.
+   */
+  bool write(std::string name, PooledBuffer data, std::size_t size) {
+    return push({std::move(name), std::move(data), size, 0, 0});
+  }
+
+  /**
+   * @brief Queues a copy of `size` bytes.
+   */
+  bool write(std::string name, const uint8_t *data, std::size_t size) {
+    PooledBuffer copy =
+        BufferPool::local().acquire(std::max<std::size_t>(1, size));
+    std::memcpy(copy.data(), data, size);
+    return write(std::move(name), std::move(copy), size);
+  }
+
+  /**
+   * @brief Queues a binary PGM image whose `width * height` pixels the
+   * buffer holds; the header is formatted by the writer thread.
+   */
+  bool write_pgm(std::string name, PooledBuffer pixels, int width,
+                 int height) {
+    return push({std::move(name), std::move(pixels),
+                 (std::size_t)width * height, width, height});
+  }
+
+  /**
+   * @brief Queues a copy of a binary PGM image.
+   */
+  bool write_pgm(std::string name, const uint8_t *pixels, int width,
+                 int height) {
+    std::size_t size = (std::size_t)width * height;
+    PooledBuffer copy =
+        BufferPool::local().acquire(std::max<std::size_t>(1, size));
+    std::memcpy(copy.data(), pixels, size);
+    return write_pgm(std::move(name), std::move(copy), width, height);
+  }
+
+  /**
+   * @brief Waits until every file queued so far is written and synced.
+   */
+  void flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [&] { return queue.empty() && !busy; });
+  }
+
+  /**
+   * @brief Writes the remaining files and stops the writer thread.
+   *
+   * @return false if any file failed.
+   */
+  bool close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (closed)
+        return totals.failed == 0;
+      closed = true;
+    }
+    queued.notify_all();
+    worker.join();
+    if (container)
+      fclose(container);
+    container = nullptr;
+    return totals.failed == 0;
+  }
+
+  AsyncWriterStats stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return totals;
+  }
+
+private:
+  struct File {
+    std::string name;
+    PooledBuffer data;
+    std::size_t size;
+    /// Image size for PGM files, 0 for plain data.
+    int width;
+    int height;
+
+    std::string header() const {
+      return width ? "P5\n" + std::to_string(width) + " " +
+                         std::to_string(height) + "\n255\n"
+                   : std::string();
+    }
+  };
+
+  bool push(File file) {
+    std::size_t bytes = file.size;
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex);
+    ++totals.queued;
+    auto has_room = [&] {
+      return closed || queue.empty() ||
+             (queue.size() < options.max_queue_files &&
+              queue_bytes + bytes <= options.max_queue_bytes);
+    };
+    if (!has_room()) {
+      if (options.drop_when_full) {
+        ++totals.dropped;
+        return false;
+      }
+      room.wait(lock, has_room);
+      double ms = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+      ++totals.blocked;
+      totals.blocked_ms += ms;
+      totals.max_blocked_ms = std::max(totals.max_blocked_ms, ms);
+    }
+    if (closed) {
+      ++totals.dropped;
+      return false;
+    }
+    queue_bytes += bytes;
+    queue.push_back(std::move(file));
+    totals.max_queue_files = std::max(totals.max_queue_files, queue.size());
+    totals.max_queue_bytes = std::max(totals.max_queue_bytes, queue_bytes);
+    lock.unlock();
+    queued.notify_one();
+    return true;
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      queued.wait(lock, [&] { return closed || !queue.empty(); });
+      if (queue.empty())
+        return;
+      std::vector<File> batch;
+      while (!queue.empty() && batch.size() < options.batch) {
+        queue_bytes -= queue.front().size;
+        batch.push_back(std::move(queue.front()));
+        queue.pop_front();
+      }
+      busy = true;
+      lock.unlock();
+      room.notify_all();
+
+      auto start = std::chrono::steady_clock::now();
+      BatchResult result =
+          options.container.empty() ? write_files(batch) : append(batch);
+      double ms = std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+      // The buffers go back to their pools outside the lock.
+      batch.clear();
+
+      lock.lock();
+      busy = false;
+      ++totals.batches;
+      totals.written += result.written;
+      totals.failed += result.failed;
+      totals.bytes += result.bytes;
+      totals.syncs += result.syncs;
+      totals.write_ms += ms;
+      idle.notify_all();
+    }
+  }
+
+  struct BatchResult {
+    std::size_t written = 0;
+    std::size_t failed = 0;
+    uint64_t bytes = 0;
+    std::size_t syncs = 0;
+  };
+
+  /**
+   * @brief Creates every file of the batch, then syncs and closes them.
+   */
+  BatchResult write_files(const std::vector<File> &batch) {
+    BatchResult result;
+    std::vector<std::pair<FILE *, std::size_t>> written;
+    for (const File &file : batch) {
+      FILE *out = fopen(file.name.c_str(), "wb");
+      std::string header = file.header();
+      if (!out ||
+          fwrite(header.data(), 1, header.size(), out) != header.size() ||
+          fwrite(file.data.data(), 1, file.size, out) != file.size) {
+        if (out)
+          fclose(out);
+        ++result.failed;
+        continue;
+      }
+      written.push_back({out, header.size() + file.size});
+    }
+    for (auto &file : written) {
+      bool ok = fflush(file.first) == 0;
+      if (ok && options.sync) {
+        ok = sync(file.first);
+        ++result.syncs;
+      }
+      if (fclose(file.first) == 0 && ok) {
+        ++result.written;
+        result.bytes += file.second;
+      } else {
+        ++result.failed;
+      }
+    }
+    return result;
+  }
+
+  /**
+   * @brief Appends the batch to the container and syncs it once.
+   *
+   * A batch that can not be written completely is cut off again, so the
+   * container never holds a partial entry that would hide the entries
+   * appended after it from @ref read_artifacts.
+   */
+  BatchResult append(const std::vector<File> &batch) {
+    BatchResult result;
+    if (!container && !open_container()) {
+      result.failed = batch.size();
+      return result;
+    }
+    bool ok = true;
+    uint64_t appended = 0;
+    for (std::size_t i = 0; ok && i < batch.size(); ++i) {
+      const File &file = batch[i];
+      std::string header = file.header();
+      ArtifactEntryHeader entry;
+      std::memcpy(entry.magic, ARTIFACT_ENTRY_MAGIC, 4);
+      entry.name_size = (uint32_t)file.name.size();
+      entry.size = header.size() + file.size;
+      ok = fwrite(&entry, sizeof(entry), 1, container) == 1 &&
+           fwrite(file.name.data(), 1, file.name.size(), container) ==
+               file.name.size() &&
+           fwrite(header.data(), 1, header.size(), container) ==
+               header.size() &&
+           fwrite(file.data.data(), 1, file.size, container) == file.size;
+      appended += sizeof(entry) + entry.name_size + entry.size;
+      result.bytes += entry.size;
+    }
+    ok = ok && fflush(container) == 0;
+    if (ok && options.sync) {
+      ok = sync(container);
+      ++result.syncs;
+    }
+    if (ok) {
+      result.written = batch.size();
+      container_size += appended;
+      return result;
+    }
+    result.failed = batch.size();
+    result.bytes = 0;
+    // Buffered bytes of the batch are dropped with the stream, the written
+    // ones by cutting the file back to its size before the batch; the next
+    // batch reopens it.
+    fclose(container);
+    container = nullptr;
+    std::error_code error;
+    std::filesystem::resize_file(options.container, container_size, error);
+    truncate_pending = (bool)error;
+    return result;
+  }
+
+  /**
+   * @brief Opens the container for appending and records its size, after
+   * cutting off a failed batch that could not be cut off before.
+   */
+  bool open_container() {
+    std::error_code error;
+    if (truncate_pending) {
+      std::filesystem::resize_file(options.container, container_size, error);
+      if (error)
+        return false;
+      truncate_pending = false;
+    }
+    container = fopen(options.container.c_str(), "ab");
+    if (container && fseek(container, 0, SEEK_END) == 0) {
+      long end = ftell(container);
+      if (end >= 0) {
+        container_size = (uint64_t)end;
+        return true;
+      }
+    }
+    if (container)
+      fclose(container);
+    container = nullptr;
+    return false;
+  }
+
+  static bool sync(FILE *file) {
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+  }
+
+  AsyncWriterOptions options;
+  mutable std::mutex mutex;
+  std::condition_variable queued, room, idle;
+  std::deque<File> queue;
+  std::size_t queue_bytes = 0;
+  bool busy = false;
+  bool closed = false;
+  AsyncWriterStats totals;
+  /// Used by the writer thread only.
+  FILE *container = nullptr;
+  /// Size of the container up to its last complete batch.
+  uint64_t container_size = 0;
+  /// A failed batch is still to be cut off the container.
+  bool truncate_pending = false;
+  std::thread worker;
+};
+
+/**
+ * @brief Calls `fn(name, data, size)` for every file of an artifact
+ * container.
+ *
+ * @return false if the container can not be read or ends in a partial
+ * entry, e.g. after a crash; the complete entries before it are visited.
+ */
+inline bool read_artifacts(
+    const std::string &path,
+    const std::function<void(const std::string &, const uint8_t *,
+                             std::size_t)> &fn) {
+  MappedFile file;
+  if (!file.open(path))
+    return false;
+  const uint8_t *p = file.data();
+  std::size_t left = file.size();
+  while (left > 0) {
+    ArtifactEntryHeader entry;
+    if (left < sizeof(entry))
+      return false;
+    std::memcpy(&entry, p, sizeof(entry));
+    if (std::memcmp(entry.magic, ARTIFACT_ENTRY_MAGIC, 4) != 0 ||
+        left - sizeof(entry) < entry.name_size ||
+        left - sizeof(entry) - entry.name_size < entry.size)
+      return false;
+    std::string name((const char *)p + sizeof(entry), entry.name_size);
+    fn(name, p + sizeof(entry) + entry.name_size, (std::size_t)entry.size);
+    std::size_t total = sizeof(entry) + entry.name_size + entry.size;
+    p += total;
+    left -= total;
+  }
+  return true;
+}
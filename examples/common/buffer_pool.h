@@ -0,0 +1,252 @@
+/// @file buffer_pool.h
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/// Alignment of every pooled buffer, one cache line.
+#define BUFFER_POOL_CACHE_LINE (64)
+/// Buffers of at least this size are aligned to (and sized in) huge pages.
+#define BUFFER_POOL_HUGE_PAGE (2 * 1024 * 1024)
+/// Default limit of the idle memory of one pool. Every thread using
+/// BufferPool::local() has a pool of its own, so the process may hold this
+/// much per such thread.
+#define BUFFER_POOL_MAX_CACHED_BYTES (512 * 1024 * 1024)
+
+struct BufferPoolStats {
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+  /// Buffers freed instead of cached because the pool was full.
+  std::size_t evictions = 0;
+  std::size_t cached_bytes = 0;
+  std::size_t cached_buffers = 0;
+
+  double hit_rate() const {
+    return hits + misses ? (double)hits / (hits + misses) : 0;
+  }
+};
+
+inline std::ostream &operator<<(std::ostream &out, const BufferPoolStats &s) {
+  return out << "Buffer pool: " << s.hits << " hits, " << s.misses
+             << " misses, " << s.evictions << " evictions, hit rate "
+             << s.hit_rate() * 100 << "%, " << s.cached_buffers
+             << " buffers / " << s.cached_bytes << " bytes cached";
+}
+
+namespace buffer_pool_detail {
+
+inline std::size_t alignment_for(std::size_t size) {
+  return size >= BUFFER_POOL_HUGE_PAGE ? BUFFER_POOL_HUGE_PAGE
+                                       : BUFFER_POOL_CACHE_LINE;
+}
+
+inline void *allocate(std::size_t size) {
+  std::size_t alignment = alignment_for(size);
+  std::size_t rounded = (size + alignment - 1) / alignment * alignment;
+#ifdef _WIN32
+  return _aligned_malloc(rounded, alignment);
+#else
+  void *p = nullptr;
+  if (posix_memalign(&p, alignment, rounded) != 0)
+    return nullptr;
+#ifdef MADV_HUGEPAGE
+  if (alignment == BUFFER_POOL_HUGE_PAGE)
+    madvise(p, rounded, MADV_HUGEPAGE);
+#endif
+  return p;
+#endif
+}
+
+inline void deallocate(void *p) {
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+/**
+ * @brief Cached buffers of one pool. Shared with the outstanding buffers so
+ * they can be returned even after the pool object is gone.
+ */
+struct Shelf {
+  explicit Shelf(std::size_t max_cached_bytes)
+      : max_cached_bytes(max_cached_bytes) {}
+  ~Shelf() { trim(); }
+
+  void *take(std::size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = free_buffers.find(size);
+    if (it != free_buffers.end() && !it->second.empty()) {
+      void *p = it->second.back();
+      it->second.pop_back();
+      stats.cached_bytes -= size;
+      --stats.cached_buffers;
+      ++stats.hits;
+      return p;
+    }
+    ++stats.misses;
+    return nullptr;
+  }
+
+  void give(std::size_t size, void *p) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (stats.cached_bytes + size <= max_cached_bytes) {
+        free_buffers[size].push_back(p);
+        stats.cached_bytes += size;
+        ++stats.cached_buffers;
+        return;
+      }
+      ++stats.evictions;
+    }
+    deallocate(p);
+  }
+
+  void trim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &entry : free_buffers)
+      for (void *p : entry.second)
+        deallocate(p);
+    free_buffers.clear();
+    stats.cached_bytes = 0;
+    stats.cached_buffers = 0;
+  }
+
+  std::mutex mutex;
+  std::map<std::size_t, std::vector<void *>> free_buffers;
+  std::size_t max_cached_bytes;
+  BufferPoolStats stats;
+};
+
+} // namespace buffer_pool_detail
+
+/**
+ * @brief Move-only handle of a pooled buffer. Returns the buffer to its pool
+ * on destruction.
+ */
+class PooledBuffer {
+public:
+  PooledBuffer() = default;
+  ~PooledBuffer() { reset(); }
+
+  PooledBuffer(const PooledBuffer &) = delete;
+  PooledBuffer &operator=(const PooledBuffer &) = delete;
+
+  PooledBuffer(PooledBuffer &&other) noexcept { swap(other); }
+  PooledBuffer &operator=(PooledBuffer &&other) noexcept {
+    if (this != &other) {
+      reset();
+      swap(other);
+    }
+    return *this;
+  }
+
+  uint8_t *data() const { return memory; }
+  std::size_t size() const { return bytes; }
+  explicit operator bool() const { return memory != nullptr; }
+
+  /**
+   * @brief Returns the buffer to the pool now.
+   */
+  void reset() {
+    if (memory)
+      shelf->give(bytes, memory);
+    memory = nullptr;
+    bytes = 0;
+    shelf.reset();
+  }
+
+private:
+  friend class BufferPool;
+
+  PooledBuffer(std::shared_ptr<buffer_pool_detail::Shelf> shelf,
+               std::size_t bytes, uint8_t *memory)
+      : shelf(std::move(shelf)), bytes(bytes), memory(memory) {}
+
+  void swap(PooledBuffer &other) noexcept {
+    std::swap(shelf, other.shelf);
+    std::swap(bytes, other.bytes);
+    std::swap(memory, other.memory);
+  }
+
+  std::shared_ptr<buffer_pool_detail::Shelf> shelf;
+  std::size_t bytes = 0;
+  uint8_t *memory = nullptr;
+};
+
+/**
+ * @brief Pool of reusable engine buffers (contexts, working sets, features).
+ *
+ * Buffers are cache-line aligned, buffers of 2 MB and more are aligned to
+ * huge pages. A released buffer is handed out again for a request of the
+ * same size, so steady-state calls do not touch the allocator and do not
+ * page-fault on fresh memory.
+ */
+class BufferPool {
+public:
+  /**
+   * @param max_cached_bytes upper limit for memory held by the idle buffers
+   * of this pool.
+   */
+  explicit BufferPool(
+      std::size_t max_cached_bytes = BUFFER_POOL_MAX_CACHED_BYTES)
+      : shelf(std::make_shared<buffer_pool_detail::Shelf>(max_cached_bytes)) {
+  }
+
+  BufferPool(const BufferPool &) = delete;
+  BufferPool &operator=(const BufferPool &) = delete;
+
+  /**
+   * @brief Pool of the calling thread. Its lock is never contended unless
+   * buffers are released on other threads.
+   *
+   * The limit of @ref BUFFER_POOL_MAX_CACHED_BYTES applies to each thread's
+   * pool separately, not to the process.
+   */
+  static BufferPool &local() {
+    thread_local BufferPool pool;
+    return pool;
+  }
+
+  /**
+   * @brief Hands out a buffer of at least `size` bytes.
+   *
+   * @param size requested size.
+   * @return the buffer, empty on allocation failure.
+   */
+  PooledBuffer acquire(std::size_t size) {
+    void *p = shelf->take(size);
+    if (!p)
+      p = buffer_pool_detail::allocate(size);
+    if (!p)
+      return PooledBuffer();
+    return PooledBuffer(shelf, size, (uint8_t *)p);
+  }
+
+  BufferPoolStats stats() const {
+    std::lock_guard<std::mutex> lock(shelf->mutex);
+    return shelf->stats;
+  }
+
+  /**
+   * @brief Frees all idle buffers.
+   */
+  void trim() { shelf->trim(); }
+
+private:
+  std::shared_ptr<buffer_pool_detail::Shelf> shelf;
+};
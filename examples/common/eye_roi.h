@@ -0,0 +1,193 @@
+/// @file eye_roi.h
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "image_kernels.h"
+#include "image_source.h"
+
+/// Size of an eye region, the crop the ire3 examples take.
+#define EYE_ROI_WIDTH (640)
+#define EYE_ROI_HEIGHT (480)
+/// Halvings of the frame before the coarse search, 1/8 resolution.
+#define EYE_ROI_LEVELS (3)
+/// Side of the dark window searched for, in coarse pixels: about a pupil.
+#define EYE_ROI_WINDOW (6)
+/// A window is an eye if it is this much darker than its surroundings.
+#define EYE_ROI_MIN_CONTRAST (16)
+/// Search radius around the previous eye when tracking, in full pixels.
+#define EYE_ROI_TRACK_RADIUS (96)
+
+/**
+ * @brief Eye region of a frame.
+ */
+struct EyeRoi {
+  /// Top-left corner of the @ref EYE_ROI_WIDTH x @ref EYE_ROI_HEIGHT
+  /// region, inside the frame.
+  int x = 0;
+  int y = 0;
+  /// Center of the pupil.
+  int center_x = 0;
+  int center_y = 0;
+  /// Mean gray level of the surroundings minus the one of the pupil window.
+  int contrast = 0;
+  bool found = false;
+};
+
+/**
+ * @brief Locates the two eye regions of a wide two-eye frame.
+ *
+ * Every half of the frame is downscaled by 2^@ref EYE_ROI_LEVELS with the
+ * box filter of @ref image_kernels and searched for its darkest
+ * @ref EYE_ROI_WINDOW square, the pupil, using a summed-area table. Once
+ * both eyes were found, the next frame only searches a window of
+ * @ref EYE_ROI_TRACK_RADIUS around the previous pupils, which downscales a
+ * small part of the frame; a frame where tracking loses an eye falls back
+ * to the full search.
+ *
+ * The regions are @ref ImageView::crop views into the frame, nothing is
+ * copied. Not thread-safe; use one detector per stream.
+ */
+class EyeRoiDetector {
+public:
+  /**
+   * @brief Locates the eyes of a frame of at least @ref EYE_ROI_WIDTH x
+   * @ref EYE_ROI_HEIGHT per eye.
+   *
+   * @return the number of eyes found, see @ref rois.
+   */
+  int detect(const ImageView &frame) {
+    if (frame.width < 2 * EYE_ROI_WIDTH || frame.height < EYE_ROI_HEIGHT)
+      return 0;
+    int half = frame.width / 2;
+    bool tracking = eyes[0].found && eyes[1].found;
+    for (int e = 0; e < 2; ++e) {
+      int x0 = e * half, x1 = e ? frame.width : half;
+      int y0 = 0, y1 = frame.height;
+      if (tracking) {
+        x0 = std::max(x0, eyes[e].center_x - EYE_ROI_TRACK_RADIUS);
+        x1 = std::min(x1, eyes[e].center_x + EYE_ROI_TRACK_RADIUS);
+        y0 = std::max(y0, eyes[e].center_y - EYE_ROI_TRACK_RADIUS);
+        y1 = std::min(y1, eyes[e].center_y + EYE_ROI_TRACK_RADIUS);
+      }
+      eyes[e] = search(frame, x0, y0, x1, y1);
+    }
+    if (tracking && !(eyes[0].found && eyes[1].found)) {
+      ++lost;
+      eyes = {};
+      return detect(frame);
+    }
+    ++(tracking ? tracked : full_searches);
+    return eyes[0].found + eyes[1].found;
+  }
+
+  /**
+   * @brief Eye regions of the last frame, the left one of the image first.
+   */
+  const std::array<EyeRoi, 2> &rois() const { return eyes; }
+
+  /**
+   * @brief Region of an eye as a view into the frame it was found in.
+   */
+  ImageView crop(const ImageView &frame, int eye) const {
+    return frame.crop(eyes[eye].x, eyes[eye].y, EYE_ROI_WIDTH, EYE_ROI_HEIGHT);
+  }
+
+  /**
+   * @brief Forgets the previous eyes, e.g. when the camera restarts.
+   */
+  void reset() { eyes = {}; }
+
+  /// Frames searched in full and frames tracked from the previous one.
+  std::size_t full_searches = 0;
+  std::size_t tracked = 0;
+  /// Tracked frames which lost an eye and were searched again.
+  std::size_t lost = 0;
+
+private:
+  /**
+   * @brief Searches the darkest pupil window of a part of the frame.
+   */
+  EyeRoi search(const ImageView &frame, int x0, int y0, int x1, int y1) {
+    const int scale = 1 << EYE_ROI_LEVELS;
+    int w = (x1 - x0) / scale, h = (y1 - y0) / scale;
+    EyeRoi roi;
+    if (w < EYE_ROI_WINDOW || h < EYE_ROI_WINDOW)
+      return roi;
+
+    // Each level reads the previous one, both live in the same buffer.
+    std::size_t size = 0;
+    for (int l = 1; l <= EYE_ROI_LEVELS; ++l)
+      size += (std::size_t)(w << (EYE_ROI_LEVELS - l)) *
+              (h << (EYE_ROI_LEVELS - l));
+    if (levels.size() < size)
+      levels = BufferPool::local().acquire(size);
+    ImageView level = frame.crop(x0, y0, w * scale, h * scale);
+    uint8_t *p = levels.data();
+    for (int l = 1; l <= EYE_ROI_LEVELS; ++l) {
+      ImageView next = {p, level.width / 2, level.height / 2, level.width / 2};
+      downscale_2x(level, next);
+      p += (std::size_t)next.width * next.height;
+      level = next;
+    }
+
+    // Summed-area table with a zero first row and column.
+    sums.assign((std::size_t)(w + 1) * (h + 1), 0);
+    for (int y = 0; y < h; ++y) {
+      uint32_t row = 0;
+      const uint8_t *src = level.row(y);
+      uint32_t *above = &sums[(std::size_t)y * (w + 1)];
+      uint32_t *out = above + w + 1;
+      for (int x = 0; x < w; ++x) {
+        row += src[x];
+        out[x + 1] = above[x + 1] + row;
+      }
+    }
+    auto rect = [&](int x, int y, int rw, int rh) {
+      const uint32_t *top = &sums[(std::size_t)y * (w + 1) + x];
+      const uint32_t *bottom = top + (std::size_t)rh * (w + 1);
+      return bottom[rw] - bottom[0] - top[rw] + top[0];
+    };
+
+    const int n = EYE_ROI_WINDOW;
+    uint32_t best = UINT32_MAX;
+    int best_x = 0, best_y = 0;
+    for (int y = 0; y + n <= h; ++y)
+      for (int x = 0; x + n <= w; ++x) {
+        uint32_t s = rect(x, y, n, n);
+        if (s < best) {
+          best = s;
+          best_x = x;
+          best_y = y;
+        }
+      }
+
+    // The surroundings are a window three times as large, clamped.
+    int sx = std::max(0, best_x - n), sy = std::max(0, best_y - n);
+    int sw = std::min(w, best_x + 2 * n) - sx;
+    int sh = std::min(h, best_y + 2 * n) - sy;
+    uint32_t ring = rect(sx, sy, sw, sh) - best;
+    int ring_area = sw * sh - n * n;
+    int inner_mean = (int)(best / (n * n));
+    int ring_mean = ring_area > 0 ? (int)(ring / ring_area) : inner_mean;
+
+    roi.contrast = ring_mean - inner_mean;
+    roi.found = roi.contrast >= EYE_ROI_MIN_CONTRAST;
+    roi.center_x = x0 + (best_x * 2 + n) * scale / 2;
+    roi.center_y = y0 + (best_y * 2 + n) * scale / 2;
+    roi.x = std::min(std::max(0, roi.center_x - EYE_ROI_WIDTH / 2),
+                     frame.width - EYE_ROI_WIDTH);
+    roi.y = std::min(std::max(0, roi.center_y - EYE_ROI_HEIGHT / 2),
+                     frame.height - EYE_ROI_HEIGHT);
+    return roi;
+  }
+
+  std::array<EyeRoi, 2> eyes;
+  PooledBuffer levels;
+  std::vector<uint32_t> sums;
+};
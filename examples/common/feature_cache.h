@@ -0,0 +1,229 @@
+/// @file feature_cache.h
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "iris_engine_v3.h"
+
+/**
+ * @brief 64-bit hash of a byte string (multiply-xorshift over 8-byte words).
+ */
+inline uint64_t hash_bytes(const uint8_t *data, std::size_t size) {
+  const uint64_t k = 0x9E3779B97F4A7C15ull;
+  uint64_t h = size * k;
+  auto mix = [&](uint64_t word) {
+    h ^= word * k;
+    h = (h << 29 | h >> 35) * 0xBF58476D1CE4E5B9ull;
+  };
+  std::size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, 8);
+    mix(word);
+  }
+  uint64_t tail = 0;
+  if (i < size)
+    std::memcpy(&tail, data + i, size - i);
+  mix(tail);
+  h ^= h >> 31;
+  h *= 0x94D049BB133111EBull;
+  return h ^ (h >> 32);
+}
+
+struct FeatureCacheStats {
+  std::size_t hits = 0;
+  std::size_t misses = 0;
+  std::size_t evictions = 0;
+  /// Lookups whose hash matched an entry of different content.
+  std::size_t collisions = 0;
+  /// Failed deserializations; nothing is cached for them.
+  std::size_t failures = 0;
+  std::size_t entries = 0;
+  std::size_t bytes = 0;
+
+  double hit_rate() const {
+    return hits + misses ? 100.0 * hits / (hits + misses) : 0;
+  }
+};
+
+inline std::ostream &operator<<(std::ostream &out,
+                                const FeatureCacheStats &stats) {
+  return out << "Feature cache: " << stats.hits << " hits, " << stats.misses
+             << " misses, hit rate " << stats.hit_rate() << "%, "
+             << stats.evictions << " evictions, " << stats.collisions
+             << " collisions, " << stats.failures << " failures, "
+             << stats.entries << " entries / " << stats.bytes << " bytes";
+}
+
+/**
+ * @brief Deserialized ire3 features held by a @ref FeatureCache.
+ */
+struct FeatureCacheEntry {
+  /// The serialized blob, compared on every hit so that a hash collision
+  /// can never return someone else's features.
+  std::vector<uint8_t> serialized;
+  std::vector<uint8_t> deserialized;
+
+  const uint8_t *data() const { return deserialized.data(); }
+  std::size_t bytes() const {
+    return serialized.size() + deserialized.size() + sizeof(*this);
+  }
+};
+
+/**
+ * @brief Bounded, sharded LRU cache from serialized ire3 features to their
+ * deserialized form.
+ *
+ * Lookups hash the serialized blob; the hash picks a shard with its own lock
+ * and LRU list, so concurrent verifications rarely contend. Misses
+ * deserialize outside the lock. Each shard holds at most its share of the
+ * memory cap, least recently used entries are evicted first. Entries are
+ * handed out as shared pointers and stay valid after eviction for as long
+ * as a caller holds them.
+ */
+class FeatureCache {
+public:
+  using Handle = std::shared_ptr<const FeatureCacheEntry>;
+
+  /**
+   * @param max_bytes memory cap over all shards, including the copies of the
+   * serialized blobs.
+   * @param num_shards number of independently locked shards.
+   */
+  explicit FeatureCache(std::size_t max_bytes, std::size_t num_shards = 16)
+      : shards(num_shards ? num_shards : 1),
+        max_shard_bytes(max_bytes / shards.size()) {
+    if (ire3_get_deserialized_features_size(&des_size) != IRE3_STATUS_OK)
+      des_size = 0;
+  }
+
+  FeatureCache(const FeatureCache &) = delete;
+  FeatureCache &operator=(const FeatureCache &) = delete;
+
+  /**
+   * @brief Returns the deserialized form of the features, deserializing and
+   * caching them on a miss.
+   *
+   * @param features serialized ire3 features.
+   * @param size size of the serialized features.
+   * @param rc optional status of a failed deserialization.
+   * @return the entry or nullptr if deserialization fails.
+   */
+  Handle get(const uint8_t *features, std::size_t size, int *rc = nullptr) {
+    uint64_t key = hash_bytes(features, size);
+    // The low bits are left to the index of the shard.
+    Shard &shard = shards[(key >> 40) % shards.size()];
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      auto it = shard.index.find(key);
+      if (it != shard.index.end()) {
+        if (same(*it->second->entry, features, size)) {
+          shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+          ++shard.stats.hits;
+          return it->second->entry;
+        }
+        ++shard.stats.collisions;
+      }
+      ++shard.stats.misses;
+    }
+
+    auto entry = std::make_shared<FeatureCacheEntry>();
+    entry->serialized.assign(features, features + size);
+    entry->deserialized.resize(des_size);
+    int status = ire3_deserialize_features(features, size,
+                                           entry->deserialized.data(),
+                                           des_size);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (status != IRE3_STATUS_OK) {
+      if (rc)
+        *rc = status;
+      ++shard.stats.failures;
+      return nullptr;
+    }
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      // Another thread inserted the same blob meanwhile, or the slot holds
+      // a colliding blob which the newer entry replaces.
+      if (same(*it->second->entry, features, size))
+        return it->second->entry;
+      shard.remove(it->second);
+    }
+    if (entry->bytes() > max_shard_bytes)
+      return entry; // too large to cache
+    shard.lru.push_front({key, entry});
+    shard.index[key] = shard.lru.begin();
+    shard.bytes += entry->bytes();
+    while (shard.bytes > max_shard_bytes) {
+      shard.remove(std::prev(shard.lru.end()));
+      ++shard.stats.evictions;
+    }
+    return entry;
+  }
+
+  /**
+   * @brief Drops all entries; statistics are kept.
+   */
+  void clear() {
+    for (auto &shard : shards) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      shard.lru.clear();
+      shard.index.clear();
+      shard.bytes = 0;
+    }
+  }
+
+  FeatureCacheStats stats() const {
+    FeatureCacheStats total;
+    for (const auto &shard : shards) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      total.hits += shard.stats.hits;
+      total.misses += shard.stats.misses;
+      total.evictions += shard.stats.evictions;
+      total.collisions += shard.stats.collisions;
+      total.failures += shard.stats.failures;
+      total.entries += shard.lru.size();
+      total.bytes += shard.bytes;
+    }
+    return total;
+  }
+
+private:
+  struct Node {
+    uint64_t key;
+    Handle entry;
+  };
+  using Lru = std::list<Node>;
+
+  struct alignas(64) Shard {
+    mutable std::mutex mutex;
+    Lru lru; // most recently used first
+    std::unordered_map<uint64_t, Lru::iterator> index;
+    std::size_t bytes = 0;
+    FeatureCacheStats stats;
+
+    void remove(Lru::iterator it) {
+      bytes -= it->entry->bytes();
+      index.erase(it->key);
+      lru.erase(it);
+    }
+  };
+
+  static bool same(const FeatureCacheEntry &entry, const uint8_t *features,
+                   std::size_t size) {
+    return entry.serialized.size() == size &&
+           std::memcmp(entry.serialized.data(), features, size) == 0;
+  }
+
+  std::vector<Shard> shards;
+  std::size_t max_shard_bytes;
+  std::size_t des_size = 0;
+};
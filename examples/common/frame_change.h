@@ -0,0 +1,189 @@
+/// @file frame_change.h
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <ostream>
+#include <stdint.h>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                   \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRAME_CHANGE_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FRAME_CHANGE_NEON 1
+#endif
+
+#include "image_source.h"
+
+/// Side of the blocks a frame is summarized in, one vector load wide.
+#define FRAME_CHANGE_BLOCK (16)
+
+/**
+ * @brief Sensitivity of @ref FrameChangeDetector.
+ */
+struct FrameChangeSettings {
+  /// A block changed when its mean grey level moved by more than this.
+  /// 0 disables the detector: every frame counts as changed.
+  int block_threshold = 4;
+  /// A frame changed when more than this fraction of its blocks did.
+  double max_changed_blocks = 0.001;
+  /// Only every `row_step`-th row of a block is summed.
+  int row_step = 2;
+  /// Consecutive frames skipped at most before one is processed anyway.
+  std::size_t max_skips = 15;
+};
+
+struct FrameChangeStats {
+  std::size_t frames = 0;
+  std::size_t skipped = 0;
+  /// Unchanged frames processed because `max_skips` was reached.
+  std::size_t forced = 0;
+};
+
+inline std::ostream &operator<<(std::ostream &out, const FrameChangeStats &s) {
+  return out << "Frame change: " << s.frames << " frames, " << s.skipped
+             << " skipped as unchanged ("
+             << (s.frames ? 100.0 * s.skipped / s.frames : 0) << "%), "
+             << s.forced << " forced";
+}
+
+namespace frame_change_detail {
+
+/**
+ * @brief Adds the sum of every 16 pixels of a row to `sums`.
+ */
+inline void block_sums_scalar(const uint8_t *row, int blocks,
+                              uint32_t *sums) {
+  for (int b = 0; b < blocks; ++b, row += FRAME_CHANGE_BLOCK) {
+    uint32_t s = 0;
+    for (int x = 0; x < FRAME_CHANGE_BLOCK; ++x)
+      s += row[x];
+    sums[b] += s;
+  }
+}
+
+#if defined(FRAME_CHANGE_SSE2)
+inline void block_sums(const uint8_t *row, int blocks, uint32_t *sums) {
+  const __m128i zero = _mm_setzero_si128();
+  for (int b = 0; b < blocks; ++b, row += FRAME_CHANGE_BLOCK) {
+    // Sums of absolute differences against zero: two 8-pixel sums.
+    __m128i s = _mm_sad_epu8(_mm_loadu_si128((const __m128i *)row), zero);
+    sums[b] += (uint32_t)(_mm_cvtsi128_si32(s) +
+                          _mm_cvtsi128_si32(_mm_srli_si128(s, 8)));
+  }
+}
+#elif defined(FRAME_CHANGE_NEON)
+inline void block_sums(const uint8_t *row, int blocks, uint32_t *sums) {
+  for (int b = 0; b < blocks; ++b, row += FRAME_CHANGE_BLOCK) {
+    uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vld1q_u8(row))));
+    sums[b] += (uint32_t)(vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1));
+  }
+}
+#else
+inline void block_sums(const uint8_t *row, int blocks, uint32_t *sums) {
+  block_sums_scalar(row, blocks, sums);
+}
+#endif
+
+} // namespace frame_change_detail
+
+/**
+ * @brief Detects frames which barely differ from the last processed one, so
+ * the caller can reuse its previous engine result instead of calling
+ * `irm2_on_frame` again.
+ *
+ * A frame is summarized as the mean grey level of every
+ * @ref FRAME_CHANGE_BLOCK square, summed with SSE2 or NEON over every
+ * `row_step`-th row: a few microseconds for a wide frame. The summary is
+ * compared with the one of the last frame that was processed, not the last
+ * frame seen, so slow drift still adds up to a change. Noise stays below
+ * `block_threshold`, while an eye moving or closing changes many blocks.
+ *
+ * Not thread-safe; use one detector per stream.
+ */
+class FrameChangeDetector {
+public:
+  explicit FrameChangeDetector(const FrameChangeSettings &settings = {})
+      : settings(settings) {}
+
+  /**
+   * @brief Decides whether a frame needs processing.
+   *
+   * A frame that does becomes the new reference.
+   *
+   * @return false if the previous result still holds for the frame.
+   */
+  bool changed(const ImageView &frame) {
+    ++totals.frames;
+    if (settings.block_threshold <= 0)
+      return true;
+    summarize(frame, current);
+    bool same_size = reference.size() == current.size() && !current.empty();
+    if (same_size && skips < settings.max_skips &&
+        !differs(current, reference)) {
+      ++skips;
+      ++totals.skipped;
+      return false;
+    }
+    if (same_size && skips >= settings.max_skips)
+      ++totals.forced;
+    skips = 0;
+    reference.swap(current);
+    return true;
+  }
+
+  /**
+   * @brief Makes the next frame count as changed, e.g. after the engine
+   * state was reset.
+   */
+  void reset() {
+    reference.clear();
+    skips = 0;
+  }
+
+  const FrameChangeStats &stats() const { return totals; }
+
+private:
+  /**
+   * @brief Mean grey level of every complete block of the frame.
+   */
+  void summarize(const ImageView &frame, std::vector<uint8_t> &means) {
+    int blocks_x = frame.width / FRAME_CHANGE_BLOCK;
+    int blocks_y = frame.height / FRAME_CHANGE_BLOCK;
+    int step = std::max(settings.row_step, 1);
+    int rows = (FRAME_CHANGE_BLOCK + step - 1) / step;
+    uint32_t samples = (uint32_t)rows * FRAME_CHANGE_BLOCK;
+    means.resize((std::size_t)blocks_x * blocks_y);
+    sums.resize(blocks_x);
+    for (int by = 0; by < blocks_y; ++by) {
+      std::fill(sums.begin(), sums.end(), 0);
+      for (int y = 0; y < FRAME_CHANGE_BLOCK; y += step)
+        frame_change_detail::block_sums(
+            frame.row(by * FRAME_CHANGE_BLOCK + y), blocks_x, sums.data());
+      uint8_t *out = &means[(std::size_t)by * blocks_x];
+      for (int bx = 0; bx < blocks_x; ++bx)
+        out[bx] = (uint8_t)((sums[bx] + samples / 2) / samples);
+    }
+  }
+
+  bool differs(const std::vector<uint8_t> &a,
+               const std::vector<uint8_t> &b) const {
+    std::size_t limit = (std::size_t)(settings.max_changed_blocks * a.size());
+    std::size_t changed = 0;
+    for (std::size_t i = 0; i < a.size(); ++i)
+      if (std::abs(a[i] - b[i]) > settings.block_threshold &&
+          ++changed > limit)
+        return true;
+    return false;
+  }
+
+  FrameChangeSettings settings;
+  std::vector<uint8_t> reference, current;
+  std::vector<uint32_t> sums;
+  std::size_t skips = 0;
+  FrameChangeStats totals;
+};
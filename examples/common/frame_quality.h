@@ -0,0 +1,263 @@
+/// @file frame_quality.h
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                   \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRAME_QUALITY_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FRAME_QUALITY_NEON 1
+#endif
+
+#include "image_source.h"
+
+/**
+ * @brief Cheap image statistics computed before an engine call.
+ */
+struct FrameQuality {
+  /// Variance of the 4-neighbour Laplacian, grows with focus.
+  double focus = 0;
+  /// Mean grey level.
+  double brightness = 0;
+  /// Fraction of pixels below 16.
+  double dark = 0;
+  /// Fraction of pixels at 240 and above.
+  double saturated = 0;
+  /// Ratio of the stronger to the weaker of the mean horizontal and vertical
+  /// gradients. Close to 1 for sharp images, grows with linear motion blur.
+  double anisotropy = 1;
+  /// Exposure histogram, 16 bins of 16 grey levels.
+  uint32_t histogram[16] = {0};
+};
+
+/**
+ * @brief Limits of @ref judge_quality. The defaults only reject hopeless
+ * exposure; focus and motion limits come from calibration against the
+ * engine's sharpness.
+ */
+struct QualityThresholds {
+  double min_focus = 0;
+  double max_dark = 0.6;
+  double max_saturated = 0.2;
+  double max_anisotropy = 1e9;
+};
+
+enum class QualityVerdict { Pass, UnderExposed, OverExposed, Motion, Blurred };
+
+inline const char *to_string(QualityVerdict verdict) {
+  switch (verdict) {
+  case QualityVerdict::Pass:
+    return "pass";
+  case QualityVerdict::UnderExposed:
+    return "under-exposed";
+  case QualityVerdict::OverExposed:
+    return "over-exposed";
+  case QualityVerdict::Motion:
+    return "motion";
+  case QualityVerdict::Blurred:
+    return "blurred";
+  }
+  return "?";
+}
+
+namespace frame_quality_detail {
+
+struct Sums {
+  int64_t laplacian = 0;
+  uint64_t laplacian_squared = 0;
+  uint64_t gradient_x = 0;
+  uint64_t gradient_y = 0;
+};
+
+/**
+ * @brief Accumulates the Laplacian and gradients of row `c` for columns
+ * [x, end). `up` and `down` are the neighbouring rows, columns x - 1 and end
+ * must exist.
+ */
+inline void row_scalar(const uint8_t *up, const uint8_t *c,
+                       const uint8_t *down, int x, int end, Sums &sums) {
+  for (; x < end; ++x) {
+    int laplacian = 4 * c[x] - c[x - 1] - c[x + 1] - up[x] - down[x];
+    sums.laplacian += laplacian;
+    sums.laplacian_squared += (uint64_t)(laplacian * laplacian);
+    sums.gradient_x += (uint64_t)std::abs(c[x + 1] - c[x - 1]);
+    sums.gradient_y += (uint64_t)std::abs(down[x] - up[x]);
+  }
+}
+
+// The 32-bit lanes of the vector loops are flushed every BLOCKS blocks of 16
+// pixels: 128 blocks of squared Laplacians (at most 4 * 1020^2 per lane and
+// block) stay below 2^31.
+#define FRAME_QUALITY_BLOCKS 128
+
+#if defined(FRAME_QUALITY_SSE2)
+inline void row_simd(const uint8_t *up, const uint8_t *c, const uint8_t *down,
+                     int x, int end, Sums &sums) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  auto absdiff = [](__m128i a, __m128i b) {
+    return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+  };
+  auto laplacian = [](__m128i m, __m128i l, __m128i r, __m128i u, __m128i d) {
+    __m128i neighbours =
+        _mm_add_epi16(_mm_add_epi16(l, r), _mm_add_epi16(u, d));
+    return _mm_sub_epi16(_mm_slli_epi16(m, 2), neighbours);
+  };
+  while (x + 16 <= end) {
+    int blocks = std::min((end - x) / 16, FRAME_QUALITY_BLOCKS);
+    __m128i sum = zero, squared = zero, gx = zero, gy = zero;
+    for (int b = 0; b < blocks; ++b, x += 16) {
+      __m128i m = _mm_loadu_si128((const __m128i *)(c + x));
+      __m128i l = _mm_loadu_si128((const __m128i *)(c + x - 1));
+      __m128i r = _mm_loadu_si128((const __m128i *)(c + x + 1));
+      __m128i u = _mm_loadu_si128((const __m128i *)(up + x));
+      __m128i d = _mm_loadu_si128((const __m128i *)(down + x));
+      gx = _mm_add_epi64(gx, _mm_sad_epu8(absdiff(l, r), zero));
+      gy = _mm_add_epi64(gy, _mm_sad_epu8(absdiff(u, d), zero));
+      __m128i lo = laplacian(
+          _mm_unpacklo_epi8(m, zero), _mm_unpacklo_epi8(l, zero),
+          _mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(u, zero),
+          _mm_unpacklo_epi8(d, zero));
+      __m128i hi = laplacian(
+          _mm_unpackhi_epi8(m, zero), _mm_unpackhi_epi8(l, zero),
+          _mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(u, zero),
+          _mm_unpackhi_epi8(d, zero));
+      sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(lo, ones),
+                                             _mm_madd_epi16(hi, ones)));
+      squared = _mm_add_epi32(squared, _mm_add_epi32(_mm_madd_epi16(lo, lo),
+                                                     _mm_madd_epi16(hi, hi)));
+    }
+    alignas(16) int32_t s[4], q[4];
+    alignas(16) uint64_t h[2], v[2];
+    _mm_store_si128((__m128i *)s, sum);
+    _mm_store_si128((__m128i *)q, squared);
+    _mm_store_si128((__m128i *)h, gx);
+    _mm_store_si128((__m128i *)v, gy);
+    for (int i = 0; i < 4; ++i) {
+      sums.laplacian += s[i];
+      sums.laplacian_squared += (uint32_t)q[i];
+    }
+    sums.gradient_x += h[0] + h[1];
+    sums.gradient_y += v[0] + v[1];
+  }
+  row_scalar(up, c, down, x, end, sums);
+}
+#elif defined(FRAME_QUALITY_NEON)
+inline void row_simd(const uint8_t *up, const uint8_t *c, const uint8_t *down,
+                     int x, int end, Sums &sums) {
+  auto laplacian = [](uint8x8_t m, uint8x8_t l, uint8x8_t r, uint8x8_t u,
+                      uint8x8_t d) {
+    uint16x8_t neighbours = vaddq_u16(vaddl_u8(l, r), vaddl_u8(u, d));
+    return vsubq_s16(vreinterpretq_s16_u16(vshll_n_u8(m, 2)),
+                     vreinterpretq_s16_u16(neighbours));
+  };
+  while (x + 16 <= end) {
+    int blocks = std::min((end - x) / 16, FRAME_QUALITY_BLOCKS);
+    int32x4_t sum = vdupq_n_s32(0), squared = vdupq_n_s32(0);
+    uint32x4_t gx = vdupq_n_u32(0), gy = vdupq_n_u32(0);
+    for (int b = 0; b < blocks; ++b, x += 16) {
+      uint8x16_t m = vld1q_u8(c + x);
+      uint8x16_t l = vld1q_u8(c + x - 1);
+      uint8x16_t r = vld1q_u8(c + x + 1);
+      uint8x16_t u = vld1q_u8(up + x);
+      uint8x16_t d = vld1q_u8(down + x);
+      gx = vpadalq_u16(gx, vpaddlq_u8(vabdq_u8(l, r)));
+      gy = vpadalq_u16(gy, vpaddlq_u8(vabdq_u8(u, d)));
+      int16x8_t lo = laplacian(vget_low_u8(m), vget_low_u8(l), vget_low_u8(r),
+                               vget_low_u8(u), vget_low_u8(d));
+      int16x8_t hi =
+          laplacian(vget_high_u8(m), vget_high_u8(l), vget_high_u8(r),
+                    vget_high_u8(u), vget_high_u8(d));
+      sum = vpadalq_s16(vpadalq_s16(sum, lo), hi);
+      squared = vmlal_s16(squared, vget_low_s16(lo), vget_low_s16(lo));
+      squared = vmlal_s16(squared, vget_high_s16(lo), vget_high_s16(lo));
+      squared = vmlal_s16(squared, vget_low_s16(hi), vget_low_s16(hi));
+      squared = vmlal_s16(squared, vget_high_s16(hi), vget_high_s16(hi));
+    }
+    int32_t s[4], q[4];
+    uint32_t h[4], v[4];
+    vst1q_s32(s, sum);
+    vst1q_s32(q, squared);
+    vst1q_u32(h, gx);
+    vst1q_u32(v, gy);
+    for (int i = 0; i < 4; ++i) {
+      sums.laplacian += s[i];
+      sums.laplacian_squared += (uint32_t)q[i];
+      sums.gradient_x += h[i];
+      sums.gradient_y += v[i];
+    }
+  }
+  row_scalar(up, c, down, x, end, sums);
+}
+#else
+inline void row_simd(const uint8_t *up, const uint8_t *c, const uint8_t *down,
+                     int x, int end, Sums &sums) {
+  row_scalar(up, c, down, x, end, sums);
+}
+#endif
+
+} // namespace frame_quality_detail
+
+/**
+ * @brief Measures focus, exposure and motion blur of an image.
+ *
+ * Only every `row_step`-th row is looked at (and every 4th pixel of it for
+ * the histogram), which keeps the cost of a VGA frame well below a
+ * millisecond. The Laplacian and gradient sums use SSE2 or NEON when
+ * available.
+ *
+ * @param image image to measure, any stride.
+ * @param row_step row sampling step, 1 for every row.
+ */
+inline FrameQuality measure_quality(const ImageView &image, int row_step = 2) {
+  FrameQuality quality;
+  if (image.width < 3 || image.height < 3)
+    return quality;
+  frame_quality_detail::Sums sums;
+  uint64_t brightness = 0, samples = 0, rows = 0;
+  for (int y = 1; y < image.height - 1; y += std::max(row_step, 1), ++rows) {
+    const uint8_t *c = image.row(y);
+    frame_quality_detail::row_simd(image.row(y - 1), c, image.row(y + 1), 1,
+                                   image.width - 1, sums);
+    for (int x = 0; x < image.width; x += 4, ++samples) {
+      ++quality.histogram[c[x] >> 4];
+      brightness += c[x];
+    }
+  }
+  double n = (double)rows * (image.width - 2);
+  double mean = sums.laplacian / n;
+  quality.focus = sums.laplacian_squared / n - mean * mean;
+  quality.brightness = (double)brightness / samples;
+  quality.dark = (double)quality.histogram[0] / samples;
+  quality.saturated = (double)quality.histogram[15] / samples;
+  double gx = sums.gradient_x / n, gy = sums.gradient_y / n;
+  double weaker = std::min(gx, gy), stronger = std::max(gx, gy);
+  // Flat images have no meaningful direction.
+  quality.anisotropy = weaker > 0.5 ? stronger / weaker : 1;
+  return quality;
+}
+
+/**
+ * @brief Decides whether a frame is worth an engine call.
+ *
+ * Exposure is checked first since focus and motion measures are meaningless
+ * on clipped images.
+ */
+inline QualityVerdict judge_quality(const FrameQuality &quality,
+                                    const QualityThresholds &thresholds) {
+  if (quality.dark > thresholds.max_dark)
+    return QualityVerdict::UnderExposed;
+  if (quality.saturated > thresholds.max_saturated)
+    return QualityVerdict::OverExposed;
+  if (quality.anisotropy > thresholds.max_anisotropy)
+    return QualityVerdict::Motion;
+  if (quality.focus < thresholds.min_focus)
+    return QualityVerdict::Blurred;
+  return QualityVerdict::Pass;
+}
@@ -0,0 +1,214 @@
+/// @file frame_ring.h
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+#include "buffer_pool.h"
+
+/**
+ * @brief One slot of a @ref FrameRing.
+ */
+struct Frame {
+  uint8_t *pixels = nullptr;
+  int width = 0;
+  int height = 0;
+  /// Distance between rows in bytes, the value for `irm2_settings` stride.
+  int stride = 0;
+  /// Sequence number assigned by the producer, starts at 0.
+  uint64_t sequence = 0;
+  /// Time the frame was fully received from the camera.
+  std::chrono::steady_clock::time_point arrival;
+};
+
+struct FrameRingStats {
+  std::size_t produced = 0;
+  std::size_t consumed = 0;
+  /// Ready frames skipped by the consumer in favour of a newer one.
+  std::size_t dropped_stale = 0;
+  /// Ready frames overwritten by the producer because no slot was free.
+  std::size_t dropped_overrun = 0;
+};
+
+/**
+ * @brief Preallocated ring of frame buffers between a capture thread and a
+ * processing thread.
+ *
+ * Neither side ever blocks the other: when processing falls behind, the
+ * producer reuses the oldest unprocessed slot and, with
+ * @ref Policy::Latest, the consumer always takes the newest frame and
+ * discards older ones, so the engine never works on a stale picture.
+ */
+class FrameRing {
+public:
+  enum class Policy {
+    /// The consumer gets the newest ready frame, older ones are dropped.
+    Latest,
+    /// The consumer gets ready frames in order; only overruns drop frames.
+    Fifo
+  };
+
+  /**
+   * @param num_slots number of buffers, at least 3 (one being written, one
+   * being processed, one ready).
+   * @param width frame width.
+   * @param height frame height.
+   * @param stride row stride in bytes, at least `width`.
+   * @param policy frame selection policy.
+   */
+  FrameRing(std::size_t num_slots, int width, int height, int stride,
+            Policy policy)
+      : policy(policy) {
+    slots.resize(num_slots < 3 ? 3 : num_slots);
+    for (auto &slot : slots) {
+      slot.buffer =
+          BufferPool::local().acquire((std::size_t)stride * height);
+      slot.frame.pixels = slot.buffer.data();
+      slot.frame.width = width;
+      slot.frame.height = height;
+      slot.frame.stride = stride;
+    }
+  }
+
+  FrameRing(const FrameRing &) = delete;
+  FrameRing &operator=(const FrameRing &) = delete;
+
+  /**
+   * @brief Producer side: gets a slot to fill. Never blocks.
+   */
+  Frame *begin_write() {
+    std::lock_guard<std::mutex> lock(mutex);
+    Slot *slot = find(State::Free);
+    if (!slot) {
+      slot = oldest_ready();
+      ++stats.dropped_overrun;
+    }
+    slot->state = State::Writing;
+    return &slot->frame;
+  }
+
+  /**
+   * @brief Producer side: publishes the slot filled after @ref begin_write.
+   */
+  void end_write(Frame *frame) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Slot &slot = owner(frame);
+      slot.frame.sequence = next_sequence++;
+      slot.frame.arrival = std::chrono::steady_clock::now();
+      slot.state = State::Ready;
+      ++stats.produced;
+    }
+    ready.notify_one();
+  }
+
+  /**
+   * @brief Producer side: returns a slot without publishing it.
+   */
+  void cancel_write(Frame *frame) {
+    std::lock_guard<std::mutex> lock(mutex);
+    owner(frame).state = State::Free;
+  }
+
+  /**
+   * @brief Producer side: no more frames will come.
+   */
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+    ready.notify_all();
+  }
+
+  /**
+   * @brief Consumer side: waits for a frame to process.
+   *
+   * @return the frame or nullptr once the ring is closed and drained.
+   */
+  Frame *begin_read() {
+    std::unique_lock<std::mutex> lock(mutex);
+    Slot *slot = nullptr;
+    ready.wait(lock, [&] {
+      slot = policy == Policy::Latest ? newest_ready() : oldest_ready();
+      return slot || closed;
+    });
+    if (!slot)
+      return nullptr;
+    if (policy == Policy::Latest)
+      for (auto &other : slots)
+        if (other.state == State::Ready && &other != slot) {
+          other.state = State::Free;
+          ++stats.dropped_stale;
+        }
+    slot->state = State::Reading;
+    ++stats.consumed;
+    return &slot->frame;
+  }
+
+  /**
+   * @brief Consumer side: hands the processed slot back.
+   */
+  void end_read(Frame *frame) {
+    std::lock_guard<std::mutex> lock(mutex);
+    owner(frame).state = State::Free;
+  }
+
+  FrameRingStats get_stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+  }
+
+private:
+  enum class State { Free, Writing, Ready, Reading };
+
+  struct Slot {
+    PooledBuffer buffer;
+    Frame frame;
+    State state = State::Free;
+  };
+
+  Slot *find(State state) {
+    for (auto &slot : slots)
+      if (slot.state == state)
+        return &slot;
+    return nullptr;
+  }
+
+  Slot *oldest_ready() {
+    Slot *best = nullptr;
+    for (auto &slot : slots)
+      if (slot.state == State::Ready &&
+          (!best || slot.frame.sequence < best->frame.sequence))
+        best = &slot;
+    return best;
+  }
+
+  Slot *newest_ready() {
+    Slot *best = nullptr;
+    for (auto &slot : slots)
+      if (slot.state == State::Ready &&
+          (!best || slot.frame.sequence > best->frame.sequence))
+        best = &slot;
+    return best;
+  }
+
+  Slot &owner(Frame *frame) {
+    Slot *slot = &slots[0];
+    while (&slot->frame != frame)
+      ++slot;
+    return *slot;
+  }
+
+  std::vector<Slot> slots;
+  Policy policy;
+  mutable std::mutex mutex;
+  std::condition_variable ready;
+  uint64_t next_sequence = 0;
+  bool closed = false;
+  FrameRingStats stats;
+};
@@ -0,0 +1,261 @@
+/// @file gallery_file.h
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+/**
+ * @brief Header of the on-disk gallery.
+ *
+ * The file layout is
+ *
+ *     header | ire3 feature blobs | irm2 templates | template ids | index
+ *
+ * All sections start on a @ref GALLERY_FILE_ALIGNMENT boundary. irm2
+ * templates are fixed-size records, ire3 serialized features are variable
+ * size and are located through the index. Numbers are stored in host byte
+ * order.
+ */
+struct GalleryFileHeader {
+  char magic[8];
+  uint32_t version;
+  /// Size of a single irm2 template record, usually `IRM2_TEMPLATE_SIZE`.
+  uint32_t template_size;
+  uint64_t template_count;
+  uint64_t templates_offset;
+  uint64_t template_ids_offset;
+  uint64_t feature_count;
+  uint64_t index_offset;
+  uint64_t file_size;
+};
+
+/**
+ * @brief Location of one ire3 serialized feature set inside the file.
+ */
+struct GalleryIndexEntry {
+  uint64_t offset;
+  uint32_t size;
+  /// Caller defined identifier, e.g. the subject the features belong to.
+  uint32_t id;
+};
+
+#define GALLERY_FILE_MAGIC "IRGALLRY"
+#define GALLERY_FILE_VERSION (1)
+#define GALLERY_FILE_ALIGNMENT (64)
+
+/**
+ * @brief Sequential writer of a gallery file.
+ *
+ * Feature blobs are streamed to disk as they are added; templates and the
+ * index are kept in memory and written by @ref finish. The file is written
+ * under a temporary name and renamed on success, so processes which map the
+ * previous version keep a consistent view.
+ */
+class GalleryFileWriter {
+public:
+  GalleryFileWriter() = default;
+  ~GalleryFileWriter() {
+    if (file) {
+      fclose(file);
+      std::remove(temp_path.c_str());
+    }
+  }
+
+  GalleryFileWriter(const GalleryFileWriter &) = delete;
+  GalleryFileWriter &operator=(const GalleryFileWriter &) = delete;
+
+  /**
+   * @brief Creates the file.
+   *
+   * @param file_path output file name.
+   * @param irm2_template_size size of irm2 template records, 0 if the
+   * gallery holds ire3 features only.
+   * @return true on success.
+   */
+  bool open(const std::string &file_path, uint32_t irm2_template_size) {
+    path = file_path;
+    temp_path = path + ".tmp";
+    template_size = irm2_template_size;
+    file = fopen(temp_path.c_str(), "wb");
+    if (!file)
+      return false;
+    GalleryFileHeader header = {};
+    return write(&header, sizeof(header)) && pad();
+  }
+
+  /**
+   * @brief Appends an irm2 template of `template_size` bytes.
+   */
+  bool add_irm2_template(const uint8_t *iris_template, uint32_t id) {
+    if (!file || template_size == 0)
+      return false;
+    templates.insert(templates.end(), iris_template,
+                     iris_template + template_size);
+    template_ids.push_back(id);
+    return true;
+  }
+
+  /**
+   * @brief Appends ire3 serialized (encrypted) features.
+   */
+  bool add_ire3_features(const uint8_t *features, std::size_t size,
+                         uint32_t id) {
+    if (!file)
+      return false;
+    index.push_back({(uint64_t)position, (uint32_t)size, id});
+    return write(features, size) && pad();
+  }
+
+  std::size_t template_count() const { return template_ids.size(); }
+  std::size_t feature_count() const { return index.size(); }
+
+  /**
+   * @brief Writes the remaining sections and publishes the file.
+   *
+   * @return true on success.
+   */
+  bool finish() {
+    if (!file)
+      return false;
+    GalleryFileHeader header = {};
+    memcpy(header.magic, GALLERY_FILE_MAGIC, sizeof(header.magic));
+    header.version = GALLERY_FILE_VERSION;
+    header.template_size = template_size;
+    header.template_count = template_ids.size();
+    header.templates_offset = position;
+    bool ok = write(templates.data(), templates.size()) && pad();
+    header.template_ids_offset = position;
+    ok = ok &&
+         write(template_ids.data(), template_ids.size() * sizeof(uint32_t)) &&
+         pad();
+    header.feature_count = index.size();
+    header.index_offset = position;
+    ok = ok && write(index.data(), index.size() * sizeof(GalleryIndexEntry));
+    header.file_size = position;
+    ok = ok && fseek(file, 0, SEEK_SET) == 0 &&
+         fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = fclose(file) == 0 && ok;
+    file = nullptr;
+    if (ok) {
+#ifdef _WIN32
+      // rename() does not replace existing files on Windows.
+      std::remove(path.c_str());
+#endif
+      ok = std::rename(temp_path.c_str(), path.c_str()) == 0;
+    }
+    if (!ok)
+      std::remove(temp_path.c_str());
+    return ok;
+  }
+
+private:
+  bool write(const void *data, std::size_t size) {
+    if (size == 0)
+      return true;
+    position += size;
+    return fwrite(data, size, 1, file) == 1;
+  }
+
+  bool pad() {
+    static const uint8_t zeros[GALLERY_FILE_ALIGNMENT] = {0};
+    std::size_t rest = position % GALLERY_FILE_ALIGNMENT;
+    return rest == 0 || write(zeros, GALLERY_FILE_ALIGNMENT - rest);
+  }
+
+  std::string path;
+  std::string temp_path;
+  FILE *file = nullptr;
+  std::size_t position = 0;
+  uint32_t template_size = 0;
+  std::vector<uint8_t> templates;
+  std::vector<uint32_t> template_ids;
+  std::vector<GalleryIndexEntry> index;
+};
+
+/**
+ * @brief Read-only, zero-copy view of a gallery file.
+ *
+ * Templates and features point straight into the mapping and stay valid
+ * while the object is alive.
+ */
+class GalleryFile {
+public:
+  /**
+   * @brief Maps and validates the file.
+   *
+   * @return true if the file is a valid gallery.
+   */
+  bool open(const std::string &path) {
+    header = nullptr;
+    if (!file.open(path))
+      return false;
+    if (file.size() < sizeof(GalleryFileHeader))
+      return false;
+    auto h = (const GalleryFileHeader *)file.data();
+    uint64_t size = file.size();
+    if (memcmp(h->magic, GALLERY_FILE_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != GALLERY_FILE_VERSION || h->file_size != size)
+      return false;
+    if (!fits(h->templates_offset, h->template_count, h->template_size) ||
+        !fits(h->template_ids_offset, h->template_count, sizeof(uint32_t)) ||
+        !fits(h->index_offset, h->feature_count, sizeof(GalleryIndexEntry)))
+      return false;
+    auto entries = (const GalleryIndexEntry *)(file.data() + h->index_offset);
+    for (uint64_t i = 0; i < h->feature_count; ++i)
+      if (!fits(entries[i].offset, entries[i].size, 1))
+        return false;
+    header = h;
+    return true;
+  }
+
+  /**
+   * @brief Asks the OS to prefetch the whole file.
+   */
+  void will_need() const { file.will_need(); }
+
+  std::size_t template_size() const { return header->template_size; }
+  std::size_t template_count() const { return header->template_count; }
+  const uint8_t *irm2_template(std::size_t i) const {
+    return file.data() + header->templates_offset + i * header->template_size;
+  }
+  uint32_t template_id(std::size_t i) const {
+    return ((const uint32_t *)(file.data() + header->template_ids_offset))[i];
+  }
+
+  /**
+   * @brief Template pointers in the form `irm2_init_identification` expects.
+   */
+  std::vector<const uint8_t *> irm2_template_pointers() const {
+    std::vector<const uint8_t *> pointers(template_count());
+    for (std::size_t i = 0; i < pointers.size(); ++i)
+      pointers[i] = irm2_template(i);
+    return pointers;
+  }
+
+  std::size_t feature_count() const { return header->feature_count; }
+  const uint8_t *ire3_features(std::size_t i) const {
+    return file.data() + entry(i).offset;
+  }
+  std::size_t ire3_features_size(std::size_t i) const { return entry(i).size; }
+  uint32_t feature_id(std::size_t i) const { return entry(i).id; }
+
+private:
+  bool fits(uint64_t offset, uint64_t count, uint64_t record_size) const {
+    return offset <= file.size() &&
+           (record_size == 0 || count <= (file.size() - offset) / record_size);
+  }
+
+  const GalleryIndexEntry &entry(std::size_t i) const {
+    return ((const GalleryIndexEntry *)(file.data() +
+                                        header->index_offset))[i];
+  }
+
+  MappedFile file;
+  const GalleryFileHeader *header = nullptr;
+};
@@ -0,0 +1,429 @@
+/// @file gallery_loader.h
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <ostream>
+#include <random>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <unistd.h>
+#endif
+
+#include "iris_engine_v3.h"
+#include "buffer_pool.h"
+#include "feature_cache.h"
+#include "gallery_file.h"
+#include "ire3_gallery_matcher.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+/**
+ * @brief Header of a gallery snapshot: the deserialized features of a
+ * gallery file, ready to be mapped and compared.
+ *
+ * The file layout is
+ *
+ *     header | ids | records
+ *
+ * Records are `stride` bytes apart and start on a
+ * @ref GALLERY_SNAPSHOT_ALIGNMENT boundary. Deserialized features are
+ * specific to the ire3 build and the host, so a snapshot is only a local
+ * cache: it is used when `library_hash`, `gallery_hash` and a few canary
+ * records still match, and rebuilt otherwise.
+ */
+struct GallerySnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  /// @ref ire3_library_fingerprint of the library that wrote the records.
+  uint64_t library_hash;
+  /// @ref gallery_fingerprint of the source gallery file.
+  uint64_t gallery_hash;
+  uint64_t deserialized_size;
+  uint64_t stride;
+  uint64_t count;
+  uint64_t ids_offset;
+  uint64_t records_offset;
+  uint64_t file_size;
+};
+
+#define GALLERY_SNAPSHOT_MAGIC "IRSNAPSH"
+#define GALLERY_SNAPSHOT_VERSION (1)
+/// Records start on a page, so the mapping hands them out aligned.
+#define GALLERY_SNAPSHOT_ALIGNMENT (4096)
+/// Records deserialized again to check a snapshot before it is used.
+#define GALLERY_SNAPSHOT_CANARIES (4)
+
+/**
+ * @brief Hash of the binary `ire3_deserialize_features` is loaded from and
+ * of the deserialized features size.
+ *
+ * The binary is the shared library, or the executable itself when ire3 is
+ * linked statically; any rebuild changes the hash.
+ *
+ * @return 0 if the binary can not be located or read.
+ */
+inline uint64_t ire3_library_fingerprint() {
+  std::string path;
+#ifdef _WIN32
+  HMODULE module = NULL;
+  char name[MAX_PATH];
+  if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                             GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+                         (LPCSTR)&ire3_deserialize_features, &module) &&
+      GetModuleFileNameA(module, name, MAX_PATH) > 0)
+    path = name;
+#else
+  Dl_info info;
+  if (dladdr((void *)&ire3_deserialize_features, &info) && info.dli_fname)
+    path = info.dli_fname;
+#endif
+  MappedFile binary;
+  size_t des_size = 0;
+  if (path.empty() || !binary.open(path) || binary.size() == 0 ||
+      ire3_get_deserialized_features_size(&des_size) != IRE3_STATUS_OK)
+    return 0;
+  return hash_bytes(binary.data(), binary.size()) ^ des_size;
+}
+
+/**
+ * @brief Hash identifying a gallery file: its size, modification time and
+ * index. Gallery files are replaced by rename, so every new version gets a
+ * new modification time.
+ */
+inline uint64_t gallery_fingerprint(const std::string &path,
+                                    const GalleryFile &file) {
+  std::error_code error;
+  auto size = std::filesystem::file_size(path, error);
+  auto time = std::filesystem::last_write_time(path, error);
+  uint64_t hash = hash_bytes((const uint8_t *)&size, sizeof(size));
+  int64_t ticks = time.time_since_epoch().count();
+  hash = hash * 0x100000001B3ull ^
+         hash_bytes((const uint8_t *)&ticks, sizeof(ticks));
+  for (std::size_t i = 0; i < file.feature_count(); ++i) {
+    uint64_t entry[2] = {file.ire3_features_size(i), file.feature_id(i)};
+    hash = hash * 0x100000001B3ull ^
+           hash_bytes((const uint8_t *)entry, sizeof(entry));
+  }
+  return hash;
+}
+
+struct GalleryLoadOptions {
+  /// Snapshot file, empty to always deserialize.
+  std::string snapshot;
+  /// Writes the snapshot after deserializing when it was missing or stale.
+  bool write_snapshot = true;
+  /// Asks the OS to read a mapped snapshot in ahead of the first search.
+  bool will_need = true;
+};
+
+struct GalleryLoadStats {
+  /// Total time of @ref LoadedGallery::load.
+  double seconds = 0;
+  /// Time spent fingerprinting the library and the gallery.
+  double fingerprint_seconds = 0;
+  /// Time spent deserializing, or mapping and checking the snapshot.
+  double load_seconds = 0;
+  /// Time spent writing the snapshot.
+  double snapshot_seconds = 0;
+  bool from_snapshot = false;
+  bool snapshot_written = false;
+  /// Why an existing snapshot was not used, empty if it was or none exists.
+  std::string snapshot_rejected;
+};
+
+inline std::ostream &operator<<(std::ostream &out, const GalleryLoadStats &s) {
+  out << (s.from_snapshot ? "mapped from snapshot" : "deserialized") << " in "
+      << s.load_seconds << " s";
+  if (s.fingerprint_seconds > 0)
+    out << " after " << s.fingerprint_seconds << " s of fingerprinting";
+  if (s.snapshot_written)
+    out << ", snapshot written in " << s.snapshot_seconds << " s";
+  if (!s.snapshot_rejected.empty())
+    out << ", snapshot not used: " << s.snapshot_rejected;
+  return out;
+}
+
+/**
+ * @brief Deserialized ire3 gallery held in one contiguous region.
+ *
+ * @ref load deserializes the features of a gallery file with all threads of
+ * a pool into a single preallocated region, records cache-line aligned
+ * back to back. With a snapshot path the region is written to disk once
+ * and later loads on the same host just map it, after checking that the
+ * ire3 library and the gallery are still those it was made from.
+ */
+class LoadedGallery {
+public:
+  /**
+   * @brief Loads the gallery.
+   *
+   * @param path gallery file name.
+   * @param pool threads deserializing the records.
+   * @param options snapshot options.
+   * @param stats optional output for the timings.
+   * @return true on success, see @ref error otherwise.
+   */
+  bool load(const std::string &path, ThreadPool &pool,
+            const GalleryLoadOptions &options = {},
+            GalleryLoadStats *stats = nullptr) {
+    TRACE_SCOPE("gallery_load");
+    using Clock = std::chrono::steady_clock;
+    auto seconds = [](Clock::time_point from) {
+      return std::chrono::duration<double>(Clock::now() - from).count();
+    };
+    auto start = Clock::now();
+    GalleryLoadStats local;
+    GalleryLoadStats &s = stats ? *stats : local;
+    s = GalleryLoadStats();
+    reset();
+
+    GalleryFile file;
+    if (!file.open(path))
+      return fail("can not open gallery " + path);
+    size_t des_size = 0;
+    if (ire3_get_deserialized_features_size(&des_size) != IRE3_STATUS_OK)
+      return fail("can not query the deserialized features size");
+
+    uint64_t library_hash = 0, gallery_hash = 0;
+    if (!options.snapshot.empty()) {
+      auto fingerprint_start = Clock::now();
+      library_hash = ire3_library_fingerprint();
+      gallery_hash = gallery_fingerprint(path, file);
+      s.fingerprint_seconds = seconds(fingerprint_start);
+      if (!library_hash)
+        s.snapshot_rejected = "the ire3 library can not be fingerprinted";
+    }
+
+    auto load_start = Clock::now();
+    if (library_hash &&
+        map_snapshot(options.snapshot, file, des_size, library_hash,
+                     gallery_hash, s.snapshot_rejected)) {
+      if (options.will_need)
+        snapshot.will_need();
+      s.from_snapshot = true;
+      s.load_seconds = seconds(load_start);
+      s.seconds = seconds(start);
+      return true;
+    }
+    if (!deserialize(file, des_size, pool))
+      return false;
+    s.load_seconds = seconds(load_start);
+
+    if (library_hash && options.write_snapshot) {
+      auto snapshot_start = Clock::now();
+      s.snapshot_written = write_snapshot(options.snapshot, des_size,
+                                          library_hash, gallery_hash);
+      s.snapshot_seconds = seconds(snapshot_start);
+    }
+    s.seconds = seconds(start);
+    return true;
+  }
+
+  const FeatureGalleryView &view() const { return records; }
+  std::size_t size() const { return records.count; }
+  uint32_t id(std::size_t i) const { return ids[i]; }
+  const std::string &error() const { return message; }
+
+private:
+  void reset() {
+    memory.reset();
+    snapshot.close();
+    own_ids.clear();
+    ids = nullptr;
+    records = FeatureGalleryView();
+    message.clear();
+  }
+
+  bool fail(const std::string &reason) {
+    message = reason;
+    return false;
+  }
+
+  /**
+   * @brief Deserializes every record of the gallery in parallel into one
+   * region.
+   */
+  bool deserialize(const GalleryFile &file, std::size_t des_size,
+                   ThreadPool &pool) {
+    TRACE_SCOPE("gallery_deserialize");
+    std::size_t n = file.feature_count();
+    std::size_t stride = (des_size + 63) / 64 * 64;
+    memory = BufferPool::local().acquire(std::max<std::size_t>(1, n * stride));
+    own_ids.resize(n);
+    std::atomic<std::size_t> failed{0};
+    // Consecutive records per task keep the writes of a worker sequential.
+    std::size_t chunk = std::max<std::size_t>(1, n / (pool.size() * 16));
+    pool.parallel_for((n + chunk - 1) / chunk, [&](std::size_t task,
+                                                   std::size_t) {
+      std::size_t end = std::min(n, (task + 1) * chunk);
+      for (std::size_t i = task * chunk; i < end; ++i) {
+        own_ids[i] = file.feature_id(i);
+        if (ire3_deserialize_features(file.ire3_features(i),
+                                      file.ire3_features_size(i),
+                                      memory.data() + i * stride,
+                                      des_size) != IRE3_STATUS_OK)
+          ++failed;
+      }
+    });
+    if (failed)
+      return fail(std::to_string(failed.load()) +
+                  " records can not be deserialized");
+    ids = own_ids.data();
+    records = {memory.data(), stride, n};
+    return true;
+  }
+
+  /**
+   * @brief Maps the snapshot if it was made from this gallery by this
+   * library.
+   *
+   * @param reason set to why the snapshot can not be used.
+   */
+  bool map_snapshot(const std::string &path, const GalleryFile &file,
+                    std::size_t des_size, uint64_t library_hash,
+                    uint64_t gallery_hash, std::string &reason) {
+    TRACE_SCOPE("gallery_map_snapshot");
+    std::error_code error;
+    if (!std::filesystem::exists(path, error))
+      return false;
+    auto reject = [&](const char *why) {
+      snapshot.close();
+      reason = why;
+      return false;
+    };
+    if (!snapshot.open(path) ||
+        snapshot.size() < sizeof(GallerySnapshotHeader))
+      return reject("unreadable");
+    auto h = (const GallerySnapshotHeader *)snapshot.data();
+    std::size_t n = file.feature_count();
+    if (memcmp(h->magic, GALLERY_SNAPSHOT_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != GALLERY_SNAPSHOT_VERSION ||
+        h->file_size != snapshot.size())
+      return reject("not a snapshot of this version");
+    if (h->library_hash != library_hash || h->deserialized_size != des_size)
+      return reject("made by another ire3 library");
+    if (h->gallery_hash != gallery_hash || h->count != n)
+      return reject("made from another gallery");
+    if (h->stride < des_size || h->ids_offset > snapshot.size() ||
+        n > (snapshot.size() - h->ids_offset) / sizeof(uint32_t) ||
+        h->records_offset % GALLERY_SNAPSHOT_ALIGNMENT != 0 ||
+        h->records_offset > snapshot.size() ||
+        n > (snapshot.size() - h->records_offset) / h->stride)
+      return reject("truncated");
+
+    // Deserializes a few records again and compares them byte for byte:
+    // catches a library whose output changed while its binary hash did not
+    // and damage to the records themselves.
+    const uint8_t *data = snapshot.data() + h->records_offset;
+    const uint32_t *snapshot_ids =
+        (const uint32_t *)(snapshot.data() + h->ids_offset);
+    std::vector<uint8_t> canary(des_size);
+    std::size_t canaries = std::min<std::size_t>(n, GALLERY_SNAPSHOT_CANARIES);
+    for (std::size_t c = 0; c < canaries; ++c) {
+      // Spread over the gallery, first and last record included.
+      std::size_t i = canaries > 1 ? c * (n - 1) / (canaries - 1) : 0;
+      if (ire3_deserialize_features(file.ire3_features(i),
+                                    file.ire3_features_size(i), canary.data(),
+                                    des_size) != IRE3_STATUS_OK ||
+          memcmp(canary.data(), data + i * h->stride, des_size) != 0 ||
+          snapshot_ids[i] != file.feature_id(i))
+        return reject("canary record differs");
+    }
+    ids = snapshot_ids;
+    records = {data, (std::size_t)h->stride, n};
+    return true;
+  }
+
+  /**
+   * @brief Writes the loaded region as a snapshot, under a temporary name
+   * renamed on success so that a concurrent load never maps half a file.
+   * The temporary name is unique to the process and the call, so loads
+   * writing the same snapshot at once never write into the same file.
+   */
+  bool write_snapshot(const std::string &path, std::size_t des_size,
+                      uint64_t library_hash, uint64_t gallery_hash) {
+    TRACE_SCOPE("gallery_write_snapshot");
+    std::size_t n = records.count;
+    GallerySnapshotHeader header = {};
+    memcpy(header.magic, GALLERY_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = GALLERY_SNAPSHOT_VERSION;
+    header.library_hash = library_hash;
+    header.gallery_hash = gallery_hash;
+    header.deserialized_size = des_size;
+    header.stride = records.record_size;
+    header.count = n;
+    header.ids_offset = sizeof(header);
+    header.records_offset =
+        (header.ids_offset + n * sizeof(uint32_t) +
+         GALLERY_SNAPSHOT_ALIGNMENT - 1) /
+        GALLERY_SNAPSHOT_ALIGNMENT * GALLERY_SNAPSHOT_ALIGNMENT;
+    header.file_size = header.records_offset + n * header.stride;
+
+    std::string temp = temp_name(path);
+    FILE *out = fopen(temp.c_str(), "wb");
+    if (!out)
+      return false;
+    std::vector<uint8_t> padding(header.records_offset - header.ids_offset -
+                                 n * sizeof(uint32_t));
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+              (n == 0 || fwrite(ids, sizeof(uint32_t), n, out) == n) &&
+              (padding.empty() ||
+               fwrite(padding.data(), padding.size(), 1, out) == 1) &&
+              (n == 0 ||
+               fwrite(records.data, header.stride, n, out) == n) &&
+              fflush(out) == 0;
+#ifndef _WIN32
+    ok = ok && fsync(fileno(out)) == 0;
+#endif
+    ok = fclose(out) == 0 && ok;
+    std::error_code error;
+    if (ok)
+      std::filesystem::rename(temp, path, error);
+    if (!ok || error) {
+      std::remove(temp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  /**
+   * @brief `path` with the process id and a random suffix, in the same
+   * directory so that the rename stays on one file system.
+   */
+  static std::string temp_name(const std::string &path) {
+#ifdef _WIN32
+    unsigned long pid = GetCurrentProcessId();
+#else
+    unsigned long pid = (unsigned long)getpid();
+#endif
+    std::random_device random;
+    char suffix[64];
+    snprintf(suffix, sizeof(suffix), ".%lu.%08x%08x.tmp", pid, random(),
+             random());
+    return path + suffix;
+  }
+
+  PooledBuffer memory;
+  MappedFile snapshot;
+  std::vector<uint32_t> own_ids;
+  const uint32_t *ids = nullptr;
+  FeatureGalleryView records;
+  std::string message;
+};
@@ -0,0 +1,190 @@
+/// @file gallery_slab.h
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+#include "buffer_pool.h"
+
+/// Default number of records per slab.
+#define GALLERY_SLAB_RECORDS (1024)
+/// Records are padded to a multiple of this, so every record starts on its
+/// own cache line.
+#define GALLERY_SLAB_ALIGNMENT (64)
+/// Records a scan prefetches ahead of the one being compared.
+#define GALLERY_PREFETCH_DISTANCE (2)
+/// At most this many leading bytes of a record are prefetched.
+#define GALLERY_PREFETCH_MAX_BYTES (4096)
+
+/**
+ * @brief Hints the CPU to start loading a record into the cache.
+ */
+inline void prefetch_record(const uint8_t *record, std::size_t size) {
+#if defined(__GNUC__) || defined(__clang__)
+  size = std::min<std::size_t>(size, GALLERY_PREFETCH_MAX_BYTES);
+  for (std::size_t offset = 0; offset < size; offset += GALLERY_SLAB_ALIGNMENT)
+    __builtin_prefetch(record + offset, 0, 3);
+#else
+  (void)record;
+  (void)size;
+#endif
+}
+
+/**
+ * @brief Gallery of fixed-size records (irm2 templates or deserialized ire3
+ * features) stored contiguously in 64-byte aligned slabs.
+ *
+ * Record data, ids and live flags are kept in separate arrays, so a scan
+ * streams through the record memory and the bookkeeping stays out of its
+ * cache lines. A record is addressed by its slot; slots stay valid until
+ * @ref compact. Slabs come from the thread's @ref BufferPool, so growing the
+ * gallery never moves existing records.
+ *
+ * Not thread-safe; concurrent scans are fine while nothing is added,
+ * removed or compacted.
+ */
+class SlabGallery {
+public:
+  /**
+   * @param record_size bytes per record, e.g. IRM2_TEMPLATE_SIZE or the
+   * `ire3_get_deserialized_features_size`.
+   * @param slab_records records per slab.
+   */
+  explicit SlabGallery(std::size_t record_size,
+                       std::size_t slab_records = GALLERY_SLAB_RECORDS)
+      : size(record_size),
+        stride((record_size + GALLERY_SLAB_ALIGNMENT - 1) /
+               GALLERY_SLAB_ALIGNMENT * GALLERY_SLAB_ALIGNMENT),
+        per_slab(std::max<std::size_t>(1, slab_records)) {}
+
+  SlabGallery(SlabGallery &&) = default;
+  SlabGallery &operator=(SlabGallery &&) = default;
+  SlabGallery(const SlabGallery &) = delete;
+  SlabGallery &operator=(const SlabGallery &) = delete;
+
+  /**
+   * @brief Appends a record to be filled in place, e.g. by
+   * `ire3_deserialize_features`.
+   *
+   * @param slot receives the slot of the record, may be nullptr.
+   * @return the zeroed record memory of `record_size` bytes.
+   */
+  uint8_t *append(uint32_t id, std::size_t *slot = nullptr) {
+    std::size_t s = ids.size();
+    if (s == slabs.size() * per_slab)
+      slabs.push_back(BufferPool::local().acquire(per_slab * stride));
+    ids.push_back(id);
+    alive.push_back(1);
+    ++live;
+    if (slot)
+      *slot = s;
+    uint8_t *p = at(s);
+    std::memset(p, 0, stride);
+    return p;
+  }
+
+  /**
+   * @brief Appends a copy of `record_size` bytes.
+   *
+   * @return the slot of the record.
+   */
+  std::size_t add(const uint8_t *record, uint32_t id) {
+    std::size_t s;
+    std::memcpy(append(id, &s), record, size);
+    return s;
+  }
+
+  /**
+   * @brief Marks a record as deleted; scans skip it until @ref compact
+   * reclaims its memory.
+   *
+   * @return false if the slot is not a live record.
+   */
+  bool remove(std::size_t slot) {
+    if (slot >= ids.size() || !alive[slot])
+      return false;
+    alive[slot] = 0;
+    --live;
+    return true;
+  }
+
+  /**
+   * @brief Moves the live records down over the deleted ones, keeping their
+   * order, and gives the emptied slabs back to the pool.
+   *
+   * Slots change; @ref id still names every record.
+   *
+   * @return the number of slots reclaimed.
+   */
+  std::size_t compact() {
+    std::size_t to = 0;
+    for (std::size_t from = 0; from < ids.size(); ++from) {
+      if (!alive[from])
+        continue;
+      if (to != from) {
+        std::memcpy(at(to), at(from), stride);
+        ids[to] = ids[from];
+        alive[to] = 1;
+      }
+      ++to;
+    }
+    std::size_t reclaimed = ids.size() - to;
+    ids.resize(to);
+    alive.resize(to);
+    slabs.resize((to + per_slab - 1) / per_slab);
+    return reclaimed;
+  }
+
+  /// Number of slots, including deleted records.
+  std::size_t slots() const { return ids.size(); }
+  /// Number of live records.
+  std::size_t count() const { return live; }
+  std::size_t record_size() const { return size; }
+  /// Distance between consecutive records of a slab.
+  std::size_t record_stride() const { return stride; }
+  /// Bytes held by the slabs.
+  std::size_t bytes() const { return slabs.size() * per_slab * stride; }
+
+  bool is_live(std::size_t slot) const { return alive[slot] != 0; }
+  uint32_t id(std::size_t slot) const { return ids[slot]; }
+
+  const uint8_t *record(std::size_t slot) const {
+    return slabs[slot / per_slab].data() + (slot % per_slab) * stride;
+  }
+
+  /**
+   * @brief Live record or nullptr for a deleted one.
+   */
+  const uint8_t *live_record(std::size_t slot) const {
+    return alive[slot] ? record(slot) : nullptr;
+  }
+
+  /**
+   * @brief Pointers to the live records in slot order, e.g. for
+   * `irm2_init_identification`. Valid until the next @ref compact.
+   */
+  std::vector<const uint8_t *> pointers() const {
+    std::vector<const uint8_t *> result;
+    result.reserve(live);
+    for (std::size_t s = 0; s < ids.size(); ++s)
+      if (alive[s])
+        result.push_back(record(s));
+    return result;
+  }
+
+private:
+  uint8_t *at(std::size_t slot) {
+    return slabs[slot / per_slab].data() + (slot % per_slab) * stride;
+  }
+
+  std::size_t size;
+  std::size_t stride;
+  std::size_t per_slab;
+  std::vector<PooledBuffer> slabs;
+  std::vector<uint32_t> ids;
+  std::vector<uint8_t> alive;
+  std::size_t live = 0;
+};
@@ -0,0 +1,446 @@
+/// @file image_kernels.h
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) ||           \
+    defined(_M_IX86)
+#define IMAGE_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define IMAGE_KERNELS_TARGET(isa)
+#else
+#define IMAGE_KERNELS_TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define IMAGE_KERNELS_NEON 1
+#include <arm_neon.h>
+#endif
+
+#include "image_source.h"
+
+/**
+ * @brief Row kernels of one instruction set.
+ *
+ * Every implementation produces exactly the same bytes as the scalar one;
+ * `preprocess_example --self-test` checks this on the running CPU.
+ */
+struct ImageKernels {
+  const char *name;
+  /// Packed RAW10 (4 pixels in 5 bytes, the fifth holding the low bits) to
+  /// the 8 most significant bits. `width` is a multiple of 4.
+  void (*unpack_raw10)(const uint8_t *src, uint8_t *dst, int width);
+  /// dst[i] = src[width - 1 - i].
+  void (*reverse)(const uint8_t *src, uint8_t *dst, int width);
+  /// Transposes a `width` x `height` block, strides may be negative.
+  void (*transpose)(const uint8_t *src, std::ptrdiff_t src_stride,
+                    uint8_t *dst, std::ptrdiff_t dst_stride, int width,
+                    int height);
+  /// 2x2 box filter of two rows, (a + b + c + d + 2) >> 2.
+  void (*downscale_2x)(const uint8_t *row0, const uint8_t *row1, uint8_t *dst,
+                       int dst_width);
+};
+
+namespace image_kernels_detail {
+
+inline void unpack_raw10_scalar(const uint8_t *src, uint8_t *dst, int width) {
+  for (int x = 0; x < width; x += 4, src += 5, dst += 4) {
+    dst[0] = src[0];
+    dst[1] = src[1];
+    dst[2] = src[2];
+    dst[3] = src[3];
+  }
+}
+
+inline void reverse_scalar(const uint8_t *src, uint8_t *dst, int width) {
+  for (int x = 0; x < width; ++x)
+    dst[x] = src[width - 1 - x];
+}
+
+/**
+ * @brief Transposes the columns [x0, width) of all rows and the rows
+ * [y0, height) of the columns [0, x0): what the tiled loops leave over.
+ */
+inline void transpose_edges(const uint8_t *src, std::ptrdiff_t src_stride,
+                            uint8_t *dst, std::ptrdiff_t dst_stride,
+                            int width, int height, int x0, int y0) {
+  for (int y = 0; y < height; ++y)
+    for (int x = y < y0 ? x0 : 0; x < width; ++x)
+      dst[x * dst_stride + y] = src[y * src_stride + x];
+}
+
+inline void transpose_scalar(const uint8_t *src, std::ptrdiff_t src_stride,
+                             uint8_t *dst, std::ptrdiff_t dst_stride,
+                             int width, int height) {
+  transpose_edges(src, src_stride, dst, dst_stride, width, height, 0, 0);
+}
+
+inline void downscale_2x_scalar(const uint8_t *row0, const uint8_t *row1,
+                                uint8_t *dst, int dst_width) {
+  for (int x = 0; x < dst_width; ++x, row0 += 2, row1 += 2)
+    dst[x] = (uint8_t)((row0[0] + row0[1] + row1[0] + row1[1] + 2) >> 2);
+}
+
+#if defined(IMAGE_KERNELS_X86)
+
+// Byte positions of the 8 most significant bits of three RAW10 groups.
+#define IMAGE_KERNELS_RAW10_SHUFFLE                                            \
+  0, 1, 2, 3, 5, 6, 7, 8, 10, 11, 12, 13, -1, -1, -1, -1
+
+IMAGE_KERNELS_TARGET("ssse3")
+inline void unpack_raw10_ssse3(const uint8_t *src, uint8_t *dst, int width) {
+  const __m128i shuffle = _mm_setr_epi8(IMAGE_KERNELS_RAW10_SHUFFLE);
+  int x = 0;
+  // 12 pixels per step; the 16-byte load and store stay inside the rows.
+  for (; width - x >= 16; x += 12, src += 15, dst += 12)
+    _mm_storeu_si128((__m128i *)dst,
+                     _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src),
+                                      shuffle));
+  unpack_raw10_scalar(src, dst, width - x);
+}
+
+IMAGE_KERNELS_TARGET("ssse3")
+inline void reverse_ssse3(const uint8_t *src, uint8_t *dst, int width) {
+  const __m128i shuffle =
+      _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  int x = 0;
+  for (; x + 16 <= width; x += 16)
+    _mm_storeu_si128(
+        (__m128i *)(dst + x),
+        _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i *)(src + width - 16 - x)),
+            shuffle));
+  reverse_scalar(src, dst + x, width - x);
+}
+
+/**
+ * @brief 16x16 byte transpose: four rounds of interleaving row i with row
+ * i + 8 rotate the 8-bit (row, column) index by 4 bits.
+ */
+IMAGE_KERNELS_TARGET("sse2")
+inline void transpose_tile_sse2(const uint8_t *src, std::ptrdiff_t src_stride,
+                                uint8_t *dst, std::ptrdiff_t dst_stride) {
+  __m128i a[16], b[16];
+  for (int i = 0; i < 16; ++i)
+    a[i] = _mm_loadu_si128((const __m128i *)(src + i * src_stride));
+  for (int round = 0; round < 4; ++round) {
+    for (int i = 0; i < 8; ++i) {
+      b[2 * i] = _mm_unpacklo_epi8(a[i], a[i + 8]);
+      b[2 * i + 1] = _mm_unpackhi_epi8(a[i], a[i + 8]);
+    }
+    for (int i = 0; i < 16; ++i)
+      a[i] = b[i];
+  }
+  for (int i = 0; i < 16; ++i)
+    _mm_storeu_si128((__m128i *)(dst + i * dst_stride), a[i]);
+}
+
+IMAGE_KERNELS_TARGET("sse2")
+inline void transpose_sse2(const uint8_t *src, std::ptrdiff_t src_stride,
+                           uint8_t *dst, std::ptrdiff_t dst_stride, int width,
+                           int height) {
+  int x0 = width & ~15, y0 = height & ~15;
+  for (int y = 0; y < y0; y += 16)
+    for (int x = 0; x < x0; x += 16)
+      transpose_tile_sse2(src + y * src_stride + x, src_stride,
+                          dst + x * dst_stride + y, dst_stride);
+  transpose_edges(src, src_stride, dst, dst_stride, width, height, x0, y0);
+}
+
+IMAGE_KERNELS_TARGET("ssse3")
+inline __m128i downscale_16_ssse3(const uint8_t *row0, const uint8_t *row1) {
+  const __m128i ones = _mm_set1_epi8(1);
+  const __m128i two = _mm_set1_epi16(2);
+  __m128i lo = _mm_add_epi16(
+      _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)row0), ones),
+      _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)row1), ones));
+  __m128i hi = _mm_add_epi16(
+      _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(row0 + 16)), ones),
+      _mm_maddubs_epi16(_mm_loadu_si128((const __m128i *)(row1 + 16)), ones));
+  return _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(lo, two), 2),
+                          _mm_srli_epi16(_mm_add_epi16(hi, two), 2));
+}
+
+IMAGE_KERNELS_TARGET("ssse3")
+inline void downscale_2x_ssse3(const uint8_t *row0, const uint8_t *row1,
+                               uint8_t *dst, int dst_width) {
+  int x = 0;
+  for (; x + 16 <= dst_width; x += 16)
+    _mm_storeu_si128((__m128i *)(dst + x),
+                     downscale_16_ssse3(row0 + 2 * x, row1 + 2 * x));
+  downscale_2x_scalar(row0 + 2 * x, row1 + 2 * x, dst + x, dst_width - x);
+}
+
+IMAGE_KERNELS_TARGET("avx2")
+inline void unpack_raw10_avx2(const uint8_t *src, uint8_t *dst, int width) {
+  const __m256i shuffle = _mm256_setr_epi8(IMAGE_KERNELS_RAW10_SHUFFLE,
+                                           IMAGE_KERNELS_RAW10_SHUFFLE);
+  const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+  int x = 0;
+  // 24 pixels per step from two lanes of three groups each.
+  for (; width - x >= 32; x += 24, src += 30, dst += 24) {
+    __m256i groups = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)src)),
+        _mm_loadu_si128((const __m128i *)(src + 15)), 1);
+    _mm256_storeu_si256(
+        (__m256i *)dst,
+        _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(groups, shuffle),
+                                    pack));
+  }
+  unpack_raw10_ssse3(src, dst, width - x);
+}
+
+IMAGE_KERNELS_TARGET("avx2")
+inline void reverse_avx2(const uint8_t *src, uint8_t *dst, int width) {
+  const __m256i shuffle = _mm256_setr_epi8(
+      15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11,
+      10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(src + width - 32 - x));
+    _mm256_storeu_si256(
+        (__m256i *)(dst + x),
+        _mm256_permute4x64_epi64(_mm256_shuffle_epi8(v, shuffle), 0x4E));
+  }
+  reverse_ssse3(src, dst + x, width - x);
+}
+
+IMAGE_KERNELS_TARGET("avx2")
+inline void downscale_2x_avx2(const uint8_t *row0, const uint8_t *row1,
+                              uint8_t *dst, int dst_width) {
+  const __m256i ones = _mm256_set1_epi8(1);
+  const __m256i two = _mm256_set1_epi16(2);
+  int x = 0;
+  for (; x + 32 <= dst_width; x += 32) {
+    const uint8_t *p0 = row0 + 2 * x, *p1 = row1 + 2 * x;
+    __m256i lo = _mm256_add_epi16(
+        _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)p0), ones),
+        _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)p1), ones));
+    __m256i hi = _mm256_add_epi16(
+        _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)(p0 + 32)),
+                             ones),
+        _mm256_maddubs_epi16(_mm256_loadu_si256((const __m256i *)(p1 + 32)),
+                             ones));
+    __m256i packed =
+        _mm256_packus_epi16(_mm256_srli_epi16(_mm256_add_epi16(lo, two), 2),
+                            _mm256_srli_epi16(_mm256_add_epi16(hi, two), 2));
+    // packus works per 128-bit lane, restore the order of the 64-bit halves.
+    _mm256_storeu_si256((__m256i *)(dst + x),
+                        _mm256_permute4x64_epi64(packed, 0xD8));
+  }
+  downscale_2x_ssse3(row0 + 2 * x, row1 + 2 * x, dst + x, dst_width - x);
+}
+
+inline bool cpu_supports(const char *isa) {
+#if defined(_MSC_VER) && !defined(__clang__)
+  int info[4];
+  __cpuid(info, 1);
+  bool ssse3 = (info[2] >> 9) & 1;
+  bool os_avx = ((info[2] >> 27) & 1) && ((info[2] >> 28) & 1) &&
+                (_xgetbv(0) & 6) == 6;
+  __cpuidex(info, 7, 0);
+  bool avx2 = os_avx && ((info[1] >> 5) & 1);
+  return std::strcmp(isa, "avx2") == 0 ? avx2 : ssse3;
+#else
+  return std::strcmp(isa, "avx2") == 0 ? __builtin_cpu_supports("avx2")
+                                       : __builtin_cpu_supports("ssse3");
+#endif
+}
+
+#elif defined(IMAGE_KERNELS_NEON)
+
+inline void unpack_raw10_neon(const uint8_t *src, uint8_t *dst, int width) {
+  static const uint8_t indices[16] = {0,  1,  2,  3,  5,    6,    7,    8,
+                                      10, 11, 12, 13, 0xFF, 0xFF, 0xFF, 0xFF};
+  const uint8x16_t shuffle = vld1q_u8(indices);
+  int x = 0;
+  for (; width - x >= 16; x += 12, src += 15, dst += 12)
+    vst1q_u8(dst, vqtbl1q_u8(vld1q_u8(src), shuffle));
+  unpack_raw10_scalar(src, dst, width - x);
+}
+
+inline void reverse_neon(const uint8_t *src, uint8_t *dst, int width) {
+  int x = 0;
+  for (; x + 16 <= width; x += 16) {
+    uint8x16_t v = vrev64q_u8(vld1q_u8(src + width - 16 - x));
+    vst1q_u8(dst + x, vcombine_u8(vget_high_u8(v), vget_low_u8(v)));
+  }
+  reverse_scalar(src, dst + x, width - x);
+}
+
+inline void transpose_tile_neon(const uint8_t *src, std::ptrdiff_t src_stride,
+                                uint8_t *dst, std::ptrdiff_t dst_stride) {
+  uint8x16_t a[16], b[16];
+  for (int i = 0; i < 16; ++i)
+    a[i] = vld1q_u8(src + i * src_stride);
+  for (int round = 0; round < 4; ++round) {
+    for (int i = 0; i < 8; ++i) {
+      b[2 * i] = vzip1q_u8(a[i], a[i + 8]);
+      b[2 * i + 1] = vzip2q_u8(a[i], a[i + 8]);
+    }
+    for (int i = 0; i < 16; ++i)
+      a[i] = b[i];
+  }
+  for (int i = 0; i < 16; ++i)
+    vst1q_u8(dst + i * dst_stride, a[i]);
+}
+
+inline void transpose_neon(const uint8_t *src, std::ptrdiff_t src_stride,
+                           uint8_t *dst, std::ptrdiff_t dst_stride, int width,
+                           int height) {
+  int x0 = width & ~15, y0 = height & ~15;
+  for (int y = 0; y < y0; y += 16)
+    for (int x = 0; x < x0; x += 16)
+      transpose_tile_neon(src + y * src_stride + x, src_stride,
+                          dst + x * dst_stride + y, dst_stride);
+  transpose_edges(src, src_stride, dst, dst_stride, width, height, x0, y0);
+}
+
+inline void downscale_2x_neon(const uint8_t *row0, const uint8_t *row1,
+                              uint8_t *dst, int dst_width) {
+  int x = 0;
+  for (; x + 16 <= dst_width; x += 16) {
+    const uint8_t *p0 = row0 + 2 * x, *p1 = row1 + 2 * x;
+    uint16x8_t lo = vpadalq_u8(vpaddlq_u8(vld1q_u8(p0)), vld1q_u8(p1));
+    uint16x8_t hi =
+        vpadalq_u8(vpaddlq_u8(vld1q_u8(p0 + 16)), vld1q_u8(p1 + 16));
+    // The rounding narrowing shift is exactly (sum + 2) >> 2.
+    vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2)));
+  }
+  downscale_2x_scalar(row0 + 2 * x, row1 + 2 * x, dst + x, dst_width - x);
+}
+
+#endif
+
+} // namespace image_kernels_detail
+
+/**
+ * @brief Kernel sets usable on the running CPU, the scalar reference first
+ * and the fastest last.
+ */
+inline const std::vector<const ImageKernels *> &available_image_kernels() {
+  using namespace image_kernels_detail;
+  static const ImageKernels scalar = {"scalar", unpack_raw10_scalar,
+                                      reverse_scalar, transpose_scalar,
+                                      downscale_2x_scalar};
+#if defined(IMAGE_KERNELS_X86)
+  static const ImageKernels ssse3 = {"ssse3", unpack_raw10_ssse3,
+                                     reverse_ssse3, transpose_sse2,
+                                     downscale_2x_ssse3};
+  static const ImageKernels avx2 = {"avx2", unpack_raw10_avx2, reverse_avx2,
+                                    transpose_sse2, downscale_2x_avx2};
+  static const std::vector<const ImageKernels *> kernels = [] {
+    std::vector<const ImageKernels *> list = {&scalar};
+    if (cpu_supports("ssse3"))
+      list.push_back(&ssse3);
+    if (cpu_supports("ssse3") && cpu_supports("avx2"))
+      list.push_back(&avx2);
+    return list;
+  }();
+#elif defined(IMAGE_KERNELS_NEON)
+  static const ImageKernels neon = {"neon", unpack_raw10_neon, reverse_neon,
+                                    transpose_neon, downscale_2x_neon};
+  static const std::vector<const ImageKernels *> kernels = {&scalar, &neon};
+#else
+  static const std::vector<const ImageKernels *> kernels = {&scalar};
+#endif
+  return kernels;
+}
+
+/**
+ * @brief The fastest kernel set of the running CPU, chosen once.
+ */
+inline const ImageKernels &image_kernels() {
+  static const ImageKernels &best = *available_image_kernels().back();
+  return best;
+}
+
+/**
+ * @brief Unpacks a RAW10 frame to 8 bits.
+ *
+ * @param src first row of the packed frame.
+ * @param src_stride distance between packed rows in bytes, at least
+ * `dst.width * 5 / 4`.
+ * @param dst destination, its width must be a multiple of 4.
+ * @return false if the width is not a multiple of 4.
+ */
+inline bool unpack_raw10(const uint8_t *src, std::ptrdiff_t src_stride,
+                         const ImageView &dst,
+                         const ImageKernels &kernels = image_kernels()) {
+  if (dst.width % 4)
+    return false;
+  for (int y = 0; y < dst.height; ++y)
+    kernels.unpack_raw10(src + y * src_stride, dst.row(y), dst.width);
+  return true;
+}
+
+/**
+ * @brief Copies between images of the same size and any strides; with
+ * @ref ImageView::crop on the source this is a crop.
+ *
+ * Rows are plain memcpy calls, which are already vectorized by the C
+ * library, so there is no per-instruction-set variant.
+ */
+inline bool copy_image(const ImageView &src, const ImageView &dst) {
+  if (src.width != dst.width || src.height != dst.height)
+    return false;
+  for (int y = 0; y < src.height; ++y)
+    std::memcpy(dst.row(y), src.row(y), src.width);
+  return true;
+}
+
+/**
+ * @brief Rotates clockwise by 0, 90, 180 or 270 degrees.
+ *
+ * @param dst destination, with width and height swapped for 90 and 270.
+ * @return false for other angles or mismatching sizes.
+ */
+inline bool rotate_image(const ImageView &src, const ImageView &dst,
+                         int degrees,
+                         const ImageKernels &kernels = image_kernels()) {
+  bool swapped = degrees == 90 || degrees == 270;
+  if ((swapped ? dst.width != src.height || dst.height != src.width
+               : dst.width != src.width || dst.height != src.height))
+    return false;
+  switch (degrees) {
+  case 0:
+    return copy_image(src, dst);
+  case 90:
+    // dst[x][h - 1 - y] = src[y][x]: transpose the source read bottom-up.
+    kernels.transpose(src.row(src.height - 1), -(std::ptrdiff_t)src.stride,
+                      dst.pixels, dst.stride, src.width, src.height);
+    return true;
+  case 180:
+    for (int y = 0; y < src.height; ++y)
+      kernels.reverse(src.row(y), dst.row(dst.height - 1 - y), src.width);
+    return true;
+  case 270:
+    // dst[w - 1 - x][y] = src[y][x]: transpose into the destination
+    // written bottom-up.
+    kernels.transpose(src.pixels, src.stride, dst.row(dst.height - 1),
+                      -(std::ptrdiff_t)dst.stride, src.width, src.height);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Halves both dimensions with a rounded 2x2 box filter, e.g. from
+ * 1280x960 to the 640x480 eye crops the ire3 examples take.
+ *
+ * @param dst destination of size `src.width / 2` x `src.height / 2`.
+ * @return false on mismatching sizes.
+ */
+inline bool downscale_2x(const ImageView &src, const ImageView &dst,
+                         const ImageKernels &kernels = image_kernels()) {
+  if (dst.width != src.width / 2 || dst.height != src.height / 2)
+    return false;
+  for (int y = 0; y < dst.height; ++y)
+    kernels.downscale_2x(src.row(2 * y), src.row(2 * y + 1), dst.row(y),
+                         dst.width);
+  return true;
+}
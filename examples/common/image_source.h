@@ -0,0 +1,143 @@
+/// @file image_source.h
+#pragma once
+
+#include <cctype>
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+#include "mapped_file.h"
+
+/**
+ * @brief Non-owning view of an 8-bit grayscale image.
+ *
+ * `stride` is the distance between rows in bytes; it is what `irm2_settings`
+ * expects as stride. ire3 calls take no stride and need @ref contiguous
+ * views.
+ */
+struct ImageView {
+  uint8_t *pixels = nullptr;
+  int width = 0;
+  int height = 0;
+  int stride = 0;
+
+  bool contiguous() const { return stride == width; }
+  uint8_t *row(int y) const { return pixels + (std::size_t)y * stride; }
+
+  /**
+   * @brief Rectangular part of the image sharing its pixels.
+   */
+  ImageView crop(int x, int y, int crop_width, int crop_height) const {
+    return {pixels + (std::size_t)y * stride + x, crop_width, crop_height,
+            stride};
+  }
+};
+
+/**
+ * @brief Image file mapped into memory and used in place.
+ *
+ * Binary PGM (`P5`, 8-bit) headers are parsed directly in the mapping, RAW
+ * files are plain rows of pixels of a known size. Nothing is copied and any
+ * image size is supported. The mapping is copy-on-write, so the pixels can
+ * be handed to engine calls taking a non-const pointer without touching the
+ * file.
+ */
+class MappedImage {
+public:
+  /**
+   * @brief Maps a binary PGM file.
+   *
+   * @return true on success, see @ref error otherwise.
+   */
+  bool open_pgm(const std::string &path) {
+    if (!map(path))
+      return false;
+    const uint8_t *p = file.data();
+    const uint8_t *end = p + file.size();
+    if (file.size() < 2 || p[0] != 'P' || p[1] != '5')
+      return fail("not a binary PGM file");
+    p += 2;
+    long values[3];
+    for (long &value : values) {
+      // Whitespace and comments may separate the header fields.
+      while (p < end && (std::isspace(*p) || *p == '#'))
+        if (*p++ == '#')
+          while (p < end && *p != '\n')
+            ++p;
+      if (p == end || !std::isdigit(*p))
+        return fail("malformed PGM header");
+      value = 0;
+      while (p < end && std::isdigit(*p) && value < 1000000)
+        value = value * 10 + (*p++ - '0');
+    }
+    if (values[2] <= 0 || values[2] > 255)
+      return fail("only 8-bit PGM files are supported");
+    // Exactly one whitespace character precedes the pixels.
+    if (p == end || !std::isspace(*p))
+      return fail("malformed PGM header");
+    ++p;
+    return set_view(p - file.data(), (int)values[0], (int)values[1],
+                    (int)values[0]);
+  }
+
+  /**
+   * @brief Maps a RAW file of known geometry.
+   *
+   * @param stride row stride in bytes, 0 for `width`.
+   * @return true on success, see @ref error otherwise.
+   */
+  bool open_raw(const std::string &path, int width, int height,
+                int stride = 0) {
+    if (!map(path))
+      return false;
+    return set_view(0, width, height, stride ? stride : width);
+  }
+
+  /**
+   * @brief Maps `.pgm` files as PGM and anything else as RAW of the given
+   * geometry.
+   */
+  bool open(const std::string &path, int raw_width, int raw_height) {
+    auto dot = path.rfind('.');
+    if (dot != std::string::npos && path.substr(dot) == ".pgm")
+      return open_pgm(path);
+    return open_raw(path, raw_width, raw_height);
+  }
+
+  const ImageView &view() const { return image; }
+  const std::string &error() const { return message; }
+
+  /**
+   * @brief Asks the OS to start reading the pixels in.
+   */
+  void will_need() const { file.will_need(); }
+
+private:
+  bool map(const std::string &path) {
+    image = ImageView();
+    message.clear();
+    if (!file.open(path, MappedFile::Mode::CopyOnWrite))
+      return fail("can not open " + path);
+    return true;
+  }
+
+  bool set_view(std::size_t offset, int width, int height, int stride) {
+    if (width <= 0 || height <= 0 || stride < width)
+      return fail("invalid image size");
+    std::size_t needed = (std::size_t)stride * (height - 1) + width;
+    if (file.size() < offset || file.size() - offset < needed)
+      return fail("file is shorter than the image");
+    image = {file.data() + offset, width, height, stride};
+    return true;
+  }
+
+  bool fail(const std::string &text) {
+    message = text;
+    image = ImageView();
+    return false;
+  }
+
+  MappedFile file;
+  ImageView image;
+  std::string message;
+};
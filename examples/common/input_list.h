@@ -0,0 +1,59 @@
+/// @file input_list.h
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Image of a corpus and the id (subject) it belongs to.
+ */
+struct InputImage {
+  std::string path;
+  uint32_t id;
+};
+
+/**
+ * @brief Lists the images of a corpus.
+ *
+ * A directory is searched recursively for `.pgm` files, the images of one
+ * directory share an id (one directory per subject). Otherwise the source is
+ * a manifest with one `path [id]` entry per line; entries without an id get
+ * their line number.
+ *
+ * @param source directory or manifest file name.
+ * @return the images in processing order.
+ */
+inline std::vector<InputImage> list_inputs(const std::string &source) {
+  namespace fs = std::filesystem;
+  std::vector<InputImage> inputs;
+  if (fs::is_directory(source)) {
+    std::vector<fs::path> paths;
+    for (const auto &entry : fs::recursive_directory_iterator(source))
+      if (entry.is_regular_file() && entry.path().extension() == ".pgm")
+        paths.push_back(entry.path());
+    std::sort(paths.begin(), paths.end());
+    std::map<fs::path, uint32_t> subjects;
+    for (const auto &path : paths) {
+      auto it = subjects.emplace(path.parent_path(), (uint32_t)subjects.size());
+      inputs.push_back({path.string(), it.first->second});
+    }
+    return inputs;
+  }
+  std::ifstream manifest(source);
+  std::string line;
+  for (uint32_t n = 0; std::getline(manifest, line); ++n) {
+    std::istringstream fields(line);
+    InputImage input = {"", n};
+    if (fields >> input.path) {
+      fields >> input.id;
+      inputs.push_back(input);
+    }
+  }
+  return inputs;
+}
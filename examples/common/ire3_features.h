@@ -0,0 +1,159 @@
+/// @file ire3_features.h
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+
+#include "iris_engine_v3.h"
+#include "buffer_pool.h"
+#include "image_source.h"
+
+/**
+ * @brief Move-only deserialized ire3 feature set, ready for `ire3_compare`.
+ *
+ * The buffer comes from the calling thread's @ref BufferPool and is reused
+ * when the set is deserialized again.
+ */
+class FeatureSet {
+public:
+  FeatureSet() = default;
+  FeatureSet(FeatureSet &&) noexcept = default;
+  FeatureSet &operator=(FeatureSet &&) noexcept = default;
+  FeatureSet(const FeatureSet &) = delete;
+  FeatureSet &operator=(const FeatureSet &) = delete;
+
+  /**
+   * @brief Deserializes `size` bytes of serialized features.
+   *
+   * @return the engine status.
+   */
+  int deserialize(const uint8_t *features, std::size_t size) {
+    if (!buffer) {
+      size_t des_size = 0;
+      int rc = ire3_get_deserialized_features_size(&des_size);
+      if (rc != IRE3_STATUS_OK)
+        return rc;
+      buffer = BufferPool::local().acquire(des_size);
+    }
+    int rc = ire3_deserialize_features(features, size, buffer.data(),
+                                       buffer.size());
+    valid = rc == IRE3_STATUS_OK;
+    return rc;
+  }
+
+  /**
+   * @brief Compares with another set; higher scores are better matches.
+   */
+  int compare(const FeatureSet &other, const ire3_settings &settings,
+              int &score) const {
+    ire3_settings s = settings;
+    return ire3_compare(data(), other.data(), &s, &score);
+  }
+
+  explicit operator bool() const { return valid; }
+  const uint8_t *data() const { return buffer.data(); }
+  std::size_t size() const { return buffer.size(); }
+
+private:
+  PooledBuffer buffer;
+  bool valid = false;
+};
+
+/**
+ * @brief Move-only ire3 feature extractor owning its working set and its
+ * serialized output buffer.
+ *
+ * Both buffers are taken from the calling thread's @ref BufferPool, or the
+ * pool given to `init`, so extractions do not allocate. ire3 takes no
+ * stride: contiguous views are used in place, other views are first packed
+ * into a staging buffer that grows to the largest image seen.
+ */
+class Ire3Extractor {
+public:
+  Ire3Extractor() = default;
+  Ire3Extractor(Ire3Extractor &&) noexcept = default;
+  Ire3Extractor &operator=(Ire3Extractor &&) noexcept = default;
+  Ire3Extractor(const Ire3Extractor &) = delete;
+  Ire3Extractor &operator=(const Ire3Extractor &) = delete;
+
+  /**
+   * @param pool pool the buffers are taken from, the calling thread's by
+   * default.
+   * @return the engine status.
+   */
+  int init(const ire3_settings &extraction_settings,
+           BufferPool &pool = BufferPool::local()) {
+    settings = extraction_settings;
+    size_t max_size = 0, set_size = 0;
+    int rc = ire3_get_max_features_size(&max_size);
+    if (rc == IRE3_STATUS_OK)
+      rc = ire3_get_extraction_working_set_size(&set_size, &settings);
+    if (rc != IRE3_STATUS_OK)
+      return rc;
+    buffers = &pool;
+    working_set = pool.acquire(set_size);
+    output = pool.acquire(max_size);
+    output_size = 0;
+    return IRE3_STATUS_OK;
+  }
+
+  /**
+   * @brief Extracts the serialized features of an eye crop into
+   * @ref features.
+   *
+   * @param eye_info receives the eye information, may be nullptr.
+   * @return the engine status.
+   */
+  int extract(const ImageView &image, ire3_eye_info *eye_info = nullptr) {
+    ire3_eye_info ignored;
+    ire3_eye_info *info = eye_info ? eye_info : &ignored;
+    uint8_t *pixels = image.contiguous() ? image.pixels : pack(image);
+    output_size = 0;
+    size_t size = 0;
+    ire3_settings s = settings;
+    int rc = ire3_extract_features(pixels, image.width, image.height,
+                                   output.data(), output.size(), &size, info,
+                                   sizeof(*info), working_set.data(),
+                                   working_set.size(), &s);
+    if (rc == IRE3_STATUS_OK)
+      output_size = size;
+    return rc;
+  }
+
+  /**
+   * @brief Extracts and deserializes the features of an eye crop.
+   */
+  int extract(const ImageView &image, FeatureSet &features,
+              ire3_eye_info *eye_info = nullptr) {
+    int rc = extract(image, eye_info);
+    return rc == IRE3_STATUS_OK
+               ? features.deserialize(output.data(), output_size)
+               : rc;
+  }
+
+  explicit operator bool() const { return (bool)working_set; }
+
+  /// Serialized features of the last successful extraction.
+  const uint8_t *features() const { return output.data(); }
+  std::size_t features_size() const { return output_size; }
+  const ire3_settings &extraction_settings() const { return settings; }
+
+private:
+  uint8_t *pack(const ImageView &image) {
+    std::size_t size = (std::size_t)image.width * image.height;
+    if (staging.size() < size)
+      staging = buffers->acquire(size);
+    for (int y = 0; y < image.height; ++y)
+      std::memcpy(staging.data() + (std::size_t)y * image.width, image.row(y),
+                  image.width);
+    return staging.data();
+  }
+
+  ire3_settings settings = {sizeof(ire3_settings), 150, 4};
+  BufferPool *buffers = nullptr;
+  PooledBuffer working_set;
+  PooledBuffer output;
+  PooledBuffer staging;
+  std::size_t output_size = 0;
+};
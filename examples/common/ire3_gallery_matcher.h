@@ -0,0 +1,299 @@
+/// @file ire3_gallery_matcher.h
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+#include "iris_engine_v3.h"
+#include "gallery_slab.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+/**
+ * @brief Gallery of deserialized ire3 feature sets stored back to back.
+ *
+ * Every record is `ire3_get_deserialized_features_size` bytes long.
+ */
+struct FeatureGalleryView {
+  const uint8_t *data = nullptr;
+  std::size_t record_size = 0;
+  std::size_t count = 0;
+
+  const uint8_t *record(std::size_t i) const { return data + i * record_size; }
+};
+
+/**
+ * @brief Single gallery hit. Higher scores mean closer matches.
+ */
+struct MatchResult {
+  std::size_t index;
+  int score;
+};
+
+struct SearchOptions {
+  /// Number of best matches to return.
+  std::size_t top_k = 5;
+  /// The search stops as soon as any record reaches this score.
+  int stop_score = INT_MAX;
+  /// Number of consecutive records handed to a worker at once.
+  std::size_t chunk_size = 1024;
+  /// Records prefetched ahead of the comparison, 0 to disable.
+  std::size_t prefetch_distance = GALLERY_PREFETCH_DISTANCE;
+};
+
+struct SearchStats {
+  std::size_t comparisons = 0;
+  std::size_t failures = 0;
+  bool stopped_early = false;
+  double seconds = 0;
+
+  double matches_per_second() const {
+    return seconds > 0 ? comparisons / seconds : 0;
+  }
+};
+
+/**
+ * @brief 1:N search of a probe against a gallery using `ire3_compare`.
+ *
+ * The gallery is split into chunks which are scanned by the workers of a
+ * thread pool. Every worker keeps its own top-k list, the lists are merged
+ * once the scan is over.
+ */
+class GalleryMatcher {
+public:
+  GalleryMatcher(ThreadPool &pool, const ire3_settings &settings)
+      : pool(pool), settings(settings) {}
+
+  /**
+   * @brief Finds the best matches of a probe in the gallery.
+   *
+   * @param probe deserialized probe features.
+   * @param gallery gallery to search.
+   * @param options search options.
+   * @param stats optional output for throughput statistics.
+   * @return up to `options.top_k` matches, best first.
+   */
+  std::vector<MatchResult> search(const uint8_t *probe,
+                                  const FeatureGalleryView &gallery,
+                                  const SearchOptions &options,
+                                  SearchStats *stats = nullptr) {
+    return scan(
+        probe, gallery.count, gallery.record_size,
+        [&](std::size_t i) { return gallery.record(i); }, options, stats);
+  }
+
+  /**
+   * @brief Finds the best matches of a probe in a slab gallery; the match
+   * indices are slots, deleted records are skipped.
+   */
+  std::vector<MatchResult> search(const uint8_t *probe,
+                                  const SlabGallery &gallery,
+                                  const SearchOptions &options,
+                                  SearchStats *stats = nullptr) {
+    return scan(
+        probe, gallery.slots(), gallery.record_size(),
+        [&](std::size_t i) { return gallery.live_record(i); }, options,
+        stats);
+  }
+
+  /**
+   * @brief Finds the best matches of a probe among individually allocated
+   * records of `record_size` bytes; the match indices are positions in
+   * `records`.
+   */
+  std::vector<MatchResult> search(const uint8_t *probe,
+                                  const std::vector<const uint8_t *> &records,
+                                  std::size_t record_size,
+                                  const SearchOptions &options,
+                                  SearchStats *stats = nullptr) {
+    return scan(
+        probe, records.size(), record_size,
+        [&](std::size_t i) { return records[i]; }, options, stats);
+  }
+
+  /**
+   * @brief Finds the best matches of several probes in one scan of the
+   * gallery.
+   *
+   * Every gallery record is compared with all probes while it is in the
+   * cache, so a batch costs about one scan of the gallery memory instead of
+   * one per probe. `options.stop_score` is ignored, the gallery is always
+   * scanned completely.
+   *
+   * @param probes deserialized probe features.
+   * @param gallery gallery to search.
+   * @param options search options.
+   * @param stats optional output for throughput statistics.
+   * @return up to `options.top_k` matches per probe, best first.
+   */
+  std::vector<std::vector<MatchResult>>
+  search_batch(const std::vector<const uint8_t *> &probes,
+               const FeatureGalleryView &gallery, const SearchOptions &options,
+               SearchStats *stats = nullptr) {
+    auto start = std::chrono::steady_clock::now();
+    std::size_t chunk = std::max<std::size_t>(1, options.chunk_size);
+    std::size_t num_chunks = (gallery.count + chunk - 1) / chunk;
+
+    std::vector<BatchWorker> workers(pool.size());
+    for (auto &worker : workers)
+      worker.best.resize(probes.size());
+
+    pool.parallel_for(num_chunks, [&](std::size_t task, std::size_t index) {
+      TRACE_SCOPE("match_batch_chunk");
+      BatchWorker &worker = workers[index];
+      ire3_settings s = settings;
+      std::size_t end = std::min(gallery.count, (task + 1) * chunk);
+      for (std::size_t i = task * chunk; i < end; ++i) {
+        if (i + options.prefetch_distance < end)
+          prefetch_record(gallery.record(i + options.prefetch_distance),
+                          gallery.record_size);
+        const uint8_t *record = gallery.record(i);
+        for (std::size_t p = 0; p < probes.size(); ++p) {
+          int score = 0;
+          ++worker.comparisons;
+          if (ire3_compare(probes[p], record, &s, &score) !=
+              IRE3_STATUS_OK) {
+            ++worker.failures;
+            continue;
+          }
+          push_top_k(worker.best[p], options.top_k, {i, score});
+        }
+      }
+    });
+
+    std::vector<std::vector<MatchResult>> results(probes.size());
+    SearchStats total;
+    for (auto &worker : workers) {
+      for (std::size_t p = 0; p < probes.size(); ++p)
+        results[p].insert(results[p].end(), worker.best[p].begin(),
+                          worker.best[p].end());
+      total.comparisons += worker.comparisons;
+      total.failures += worker.failures;
+    }
+    for (auto &result : results) {
+      std::sort(result.begin(), result.end(), better);
+      if (result.size() > options.top_k)
+        result.resize(options.top_k);
+    }
+
+    if (stats) {
+      total.seconds = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+      *stats = total;
+    }
+    return results;
+  }
+
+private:
+  /**
+   * @brief Scans records `0..count` handed out by `record(i)`, which
+   * returns nullptr for records to skip.
+   */
+  template <class Records>
+  std::vector<MatchResult> scan(const uint8_t *probe, std::size_t count,
+                                std::size_t record_size,
+                                const Records &record,
+                                const SearchOptions &options,
+                                SearchStats *stats) {
+    auto start = std::chrono::steady_clock::now();
+    std::size_t chunk = std::max<std::size_t>(1, options.chunk_size);
+    std::size_t num_chunks = (count + chunk - 1) / chunk;
+    std::size_t distance = options.prefetch_distance;
+
+    std::vector<Worker> workers(pool.size());
+    std::atomic<bool> stop{false};
+
+    pool.parallel_for(num_chunks, [&](std::size_t task, std::size_t index) {
+      // Traced per chunk, a scope per ire3_compare would cost more than the
+      // comparison itself.
+      TRACE_SCOPE("match_chunk");
+      Worker &worker = workers[index];
+      ire3_settings s = settings;
+      std::size_t begin = task * chunk;
+      std::size_t end = std::min(count, (task + 1) * chunk);
+      for (std::size_t i = begin; i < std::min(end, begin + distance); ++i)
+        if (const uint8_t *ahead = record(i))
+          prefetch_record(ahead, record_size);
+      for (std::size_t i = begin; i < end; ++i) {
+        if (stop.load(std::memory_order_relaxed))
+          return;
+        if (distance && i + distance < end)
+          if (const uint8_t *ahead = record(i + distance))
+            prefetch_record(ahead, record_size);
+        const uint8_t *enrolled = record(i);
+        if (!enrolled)
+          continue;
+        int score = 0;
+        ++worker.comparisons;
+        if (ire3_compare(probe, enrolled, &s, &score) != IRE3_STATUS_OK) {
+          ++worker.failures;
+          continue;
+        }
+        push_top_k(worker.best, options.top_k, {i, score});
+        if (score >= options.stop_score)
+          stop.store(true, std::memory_order_relaxed);
+      }
+    });
+
+    std::vector<MatchResult> results;
+    SearchStats total;
+    for (auto &worker : workers) {
+      results.insert(results.end(), worker.best.begin(), worker.best.end());
+      total.comparisons += worker.comparisons;
+      total.failures += worker.failures;
+    }
+    std::sort(results.begin(), results.end(), better);
+    if (results.size() > options.top_k)
+      results.resize(options.top_k);
+
+    if (stats) {
+      total.stopped_early = stop.load();
+      total.seconds = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+      *stats = total;
+    }
+    return results;
+  }
+
+  // Aligned so that counters of different workers never share a cache line.
+  struct alignas(64) Worker {
+    std::vector<MatchResult> best; // min-heap ordered by `better`
+    std::size_t comparisons = 0;
+    std::size_t failures = 0;
+  };
+
+  struct alignas(64) BatchWorker {
+    std::vector<std::vector<MatchResult>> best; // one heap per probe
+    std::size_t comparisons = 0;
+    std::size_t failures = 0;
+  };
+
+  static bool better(const MatchResult &a, const MatchResult &b) {
+    return a.score != b.score ? a.score > b.score : a.index < b.index;
+  }
+
+  static void push_top_k(std::vector<MatchResult> &heap, std::size_t k,
+                         const MatchResult &m) {
+    if (k == 0)
+      return;
+    if (heap.size() < k) {
+      heap.push_back(m);
+      std::push_heap(heap.begin(), heap.end(), better);
+    } else if (better(m, heap.front())) {
+      std::pop_heap(heap.begin(), heap.end(), better);
+      heap.back() = m;
+      std::push_heap(heap.begin(), heap.end(), better);
+    }
+  }
+
+  ThreadPool &pool;
+  ire3_settings settings;
+};
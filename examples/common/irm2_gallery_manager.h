@@ -0,0 +1,455 @@
+/// @file irm2_gallery_manager.h
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "gallery_slab.h"
+#include "irm2_session.h"
+#include "thread_pool.h"
+
+/// Templates collected in the delta shard before they are merged into a
+/// full shard.
+#define GALLERY_DELTA_LIMIT (64)
+/// Largest number of templates per shard.
+#define GALLERY_SHARD_CAPACITY (4096)
+/// Delay before a batch whose shards could not be built is tried again.
+#define GALLERY_RETRY_MS (100)
+/// Failed attempts at a batch before its updates are applied one by one
+/// and those that still fail are dropped.
+#define GALLERY_MAX_ATTEMPTS (3)
+
+struct GalleryManagerStats {
+  std::size_t templates = 0;
+  std::size_t shards = 0;
+  /// Templates in the delta shard.
+  std::size_t delta = 0;
+  /// Updates queued but not yet visible to identification.
+  std::size_t pending = 0;
+  /// Snapshots published by the background thread.
+  std::size_t snapshots = 0;
+  /// Shards built, with the time spent building them.
+  std::size_t builds = 0;
+  std::size_t failed_builds = 0;
+  double build_ms = 0;
+  double max_build_ms = 0;
+  /// Status of the last failed build while its updates wait for a retry,
+  /// 0 otherwise.
+  int error = 0;
+  /// Updates dropped because no shard could be built with them.
+  std::size_t rejected = 0;
+};
+
+inline std::ostream &operator<<(std::ostream &out,
+                                const GalleryManagerStats &s) {
+  return out << "Gallery: " << s.templates << " templates in " << s.shards
+             << " shards (" << s.delta << " in delta, " << s.pending
+             << " pending), " << s.snapshots << " snapshots, " << s.builds
+             << " shard builds (" << s.failed_builds << " failed) taking "
+             << s.build_ms << " ms, max " << s.max_build_ms << " ms, "
+             << s.rejected << " updates rejected"
+             << (s.error ? ", retrying a failed build" : "");
+}
+
+/**
+ * @brief irm2 identification gallery that accepts new enrollments while
+ * identifying.
+ *
+ * `irm2_init_identification` takes all templates up front, so the gallery
+ * is split into shards of at most `shard_capacity` templates, each with its
+ * own initialized identification context. New templates go to a small
+ * delta shard which is merged into a full shard once it holds `delta_limit`
+ * templates. A background thread builds the changed shards and publishes a
+ * new snapshot of the shard list with an atomic pointer swap; unchanged
+ * shards keep their contexts. @ref identify only loads the current snapshot,
+ * so it never waits for an update.
+ *
+ * A batch of updates is published whole or not at all: if a shard of it can
+ * not be built, the snapshot stays as it is and the batch goes back to the
+ * front of the queue to be tried again. After @ref GALLERY_MAX_ATTEMPTS
+ * failed attempts the updates are applied one at a time, so that a template
+ * the engine always rejects does not hold up the others; an update that
+ * still fails is dropped and reported to the reject handler.
+ *
+ * Identification contexts accumulate evidence over frames, so one manager
+ * serves one identification stream: @ref identify must not be called
+ * concurrently. A shard replaced by an update starts from scratch.
+ */
+class Irm2GalleryManager {
+public:
+  /**
+   * @param config geometry of the frames.
+   * @param threshold identification threshold.
+   * @param pool fans every frame out over the shards, may be nullptr.
+   */
+  Irm2GalleryManager(const Irm2Config &config, int threshold = 100,
+                     ThreadPool *pool = nullptr,
+                     std::size_t shard_capacity = GALLERY_SHARD_CAPACITY,
+                     std::size_t delta_limit = GALLERY_DELTA_LIMIT)
+      : config(config), threshold(threshold), pool(pool),
+        shard_capacity(std::max<std::size_t>(1, shard_capacity)),
+        delta_limit(std::max<std::size_t>(1, delta_limit)),
+        snapshot(std::make_shared<Snapshot>()),
+        worker([this] { run(); }) {}
+
+  ~Irm2GalleryManager() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopped = true;
+    }
+    queued.notify_all();
+    worker.join();
+  }
+
+  Irm2GalleryManager(const Irm2GalleryManager &) = delete;
+  Irm2GalleryManager &operator=(const Irm2GalleryManager &) = delete;
+
+  /// Called on the background thread with the id and the build status of
+  /// every dropped update.
+  using RejectHandler = std::function<void(uint32_t id, int rc)>;
+
+  void set_reject_handler(RejectHandler handler) {
+    std::lock_guard<std::mutex> lock(mutex);
+    on_reject = std::move(handler);
+  }
+
+  /**
+   * @brief Queues a template; it is copied and becomes visible to
+   * identification with the next snapshot.
+   */
+  void add(const uint8_t *iris_template, uint32_t id) {
+    Update update = {Update::Add, id, {}};
+    std::copy(iris_template, iris_template + IRM2_TEMPLATE_SIZE,
+              update.iris_template.begin());
+    push(std::move(update));
+  }
+
+  /**
+   * @brief Queues the removal of every template with the id.
+   */
+  void remove(uint32_t id) { push({Update::Remove, id, {}}); }
+
+  /**
+   * @brief Waits until all queued updates are visible to identification, or
+   * until an attempt to apply them failed.
+   *
+   * @return 0 once the updates are visible, otherwise the status of the
+   * failed shard build; the updates stay queued and are retried, or the
+   * status of an update dropped meanwhile.
+   */
+  int flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    std::size_t start = attempts;
+    std::size_t rejected = totals.rejected;
+    idle.wait(lock, [&] {
+      return !busy && (updates.empty() || (totals.error && attempts > start));
+    });
+    if (!updates.empty())
+      return totals.error;
+    return totals.rejected > rejected ? reject_rc : 0;
+  }
+
+  /**
+   * @brief Processes a frame with the context of every shard.
+   *
+   * @param id receives the id of the identified template.
+   * @return 0 if a shard identified the frame, otherwise the status of the
+   * last shard (non-zero), 1 for an empty gallery.
+   */
+  int identify(const ImageView &frame, uint32_t rotation, uint32_t &id) {
+    std::shared_ptr<const Snapshot> current = std::atomic_load(&snapshot);
+    const auto &shards = current->shards;
+    std::vector<int> &rc = status;
+    rc.assign(shards.size(), 1);
+    auto process = [&](std::size_t s, std::size_t) {
+      rc[s] = shards[s]->context.on_frame(frame, rotation);
+    };
+    if (pool && shards.size() > 1)
+      pool->parallel_for(shards.size(), process);
+    else
+      for (std::size_t s = 0; s < shards.size(); ++s)
+        process(s, 0);
+    for (std::size_t s = 0; s < shards.size(); ++s) {
+      if (rc[s] != 0)
+        continue;
+      int index = -1;
+      shards[s]->context.identification_result(index);
+      if (index >= 0 && (std::size_t)index < shards[s]->gallery.slots()) {
+        id = shards[s]->gallery.id(index);
+        return 0;
+      }
+    }
+    return rc.empty() ? 1 : rc.back();
+  }
+
+  GalleryManagerStats stats() const {
+    std::shared_ptr<const Snapshot> current = std::atomic_load(&snapshot);
+    std::lock_guard<std::mutex> lock(mutex);
+    GalleryManagerStats s = totals;
+    s.shards = current->shards.size();
+    s.templates = s.delta = 0;
+    for (const auto &shard : current->shards) {
+      s.templates += shard->gallery.count();
+      if (shard->delta)
+        s.delta = shard->gallery.count();
+    }
+    s.pending = updates.size();
+    return s;
+  }
+
+private:
+  struct Update {
+    enum Kind { Add, Remove } kind;
+    uint32_t id;
+    Irm2Template iris_template;
+  };
+
+  /// Immutable once published, apart from the context used by identify.
+  struct Shard {
+    SlabGallery gallery{IRM2_TEMPLATE_SIZE};
+    std::vector<const uint8_t *> pointers;
+    Irm2Identification context;
+    bool delta = false;
+  };
+
+  struct Snapshot {
+    std::vector<std::shared_ptr<Shard>> shards;
+  };
+
+  /// Template and id of a shard being built.
+  using Entry = std::pair<const uint8_t *, uint32_t>;
+
+  void push(Update update) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      updates.push_back(std::move(update));
+      fresh = true;
+    }
+    queued.notify_one();
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      // After a failure, retry on the next update or after a delay.
+      if (totals.error)
+        queued.wait_for(lock, std::chrono::milliseconds(GALLERY_RETRY_MS),
+                        [&] { return stopped || fresh; });
+      else
+        queued.wait(lock, [&] { return stopped || !updates.empty(); });
+      if (stopped)
+        return;
+      if (updates.empty())
+        continue;
+      std::deque<Update> batch;
+      batch.swap(updates);
+      fresh = false;
+      busy = true;
+      lock.unlock();
+      int rc = apply(batch);
+      failures = rc ? failures + 1 : 0;
+      if (failures >= GALLERY_MAX_ATTEMPTS) {
+        apply_each(batch);
+        failures = rc = 0;
+      }
+      lock.lock();
+      busy = false;
+      ++attempts;
+      totals.error = rc;
+      // Nothing of a failed batch was published; it goes back in front of
+      // the updates queued meanwhile.
+      if (rc)
+        updates.insert(updates.begin(), std::make_move_iterator(batch.begin()),
+                       std::make_move_iterator(batch.end()));
+      idle.notify_all();
+    }
+  }
+
+  /**
+   * @brief Applies the updates of a batch that keeps failing one at a time
+   * and drops those that can not be applied.
+   */
+  void apply_each(const std::deque<Update> &batch) {
+    for (const auto &update : batch) {
+      int rc = apply(std::deque<Update>(1, update));
+      if (!rc)
+        continue;
+      RejectHandler handler;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++totals.rejected;
+        reject_rc = rc;
+        handler = on_reject;
+      }
+      if (handler)
+        handler(update.id, rc);
+    }
+  }
+
+  /**
+   * @brief Builds the shards changed by a batch of updates and publishes
+   * the new snapshot.
+   *
+   * @return 0, or the status of the first shard that can not be built, in
+   * which case nothing is published.
+   */
+  int apply(const std::deque<Update> &batch) {
+    std::shared_ptr<const Snapshot> current = std::atomic_load(&snapshot);
+    std::vector<std::shared_ptr<Shard>> full;
+    std::vector<Entry> delta;
+    for (const auto &shard : current->shards) {
+      if (!shard->delta) {
+        full.push_back(shard);
+        continue;
+      }
+      for (std::size_t s = 0; s < shard->gallery.slots(); ++s)
+        delta.push_back({shard->gallery.record(s), shard->gallery.id(s)});
+    }
+
+    // Removals rebuild the full shards holding the id.
+    std::vector<uint32_t> removed;
+    for (const auto &update : batch)
+      if (update.kind == Update::Remove)
+        removed.push_back(update.id);
+    std::sort(removed.begin(), removed.end());
+    auto is_removed = [&](uint32_t id) {
+      return std::binary_search(removed.begin(), removed.end(), id);
+    };
+    int rc = 0;
+    std::vector<std::shared_ptr<Shard>> remaining;
+    for (auto &shard : full) {
+      std::vector<Entry> kept;
+      for (std::size_t s = 0; s < shard->gallery.slots(); ++s)
+        if (!is_removed(shard->gallery.id(s)))
+          kept.push_back({shard->gallery.record(s), shard->gallery.id(s)});
+      // A shard whose templates were all removed is dropped.
+      if (kept.size() != shard->gallery.slots() && !kept.empty()) {
+        shard = build(kept, false, rc);
+        if (!shard)
+          return rc;
+      }
+      if (!kept.empty())
+        remaining.push_back(shard);
+    }
+    full.swap(remaining);
+
+    // Updates apply in order, a template added after its id was removed
+    // stays.
+    for (const auto &update : batch) {
+      if (update.kind == Update::Add)
+        delta.push_back({update.iris_template.data(), update.id});
+      else
+        delta.erase(std::remove_if(delta.begin(), delta.end(),
+                                   [&](const Entry &e) {
+                                     return e.second == update.id;
+                                   }),
+                    delta.end());
+    }
+
+    // A full delta is merged into the last shard while it has room.
+    std::size_t taken = 0;
+    while (delta.size() - taken >= delta_limit) {
+      std::vector<Entry> merged;
+      if (!full.empty() &&
+          full.back()->gallery.slots() + delta_limit <= shard_capacity) {
+        const SlabGallery &last = full.back()->gallery;
+        for (std::size_t s = 0; s < last.slots(); ++s)
+          merged.push_back({last.record(s), last.id(s)});
+        full.pop_back();
+      }
+      std::size_t n = std::min(delta.size() - taken,
+                               shard_capacity - merged.size());
+      merged.insert(merged.end(), delta.begin() + taken,
+                    delta.begin() + taken + n);
+      taken += n;
+      auto shard = build(merged, false, rc);
+      if (!shard)
+        return rc;
+      full.push_back(shard);
+    }
+    delta.erase(delta.begin(), delta.begin() + taken);
+
+    auto next = std::make_shared<Snapshot>();
+    next->shards = full;
+    if (!delta.empty()) {
+      auto shard = build(delta, true, rc);
+      if (!shard)
+        return rc;
+      next->shards.push_back(shard);
+    }
+    std::atomic_store(&snapshot, std::shared_ptr<const Snapshot>(next));
+    std::lock_guard<std::mutex> lock(mutex);
+    ++totals.snapshots;
+    return 0;
+  }
+
+  /**
+   * @brief Copies the templates into a new shard and initializes its
+   * identification context.
+   *
+   * @param rc receives the status of the init.
+   * @return nullptr if the context can not be initialized.
+   */
+  std::shared_ptr<Shard> build(const std::vector<Entry> &entries, bool delta,
+                               int &rc) {
+    auto start = std::chrono::steady_clock::now();
+    auto shard = std::make_shared<Shard>();
+    shard->delta = delta;
+    for (const auto &entry : entries)
+      shard->gallery.add(entry.first, entry.second);
+    shard->pointers = shard->gallery.pointers();
+    rc = shard->context.init(config, shard->pointers.data(),
+                             (int)shard->pointers.size(), threshold);
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    std::lock_guard<std::mutex> lock(mutex);
+    ++totals.builds;
+    totals.build_ms += ms;
+    totals.max_build_ms = std::max(totals.max_build_ms, ms);
+    if (rc) {
+      ++totals.failed_builds;
+      return nullptr;
+    }
+    return shard;
+  }
+
+  Irm2Config config;
+  int threshold;
+  ThreadPool *pool;
+  std::size_t shard_capacity;
+  std::size_t delta_limit;
+
+  /// Read by identify, replaced by the background thread only.
+  std::shared_ptr<const Snapshot> snapshot;
+  /// Per-frame shard status, reused by identify.
+  std::vector<int> status;
+
+  mutable std::mutex mutex;
+  std::condition_variable queued, idle;
+  std::deque<Update> updates;
+  bool busy = false;
+  bool stopped = false;
+  /// An update was queued since the last batch was taken.
+  bool fresh = false;
+  /// Batches the background thread tried to apply.
+  std::size_t attempts = 0;
+  /// Status of the last dropped update.
+  int reject_rc = 0;
+  RejectHandler on_reject;
+  GalleryManagerStats totals;
+  /// Consecutive failed attempts, used by the background thread only.
+  int failures = 0;
+  std::thread worker;
+};
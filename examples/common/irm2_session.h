@@ -0,0 +1,239 @@
+/// @file irm2_session.h
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <memory>
+#include <stdint.h>
+
+#include "iris_mobile_v2.h"
+#include "iris_mobile_v2_capture.h"
+#include "buffer_pool.h"
+#include "image_source.h"
+
+/**
+ * @brief What an irm2 context is initialized for.
+ */
+enum class Irm2Mode { Enroll, Identify, Capture };
+
+/**
+ * @brief Template produced by an enrollment.
+ */
+using Irm2Template = std::array<uint8_t, IRM2_TEMPLATE_SIZE>;
+
+/**
+ * @brief Frame geometry and camera parameters of a session.
+ */
+struct Irm2Config {
+  int width = 0;
+  int height = 0;
+  /// Row stride of the frames, 0 for `width`.
+  int stride = 0;
+  /// Camera resolution, px per rad.
+  int32_t cam_res = 3500;
+  /// Nominal resolution, px per cm.
+  int32_t nom_res = 160;
+  void (*on_score)(void *, int, int) = nullptr;
+  int flags = IRM2_FLAG_NONE;
+
+  static Irm2Config for_frames(const ImageView &frame) {
+    Irm2Config config;
+    config.width = frame.width;
+    config.height = frame.height;
+    config.stride = frame.stride;
+    return config;
+  }
+
+  int row_stride() const { return stride ? stride : width; }
+
+  irm2_settings settings() const {
+    irm2_settings s = {
+        sizeof(s), width, height, cam_res, nom_res, NULL,
+        on_score,  NULL,  NULL,   flags,   NULL,    row_stride()};
+    return s;
+  }
+};
+
+/**
+ * @brief Move-only irm2 context, specialized at compile time on its mode
+ * and on the number of eyes in the frames.
+ *
+ * The context memory comes from the calling thread's @ref BufferPool, or
+ * the pool given to `init`, and goes back to it when the session is
+ * destroyed. The settings live next to it, so the engine may keep pointers
+ * to both while the session is moved around. After `init`, frame calls do
+ * not allocate.
+ *
+ * Calls return the engine status codes; a session whose init failed must
+ * not be used for anything but destruction or a new init.
+ *
+ * @tparam Mode selects the init call and the progress query.
+ * @tparam Eyes number of eyes expected in a frame, 1 or 2.
+ */
+template <Irm2Mode Mode, uint32_t Eyes> class Irm2Session {
+  static_assert(Eyes == 1 || Eyes == 2, "irm2 handles one or two eyes");
+
+public:
+  static constexpr Irm2Mode mode = Mode;
+  static constexpr uint32_t eyes = Eyes;
+
+  Irm2Session() = default;
+  Irm2Session(Irm2Session &&) noexcept = default;
+  Irm2Session &operator=(Irm2Session &&) noexcept = default;
+  Irm2Session(const Irm2Session &) = delete;
+  Irm2Session &operator=(const Irm2Session &) = delete;
+
+  /**
+   * @brief Initializes an enrollment.
+   */
+  int init(const Irm2Config &config, BufferPool &pool = BufferPool::local()) {
+    static_assert(Mode == Irm2Mode::Enroll, "use the init of this mode");
+    allocate(config, context_size(config), pool);
+    return irm2_init_enrollment(memory(), state->context.size(), Eyes,
+                                &state->settings);
+  }
+
+  /**
+   * @brief Initializes an identification against `count` templates.
+   *
+   * The templates are not copied and must outlive the session.
+   */
+  int init(const Irm2Config &config, const uint8_t **templates, int count,
+           int threshold, BufferPool &pool = BufferPool::local()) {
+    static_assert(Mode == Irm2Mode::Identify, "use the init of this mode");
+    allocate(config, context_size(config), pool);
+    return irm2_init_identification(memory(), state->context.size(),
+                                    templates, count, threshold,
+                                    &state->settings);
+  }
+
+  /**
+   * @brief Initializes a capture of eye images.
+   */
+  int init(const Irm2Config &config, const irm2_capture_settings &capture,
+           BufferPool &pool = BufferPool::local()) {
+    static_assert(Mode == Irm2Mode::Capture, "use the init of this mode");
+    allocate(config, context_size(config), pool);
+    state->capture = capture;
+    return irm2_init_capture(memory(), state->context.size(), Eyes,
+                             &state->settings, &state->capture);
+  }
+
+  explicit operator bool() const { return state != nullptr; }
+
+  /**
+   * @brief Size of the context `init` allocates for `config`.
+   */
+  static std::size_t context_size(const Irm2Config &config) {
+    if constexpr (Mode == Irm2Mode::Capture)
+      return IRM2_GET_CAPTURE_CONTEXT_SIZE(config.width, config.height);
+    else
+      return IRM2_GET_CONTEXT_SIZE(1, config.width, config.height);
+  }
+
+  /**
+   * @brief Processes a frame in place; its geometry must match the
+   * configuration of `init`.
+   */
+  int on_frame(const ImageView &frame, uint32_t rotation = 0) {
+    assert(frame.width == state->config.width &&
+           frame.height == state->config.height &&
+           frame.stride == state->config.row_stride());
+    return irm2_on_frame(memory(), frame.pixels, rotation);
+  }
+
+  int ui_hints(irm2_ui_hints &hints) {
+    return irm2_get_ui_hints(memory(), &hints, sizeof(hints));
+  }
+
+  /**
+   * @brief Enrollment or capture progress of the last frame.
+   */
+  int progress(irm2_enrollment_info &info) {
+    static_assert(Mode != Irm2Mode::Identify,
+                  "identification has no progress");
+    if constexpr (Mode == Irm2Mode::Enroll)
+      return irm2_get_enrollment_info(memory(), &info, sizeof(info));
+    else
+      return irm2_get_capture_info(memory(), &info, sizeof(info));
+  }
+
+  /**
+   * @brief Starts the next enrollment step once a step reached 100%.
+   */
+  int continue_enrollment() {
+    static_assert(Mode == Irm2Mode::Enroll, "only enrollment has steps");
+    return irm2_continue_enrollment(memory());
+  }
+
+  int get_template(Irm2Template &iris_template) {
+    static_assert(Mode == Irm2Mode::Enroll, "only enrollment has a template");
+    return irm2_get_template(memory(), iris_template.data(),
+                             iris_template.size());
+  }
+
+  /**
+   * @brief Index of the identified template, valid once @ref on_frame
+   * returned 0.
+   */
+  int identification_result(int &template_id) {
+    static_assert(Mode == Irm2Mode::Identify, "only for identification");
+    return irm2_get_identification_result(memory(), &template_id);
+  }
+
+  /**
+   * @brief Copies the kind7 crop into `image`, a contiguous
+   * IRM2_CROPPED_WIDTH x IRM2_CROPPED_HEIGHT view.
+   */
+  int kind7_image(const ImageView &image, int eye = IRM2_EYE_UNDEF) {
+    static_assert(Mode == Irm2Mode::Capture, "only capture has eye images");
+    assert(image.contiguous());
+    return irm2_get_kind7_image(memory(), eye, image.width, image.height,
+                                image.pixels);
+  }
+
+  /**
+   * @brief Copies the kind3 crop into `image`, see @ref kind7_image.
+   */
+  int kind3_image(const ImageView &image, int eye = IRM2_EYE_UNDEF) {
+    static_assert(Mode == Irm2Mode::Capture, "only capture has eye images");
+    assert(image.contiguous());
+    return irm2_get_kind3_image(memory(), eye, image.width, image.height,
+                                image.pixels);
+  }
+
+  int eye_info(std::array<irm2_eye_info, Eyes> &info) {
+    static_assert(Mode == Irm2Mode::Capture, "only capture has eye info");
+    return irm2_get_eye_info(memory(), info.data(), sizeof(irm2_eye_info));
+  }
+
+  /**
+   * @brief Context memory for calls the facade does not wrap.
+   */
+  uint8_t *memory() const { return state->context.data(); }
+
+private:
+  struct State {
+    Irm2Config config;
+    irm2_settings settings;
+    irm2_capture_settings capture;
+    PooledBuffer context;
+  };
+
+  void allocate(const Irm2Config &config, std::size_t size,
+                BufferPool &pool) {
+    if (!state)
+      state.reset(new State());
+    state->config = config;
+    state->settings = config.settings();
+    // A re-init of the same geometry keeps the context memory.
+    if (state->context.size() != size)
+      state->context = pool.acquire(size);
+  }
+
+  std::unique_ptr<State> state;
+};
+
+using Irm2Enrollment = Irm2Session<Irm2Mode::Enroll, 2>;
+using Irm2Identification = Irm2Session<Irm2Mode::Identify, 2>;
+using Irm2Capture = Irm2Session<Irm2Mode::Capture, 1>;
@@ -0,0 +1,201 @@
+/// @file kind7_encoder.h
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include <utility>
+
+#include "iris_image_record.h"
+#include "buffer_pool.h"
+#include "image_kernels.h"
+#include "image_source.h"
+
+/**
+ * @brief Size budget and search limits of a @ref Kind7Encoder.
+ */
+struct Kind7EncodeOptions {
+  /// Largest record size in bytes.
+  uint32_t budget = 20000;
+  /// A record within this share below the budget ends the search.
+  double tolerance = 0.05;
+  /// Encode passes per record before giving up on the tolerance.
+  int max_passes = 6;
+  /// Decode every record to measure its PSNR.
+  bool verify = true;
+};
+
+/**
+ * @brief Result of @ref Kind7Encoder::encode. The pointers stay valid until
+ * the next call.
+ */
+struct Kind7Record {
+  /// Status of the failing iirPack/iirUnpack call, 0 on success.
+  int rc = 0;
+  const uint8_t *data = nullptr;
+  uint32_t size = 0;
+  /// Rate target passed to iirPack for the kept record.
+  uint32_t target = 0;
+  int passes = 0;
+  /// False if no pass produced a record within the budget.
+  bool fits = false;
+  /// Decoded record when verifying, with its PSNR against the input in dB.
+  const uint8_t *decoded = nullptr;
+  double psnr = 0;
+};
+
+/**
+ * @brief IIR header for a single eye JPEG2000 kind7 image.
+ */
+inline IirInfo kind7_iir_info(int width, int height) {
+  IirInfo ii;
+  memset(&ii, 0, sizeof(ii));
+  memcpy(ii.ich.FormatId, "IIR\0", 4);
+  ii.IirType = IIR_2011; // NOT_IIR use this to get `nacked` image without
+                         // header for diagnostics later
+
+  ii.NumberOfIrises = 1;
+  ii.NumberOfEyes = 1;
+  ii.EyeLabel = EYE_UNDEF;
+
+  memset(ii.CaptureDateAndTime, 0xff, 9);
+  ii.CaptureDeviceTechnology = 1; // (0x01 ): CMOS/CCD
+  ii.CaptureDeviceVendorID = 0x0057;
+  ii.RepresentationNumber = 1;
+
+  // This should be consistent with the "jp2" format name of iirPack.
+  ii.ImageType = Iir2011_IMAGEFORMAT_MONO_JPEG2000;
+  ii.ImageFormat = Iir2011_IMAGEFORMAT_MONO_JPEG2000;
+
+  ii.Width = width;
+  ii.Height = height;
+  ii.BitDepth = 8; // grayscale
+
+  ii.RollAngle = -1;
+  ii.RollUncertainty = -1;
+  return ii;
+}
+
+/**
+ * @brief Packs kind7 images into JPEG2000 IIR records of a given size
+ * budget.
+ *
+ * iirPack takes a rate target but the record it produces is not exactly
+ * that size, so the encoder searches the target: each pass corrects the
+ * target by the ratio of the budget to the size just achieved, bracketed
+ * by the targets known to fit and to overflow. The ratio learned on one
+ * record is the first guess for the next, which lets most records of a
+ * batch finish in one or two passes.
+ *
+ * Output and decode buffers are reused across calls, so an encoder per
+ * thread allocates only when the image size grows. Not thread safe.
+ */
+class Kind7Encoder {
+public:
+  explicit Kind7Encoder(const Kind7EncodeOptions &options = {})
+      : options(options) {}
+
+  const Kind7EncodeOptions &get_options() const { return options; }
+
+  /**
+   * @brief Encodes one image.
+   *
+   * @return false if a library call fails or no record fits the budget.
+   */
+  bool encode(const ImageView &image, Kind7Record &record) {
+    record = Kind7Record();
+    std::size_t pixels = (std::size_t)image.width * image.height;
+    // Records never exceed the raw image by more than the headers.
+    reserve(pixels + 4096 + options.budget, pixels);
+    const uint8_t *input = image.pixels;
+    if (!image.contiguous()) {
+      copy_image(image, {contiguous.data(), image.width, image.height,
+                         image.width});
+      input = contiguous.data();
+    }
+
+    uint32_t aim = (uint32_t)(options.budget * (1 - options.tolerance / 2));
+    uint32_t floor = (uint32_t)(options.budget * (1 - options.tolerance));
+    uint32_t fits_below = 0, overflows_at = UINT32_MAX;
+    uint32_t target = (uint32_t)std::max(1.0, aim / ratio);
+    for (record.passes = 1; record.passes <= options.max_passes;
+         ++record.passes) {
+      IirInfo ii = kind7_iir_info(image.width, image.height);
+      uint32_t size = 0;
+      record.rc = iirPack(input, image.width, image.height, 8,
+                          (unsigned)pixels, &ii, (char *)"jp2", target,
+                          scratch.data(), &size);
+      if (record.rc)
+        return false;
+      ratio = (double)size / target;
+      if (size <= options.budget) {
+        if (size > record.size) {
+          std::swap(best, scratch);
+          record.size = size;
+          record.target = target;
+        }
+        fits_below = target;
+        if (size >= floor)
+          break;
+      } else {
+        overflows_at = target;
+      }
+      uint32_t next = (uint32_t)std::max(1.0, aim / ratio);
+      if (next <= fits_below || next >= overflows_at)
+        next = fits_below +
+               (overflows_at == UINT32_MAX ? fits_below
+                                           : (overflows_at - fits_below) / 2);
+      if (next == target || next <= fits_below)
+        break;
+      target = next;
+    }
+    record.passes = std::min(record.passes, options.max_passes);
+    record.fits = record.size > 0;
+    if (!record.fits)
+      return false;
+    record.data = best.data();
+    return !options.verify || verify(image, record);
+  }
+
+private:
+  void reserve(std::size_t record_size, std::size_t pixels) {
+    if (best.size() < record_size) {
+      best = BufferPool::local().acquire(record_size);
+      scratch = BufferPool::local().acquire(record_size);
+    }
+    if (contiguous.size() < pixels) {
+      contiguous = BufferPool::local().acquire(pixels);
+      decoded = BufferPool::local().acquire(pixels);
+    }
+  }
+
+  bool verify(const ImageView &image, Kind7Record &record) {
+    IirInfo ii;
+    memset(&ii, 0, sizeof(ii));
+    uint32_t decoded_size = 0;
+    record.rc = iirUnpack(best.data(), record.size, &ii,
+                          (uint32_t)decoded.size(), decoded.data(),
+                          &decoded_size);
+    if (record.rc)
+      return false;
+    record.decoded = decoded.data();
+    if (ii.Width != image.width || ii.Height != image.height)
+      return true; // PSNR stays 0
+    double squared = 0;
+    for (int y = 0; y < image.height; ++y) {
+      const uint8_t *a = image.row(y);
+      const uint8_t *b = decoded.data() + (std::size_t)y * image.width;
+      for (int x = 0; x < image.width; ++x)
+        squared += (double)(a[x] - b[x]) * (a[x] - b[x]);
+    }
+    double mse = squared / ((double)image.width * image.height);
+    record.psnr = mse > 0 ? 10 * std::log10(255.0 * 255.0 / mse) : 99;
+    return true;
+  }
+
+  Kind7EncodeOptions options;
+  /// Record size / rate target of the last pass.
+  double ratio = 1;
+  PooledBuffer best, scratch, contiguous, decoded;
+};
@@ -0,0 +1,66 @@
+/// @file latency_stats.h
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+/**
+ * @brief Collects latency samples (in milliseconds) and reports their
+ * distribution.
+ *
+ * Not thread-safe: keep one instance per thread and @ref merge them.
+ */
+class LatencyStats {
+public:
+  void add(double ms) {
+    samples.push_back(ms);
+    sorted = false;
+  }
+
+  void merge(const LatencyStats &other) {
+    samples.insert(samples.end(), other.samples.begin(), other.samples.end());
+    sorted = false;
+  }
+
+  void clear() { samples.clear(); }
+
+  std::size_t count() const { return samples.size(); }
+
+  double mean() const {
+    double sum = 0;
+    for (double s : samples)
+      sum += s;
+    return samples.empty() ? 0 : sum / samples.size();
+  }
+
+  /**
+   * @brief Nearest-rank percentile.
+   *
+   * @param p percentile in range [0, 100].
+   */
+  double percentile(double p) const {
+    if (samples.empty())
+      return 0;
+    if (!sorted) {
+      std::sort(samples.begin(), samples.end());
+      sorted = true;
+    }
+    std::size_t rank = (std::size_t)std::ceil(p / 100 * samples.size());
+    return samples[std::min(samples.size() - 1, rank ? rank - 1 : 0)];
+  }
+
+  double max() const { return percentile(100); }
+
+private:
+  mutable std::vector<double> samples;
+  mutable bool sorted = true;
+};
+
+inline std::ostream &operator<<(std::ostream &out, const LatencyStats &s) {
+  return out << "n=" << s.count() << " mean=" << s.mean()
+             << " p50=" << s.percentile(50) << " p95=" << s.percentile(95)
+             << " p99=" << s.percentile(99) << " max=" << s.max() << " ms";
+}
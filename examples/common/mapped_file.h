@@ -0,0 +1,148 @@
+/// @file mapped_file.h
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Move-only memory mapping of a whole file.
+ *
+ * Pages are shared with the page cache, so several processes mapping the
+ * same file keep a single copy of it in memory.
+ */
+class MappedFile {
+public:
+  enum class Mode {
+    /// The mapping is read only.
+    ReadOnly,
+    /// The mapping is writable, writes stay private to the process and never
+    /// reach the file.
+    CopyOnWrite
+  };
+
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  MappedFile(MappedFile &&other) noexcept { swap(other); }
+  MappedFile &operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+      close();
+      swap(other);
+    }
+    return *this;
+  }
+
+  /**
+   * @brief Maps the file into memory.
+   *
+   * @param path file name.
+   * @param mode mapping mode.
+   * @return true on success.
+   */
+  bool open(const std::string &path, Mode mode = Mode::ReadOnly) {
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+      return false;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+      CloseHandle(file);
+      return false;
+    }
+    length = (std::size_t)file_size.QuadPart;
+    if (length > 0) {
+      HANDLE mapping = CreateFileMappingA(
+          file, NULL, mode == Mode::ReadOnly ? PAGE_READONLY : PAGE_WRITECOPY,
+          0, 0, NULL);
+      if (mapping)
+        memory = (uint8_t *)MapViewOfFile(
+            mapping, mode == Mode::ReadOnly ? FILE_MAP_READ : FILE_MAP_COPY, 0,
+            0, 0);
+      if (mapping)
+        CloseHandle(mapping);
+    }
+    CloseHandle(file);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+    }
+    length = (std::size_t)st.st_size;
+    if (length > 0) {
+      int prot = mode == Mode::ReadOnly ? PROT_READ : PROT_READ | PROT_WRITE;
+      void *p = mmap(NULL, length, prot, MAP_PRIVATE, fd, 0);
+      memory = p == MAP_FAILED ? nullptr : (uint8_t *)p;
+    }
+    ::close(fd);
+#endif
+    if (length > 0 && !memory) {
+      length = 0;
+      return false;
+    }
+    opened = true;
+    return true;
+  }
+
+  void close() {
+    if (memory) {
+#ifdef _WIN32
+      UnmapViewOfFile(memory);
+#else
+      munmap(memory, length);
+#endif
+    }
+    memory = nullptr;
+    length = 0;
+    opened = false;
+  }
+
+  /**
+   * @brief Hints the kernel to start reading the whole file in.
+   */
+  void will_need() const {
+#if !defined(_WIN32) && defined(MADV_WILLNEED)
+    if (memory)
+      madvise(memory, length, MADV_WILLNEED);
+#endif
+  }
+
+  bool is_open() const { return opened; }
+  const uint8_t *data() const { return memory; }
+  /// Writable only for @ref Mode::CopyOnWrite mappings.
+  uint8_t *data() { return memory; }
+  std::size_t size() const { return length; }
+
+private:
+  void swap(MappedFile &other) noexcept {
+    std::swap(memory, other.memory);
+    std::swap(length, other.length);
+    std::swap(opened, other.opened);
+  }
+
+  uint8_t *memory = nullptr;
+  std::size_t length = 0;
+  bool opened = false;
+};
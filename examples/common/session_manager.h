@@ -0,0 +1,342 @@
+/// @file session_manager.h
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "iris_engine_v3.h"
+#include "buffer_pool.h"
+#include "ire3_features.h"
+#include "irm2_session.h"
+
+/**
+ * @brief Memory one session needs, split into what must stay resident for
+ * its whole life and what it only uses while processing a frame.
+ */
+struct SessionFootprint {
+  /// irm2 context: holds the enrollment, identification or capture state
+  /// between frames.
+  std::size_t context = 0;
+  /// ire3 extraction buffers of one eye: working set, serialized output and
+  /// staging copy of the crop. Nothing in them outlives an extraction.
+  std::size_t scratch = 0;
+  uint32_t eyes = 0;
+
+  /// Memory of a session owning one set of scratch buffers per eye.
+  std::size_t dedicated() const { return context + eyes * scratch; }
+};
+
+/**
+ * @brief Size of the ire3 extraction buffers of one eye crop, as allocated
+ * by @ref Ire3Extractor.
+ *
+ * @return 0 if the engine can not be queried.
+ */
+inline std::size_t ire3_scratch_size(const ire3_settings &settings,
+                                     int crop_width, int crop_height) {
+  size_t set_size = 0, max_size = 0;
+  ire3_settings s = settings;
+  if (ire3_get_extraction_working_set_size(&set_size, &s) != IRE3_STATUS_OK ||
+      ire3_get_max_features_size(&max_size) != IRE3_STATUS_OK)
+    return 0;
+  return set_size + max_size + (std::size_t)crop_width * crop_height;
+}
+
+/**
+ * @brief Memory cost of a session of type `Session` for frames of `config`
+ * whose eyes are extracted from `crop_width` x `crop_height` crops.
+ */
+template <class Session>
+SessionFootprint session_footprint(const Irm2Config &config,
+                                   const ire3_settings &settings,
+                                   int crop_width, int crop_height) {
+  SessionFootprint footprint;
+  footprint.context = Session::context_size(config);
+  footprint.scratch = ire3_scratch_size(settings, crop_width, crop_height);
+  footprint.eyes = Session::eyes;
+  return footprint;
+}
+
+struct SessionManagerOptions {
+  /// Upper limit of the memory held by contexts and scratch buffers.
+  std::size_t memory_cap = (std::size_t)1 << 30;
+  /// Scratch buffer sets shared by all sessions, 0 if every session owns
+  /// its extractors. More sets than threads extracting at once are never
+  /// used.
+  std::size_t scratch_sets = std::max(1u, std::thread::hardware_concurrency());
+  ire3_settings extraction = {sizeof(ire3_settings), 150, 4};
+  /// Size of the eye crops handed to the extractors.
+  int crop_width = 640;
+  int crop_height = 480;
+};
+
+struct SessionManagerStats {
+  std::size_t active = 0;
+  std::size_t peak_active = 0;
+  /// Sessions refused because they would have exceeded the cap.
+  std::size_t refused = 0;
+  /// Memory of the admitted sessions plus the shared scratch sets.
+  std::size_t resident_bytes = 0;
+  std::size_t peak_resident_bytes = 0;
+  std::size_t scratch_sets = 0;
+  std::size_t scratch_bytes = 0;
+  /// Borrows that waited for a scratch set held by another session.
+  std::size_t scratch_waits = 0;
+
+  double resident_per_session() const {
+    return active ? (double)resident_bytes / active : 0;
+  }
+};
+
+inline std::ostream &operator<<(std::ostream &out,
+                                const SessionManagerStats &s) {
+  return out << "Sessions: " << s.active << " active (peak "
+             << s.peak_active << "), " << s.refused << " refused, "
+             << s.resident_bytes / 1048576.0 << " MB resident (peak "
+             << s.peak_resident_bytes / 1048576.0 << " MB), "
+             << s.resident_per_session() / 1048576.0
+             << " MB per session, " << s.scratch_sets
+             << " shared scratch sets, " << s.scratch_waits
+             << " scratch waits";
+}
+
+/**
+ * @brief Admits concurrent sessions under a memory cap and lends them
+ * shared ire3 scratch buffers.
+ *
+ * The irm2 context is opaque to the caller and the engine keeps pointers
+ * into it, so it stays resident for the life of a session. What a session
+ * needs only while processing a frame, the ire3 extraction buffers, comes
+ * from a few scratch sets shared by all sessions: an idle session holds
+ * its context and nothing else. The memory of the scratch sets is reserved
+ * against the cap up front.
+ *
+ * Contexts and scratch buffers come from the manager's own pool, so a
+ * closed session's context is reused by the next one of the same geometry.
+ * The pool is trimmed before memory in use and cached would exceed the cap.
+ *
+ * Thread-safe.
+ */
+class SessionManager {
+public:
+  /**
+   * @brief Reservation of a session's memory; releases it on destruction.
+   * Empty when the session was refused.
+   */
+  class Admission {
+  public:
+    Admission() = default;
+    ~Admission() { release(); }
+
+    Admission(Admission &&other) noexcept { swap(other); }
+    Admission &operator=(Admission &&other) noexcept {
+      if (this != &other) {
+        release();
+        swap(other);
+      }
+      return *this;
+    }
+    Admission(const Admission &) = delete;
+    Admission &operator=(const Admission &) = delete;
+
+    explicit operator bool() const { return manager != nullptr; }
+    std::size_t bytes() const { return reserved; }
+
+    void release() {
+      if (manager)
+        manager->release(reserved);
+      manager = nullptr;
+      reserved = 0;
+    }
+
+  private:
+    friend class SessionManager;
+
+    Admission(SessionManager *manager, std::size_t bytes)
+        : manager(manager), reserved(bytes) {}
+
+    void swap(Admission &other) noexcept {
+      std::swap(manager, other.manager);
+      std::swap(reserved, other.reserved);
+    }
+
+    SessionManager *manager = nullptr;
+    std::size_t reserved = 0;
+  };
+
+  /**
+   * @brief A shared scratch set lent to one session; goes back to the
+   * manager on destruction.
+   */
+  class Scratch {
+  public:
+    Scratch() = default;
+    ~Scratch() { reset(); }
+
+    Scratch(Scratch &&other) noexcept { swap(other); }
+    Scratch &operator=(Scratch &&other) noexcept {
+      if (this != &other) {
+        reset();
+        swap(other);
+      }
+      return *this;
+    }
+    Scratch(const Scratch &) = delete;
+    Scratch &operator=(const Scratch &) = delete;
+
+    Ire3Extractor &extractor() { return *set; }
+    explicit operator bool() const { return set != nullptr; }
+
+    void reset() {
+      if (set)
+        manager->give_back(std::move(set));
+      manager = nullptr;
+    }
+
+  private:
+    friend class SessionManager;
+
+    Scratch(SessionManager *manager, std::unique_ptr<Ire3Extractor> set)
+        : manager(manager), set(std::move(set)) {}
+
+    void swap(Scratch &other) noexcept {
+      std::swap(manager, other.manager);
+      std::swap(set, other.set);
+    }
+
+    SessionManager *manager = nullptr;
+    std::unique_ptr<Ire3Extractor> set;
+  };
+
+  explicit SessionManager(const SessionManagerOptions &options = {})
+      : options(options), buffers(options.memory_cap) {
+    std::size_t sets = options.scratch_sets;
+    scratch_size = ire3_scratch_size(options.extraction, options.crop_width,
+                                     options.crop_height);
+    totals.scratch_sets = sets;
+    totals.scratch_bytes = sets * scratch_size;
+    totals.resident_bytes = totals.peak_resident_bytes = totals.scratch_bytes;
+  }
+
+  /**
+   * @brief Reserves the memory of a new session.
+   *
+   * @param footprint cost of the session, see @ref session_footprint.
+   * @param dedicated_scratch reserve scratch buffers for every eye of the
+   * session instead of using the shared ones.
+   * @return the reservation, empty if it would exceed the cap.
+   */
+  Admission admit(const SessionFootprint &footprint,
+                  bool dedicated_scratch = false) {
+    std::size_t bytes =
+        dedicated_scratch ? footprint.dedicated() : footprint.context;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (totals.resident_bytes + bytes > options.memory_cap) {
+      ++totals.refused;
+      return Admission();
+    }
+    // Cached buffers of other geometries would push the process over the
+    // cap once this session allocates.
+    if (totals.resident_bytes + bytes + buffers.stats().cached_bytes >
+        options.memory_cap)
+      buffers.trim();
+    totals.resident_bytes += bytes;
+    totals.peak_resident_bytes =
+        std::max(totals.peak_resident_bytes, totals.resident_bytes);
+    totals.peak_active = std::max(totals.peak_active, ++totals.active);
+    return Admission(this, bytes);
+  }
+
+  /**
+   * @brief Lends a shared scratch set; blocks while all sets are lent.
+   *
+   * @return the set, empty if there are no shared sets or its buffers can
+   * not be initialized.
+   */
+  Scratch borrow() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (totals.scratch_sets == 0)
+      return Scratch();
+    if (idle.empty() && created >= totals.scratch_sets) {
+      ++totals.scratch_waits;
+      returned.wait(lock, [&] {
+        return !idle.empty() || created < totals.scratch_sets;
+      });
+    }
+    std::unique_ptr<Ire3Extractor> set;
+    if (!idle.empty()) {
+      set = std::move(idle.back());
+      idle.pop_back();
+      return Scratch(this, std::move(set));
+    }
+    ++created;
+    lock.unlock();
+    set.reset(new Ire3Extractor());
+    if (set->init(options.extraction, buffers) != IRE3_STATUS_OK) {
+      lock.lock();
+      --created;
+      returned.notify_one();
+      return Scratch();
+    }
+    return Scratch(this, std::move(set));
+  }
+
+  /**
+   * @brief Pool the sessions take their contexts and dedicated scratch
+   * buffers from.
+   */
+  BufferPool &pool() { return buffers; }
+
+  std::size_t scratch_set_size() const { return scratch_size; }
+
+  SessionManagerStats stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return totals;
+  }
+
+  /**
+   * @brief Number of sessions of `footprint` fitting in `bytes`, with the
+   * shared scratch sets of this manager or with dedicated scratch buffers.
+   */
+  double sessions_per(std::size_t bytes, const SessionFootprint &footprint,
+                      bool dedicated_scratch = false) const {
+    if (dedicated_scratch)
+      return footprint.dedicated() ? (double)bytes / footprint.dedicated()
+                                   : 0;
+    if (bytes <= totals.scratch_bytes || footprint.context == 0)
+      return 0;
+    return (double)(bytes - totals.scratch_bytes) / footprint.context;
+  }
+
+private:
+  void release(std::size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    totals.resident_bytes -= bytes;
+    --totals.active;
+  }
+
+  void give_back(std::unique_ptr<Ire3Extractor> set) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      idle.push_back(std::move(set));
+    }
+    returned.notify_one();
+  }
+
+  SessionManagerOptions options;
+  BufferPool buffers;
+  std::size_t scratch_size = 0;
+
+  mutable std::mutex mutex;
+  std::condition_variable returned;
+  std::vector<std::unique_ptr<Ire3Extractor>> idle;
+  std::size_t created = 0;
+  SessionManagerStats totals;
+};
@@ -0,0 +1,356 @@
+/// @file session_tasks.h
+#pragma once
+
+#if !defined(__cpp_impl_coroutine) || __cpp_impl_coroutine < 201902L
+#error "session_tasks.h requires C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "iris_engine_v3.h"
+#include "iris_mobile_v2.h"
+#include "buffer_pool.h"
+#include "image_source.h"
+#include "ire3_features.h"
+#include "irm2_session.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+template <class T = void> class Task;
+
+namespace session_tasks_detail {
+
+struct PromiseBase {
+  /// Coroutine awaiting the task, resumed when it completes.
+  std::coroutine_handle<> continuation = std::noop_coroutine();
+  std::exception_ptr error;
+
+  struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template <class Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> done) const noexcept {
+      return done.promise().continuation;
+    }
+    void await_resume() const noexcept {}
+  };
+
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+  void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <class T> struct Promise : PromiseBase {
+  std::optional<T> value;
+
+  Task<T> get_return_object();
+  template <class U> void return_value(U &&result) {
+    value.emplace(std::forward<U>(result));
+  }
+};
+
+template <> struct Promise<void> : PromiseBase {
+  Task<void> get_return_object();
+  void return_void() const noexcept {}
+};
+
+} // namespace session_tasks_detail
+
+/**
+ * @brief Lazy coroutine producing a `T`.
+ *
+ * Nothing runs until the task is awaited; the awaiting coroutine is resumed
+ * on whatever thread the task completes on. Reference arguments of a task
+ * are not copied and must outlive the `co_await`, which they do when the
+ * task is awaited in the expression creating it.
+ */
+template <class T> class Task {
+public:
+  using promise_type = session_tasks_detail::Promise<T>;
+
+  Task(Task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (handle)
+        handle.destroy();
+      handle = std::exchange(other.handle, {});
+    }
+    return *this;
+  }
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+  ~Task() {
+    if (handle)
+      handle.destroy();
+  }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<>
+  await_suspend(std::coroutine_handle<> caller) noexcept {
+    handle.promise().continuation = caller;
+    return handle;
+  }
+  T await_resume() {
+    if (handle.promise().error)
+      std::rethrow_exception(handle.promise().error);
+    if constexpr (!std::is_void_v<T>)
+      return std::move(*handle.promise().value);
+  }
+
+private:
+  friend promise_type;
+
+  explicit Task(std::coroutine_handle<promise_type> handle)
+      : handle(handle) {}
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+namespace session_tasks_detail {
+
+template <class T> Task<T> Promise<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+  return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+/**
+ * @brief Coroutine owning itself: runs until its end, then frees its frame.
+ */
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() const noexcept { return {}; }
+    std::suspend_never initial_suspend() const noexcept { return {}; }
+    std::suspend_never final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept { std::terminate(); }
+  };
+};
+
+} // namespace session_tasks_detail
+
+/**
+ * @brief Runs the engine calls of many coroutine sessions on a few worker
+ * threads.
+ *
+ * A coroutine moves onto the workers with `co_await executor.schedule()`
+ * and stays there until it suspends again. The session wrappers below
+ * reschedule before every engine call, so a session gives up its worker
+ * between frames and sessions take turns in the order their frames
+ * arrived, however many of them are open. A thread that only starts
+ * sessions and collects their results never waits for the engine.
+ */
+class SessionExecutor {
+public:
+  /**
+   * @param num_threads worker threads, 0 for the hardware concurrency.
+   */
+  explicit SessionExecutor(std::size_t num_threads = 0) : pool(num_threads) {}
+
+  SessionExecutor(const SessionExecutor &) = delete;
+  SessionExecutor &operator=(const SessionExecutor &) = delete;
+
+  struct ScheduleAwaiter {
+    SessionExecutor &executor;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> next) const {
+      executor.pool.post([next](std::size_t worker) {
+        current_worker() = worker;
+        next.resume();
+      });
+    }
+    void await_resume() const noexcept {}
+  };
+
+  /**
+   * @brief Suspends the calling coroutine and resumes it on a worker.
+   */
+  ScheduleAwaiter schedule() { return {*this}; }
+
+  /**
+   * @brief Starts `task` on a worker and returns at once.
+   *
+   * @param done called on the worker once the task completed; the executor
+   * must not be destroyed before.
+   */
+  void spawn(Task<void> task, std::function<void()> done = {}) {
+    run(*this, std::move(task), std::move(done));
+  }
+
+  std::size_t size() const { return pool.size(); }
+
+  /**
+   * @brief Index of the worker running the calling coroutine, valid until
+   * it suspends.
+   */
+  static std::size_t worker() { return current_worker(); }
+
+private:
+  static std::size_t &current_worker() {
+    thread_local std::size_t index = 0;
+    return index;
+  }
+
+  static session_tasks_detail::Detached
+  run(SessionExecutor &executor, Task<void> task, std::function<void()> done) {
+    co_await executor.schedule();
+    {
+      // Frees the task's frame, and the session it may hold, before `done`.
+      Task<void> body = std::move(task);
+      co_await body;
+    }
+    if (done)
+      done();
+  }
+
+  ThreadPool pool;
+};
+
+/**
+ * @brief Outcome of one frame of an @ref AsyncIrm2Session.
+ */
+struct Irm2FrameResult {
+  /// Status of `on_frame`.
+  int rc = 0;
+  irm2_ui_hints hints = {0};
+  /// Enrollment or capture progress, zero for identification.
+  irm2_enrollment_info progress = {0};
+  /// Identified template, -1 while there is none.
+  int template_id = -1;
+};
+
+/**
+ * @brief Coroutine facade of an @ref Irm2Session whose engine calls run on
+ * a @ref SessionExecutor.
+ *
+ * Every call returns a lazy @ref Task that moves to a worker, makes its
+ * engine calls and resumes the awaiting coroutine there. A session is
+ * driven by one coroutine at a time; frame views must stay valid until the
+ * frame is awaited.
+ */
+template <Irm2Mode Mode, uint32_t Eyes> class AsyncIrm2Session {
+public:
+  using Session = Irm2Session<Mode, Eyes>;
+
+  explicit AsyncIrm2Session(SessionExecutor &executor) : executor(executor) {}
+
+  /**
+   * @brief Initializes the session with the arguments of the `init` of
+   * @ref Irm2Session for `Mode`.
+   */
+  template <class... Args> Task<int> init(Args &&...args) {
+    co_await executor.schedule();
+    co_return session.init(std::forward<Args>(args)...);
+  }
+
+  /**
+   * @brief Processes a frame and queries the hints and the progress or the
+   * identification result.
+   */
+  Task<Irm2FrameResult> next_frame(const ImageView &frame,
+                                   uint32_t rotation = 0) {
+    co_await executor.schedule();
+    TRACE_SCOPE("async_frame");
+    Irm2FrameResult result;
+    result.rc = session.on_frame(frame, rotation);
+    session.ui_hints(result.hints);
+    if constexpr (Mode == Irm2Mode::Identify) {
+      if (result.rc == 0)
+        session.identification_result(result.template_id);
+    } else {
+      session.progress(result.progress);
+    }
+    co_return result;
+  }
+
+  Task<int> continue_enrollment() {
+    return call([](Session &s) { return s.continue_enrollment(); });
+  }
+
+  Task<int> get_template(Irm2Template &iris_template) {
+    return call([&iris_template](Session &s) {
+      return s.get_template(iris_template);
+    });
+  }
+
+  /**
+   * @brief Runs `fn(session)` on a worker, for calls the facade does not
+   * wrap.
+   */
+  template <class Fn>
+  Task<std::invoke_result_t<Fn &, Session &>> call(Fn fn) {
+    co_await executor.schedule();
+    co_return fn(session);
+  }
+
+  /**
+   * @brief The wrapped session; only to be used while no task of this
+   * facade is running.
+   */
+  Session &sync() { return session; }
+
+private:
+  SessionExecutor &executor;
+  Session session;
+};
+
+using AsyncIrm2Enrollment = AsyncIrm2Session<Irm2Mode::Enroll, 2>;
+using AsyncIrm2Identification = AsyncIrm2Session<Irm2Mode::Identify, 2>;
+using AsyncIrm2Capture = AsyncIrm2Session<Irm2Mode::Capture, 1>;
+
+/**
+ * @brief Outcome of one @ref AsyncIre3Extractor::extract call.
+ */
+struct Ire3ExtractResult {
+  int rc = 0;
+  ire3_eye_info eye_info = {0};
+  /// Deserialized features, valid when `rc` is IRE3_STATUS_OK.
+  FeatureSet features;
+};
+
+/**
+ * @brief ire3 extraction for coroutines on a @ref SessionExecutor.
+ *
+ * An extraction never suspends once it runs, so the extraction buffers are
+ * not tied to a session: every worker owns one extractor, initialized on
+ * first use from its thread's @ref BufferPool, and any number of sessions
+ * share them without locking or waiting.
+ */
+class AsyncIre3Extractor {
+public:
+  AsyncIre3Extractor(SessionExecutor &executor, const ire3_settings &settings)
+      : executor(executor), settings(settings), extractors(executor.size()) {}
+
+  AsyncIre3Extractor(const AsyncIre3Extractor &) = delete;
+  AsyncIre3Extractor &operator=(const AsyncIre3Extractor &) = delete;
+
+  /**
+   * @brief Extracts and deserializes the features of an eye image, which
+   * must stay valid until the extraction is awaited.
+   */
+  Task<Ire3ExtractResult> extract(const ImageView &image) {
+    co_await executor.schedule();
+    TRACE_SCOPE("async_extract");
+    Ire3ExtractResult result;
+    Ire3Extractor &extractor = extractors[SessionExecutor::worker()];
+    result.rc = extractor ? IRE3_STATUS_OK : extractor.init(settings);
+    if (result.rc == IRE3_STATUS_OK)
+      result.rc = extractor.extract(image, result.features, &result.eye_info);
+    co_return result;
+  }
+
+private:
+  SessionExecutor &executor;
+  ire3_settings settings;
+  std::vector<Ire3Extractor> extractors;
+};
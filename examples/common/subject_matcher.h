@@ -0,0 +1,367 @@
+/// @file subject_matcher.h
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <ostream>
+#include <stdint.h>
+#include <vector>
+
+#include "iris_engine_v3.h"
+#include "ire3_gallery_matcher.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+/// Number of eyes of a subject, 0 is the left and 1 the right one.
+#define SUBJECT_EYES (2)
+
+/**
+ * @brief How several scores are combined into one.
+ */
+enum class FusionRule {
+  /// Best score.
+  Max,
+  /// Sum of the scores; favours subjects with more samples or both eyes.
+  Sum,
+};
+
+/**
+ * @brief Gallery records grouped per subject and eye.
+ *
+ * The records stay where they are, the groups hold their indices.
+ */
+class SubjectGallery {
+public:
+  struct Subject {
+    uint32_t id;
+    /// Samples of eye `e` are `samples[begin[e]..begin[e + 1])`.
+    std::size_t begin[SUBJECT_EYES + 1];
+
+    std::size_t count(int eye) const { return begin[eye + 1] - begin[eye]; }
+  };
+
+  explicit SubjectGallery(const FeatureGalleryView &records)
+      : records(records) {}
+
+  /**
+   * @brief Adds record `record` as a sample of `eye` of subject `subject`;
+   * takes effect on @ref finish.
+   */
+  void add(std::size_t record, uint32_t subject, int eye) {
+    pending.push_back({subject, eye, record});
+  }
+
+  /**
+   * @brief Groups the added records.
+   */
+  void finish() {
+    std::stable_sort(pending.begin(), pending.end(),
+                     [](const Sample &a, const Sample &b) {
+                       return a.subject != b.subject ? a.subject < b.subject
+                                                     : a.eye < b.eye;
+                     });
+    groups.clear();
+    samples.resize(pending.size());
+    for (std::size_t i = 0; i < pending.size(); ++i) {
+      const Sample &s = pending[i];
+      if (groups.empty() || groups.back().id != s.subject)
+        groups.push_back({s.subject, {i, i, i}});
+      Subject &subject = groups.back();
+      for (int e = s.eye + 1; e <= SUBJECT_EYES; ++e)
+        subject.begin[e] = i + 1;
+      samples[i] = s.record;
+    }
+    pending.clear();
+  }
+
+  std::size_t size() const { return groups.size(); }
+  std::size_t sample_count() const { return samples.size(); }
+  const Subject &subject(std::size_t i) const { return groups[i]; }
+  /// Record of the `n`-th sample in grouped order.
+  const uint8_t *sample(std::size_t n) const {
+    return records.record(samples[n]);
+  }
+  const FeatureGalleryView &view() const { return records; }
+
+private:
+  struct Sample {
+    uint32_t subject;
+    int eye;
+    std::size_t record;
+  };
+
+  FeatureGalleryView records;
+  std::vector<Sample> pending;
+  std::vector<std::size_t> samples;
+  std::vector<Subject> groups;
+};
+
+/**
+ * @brief Subject level search result.
+ */
+struct SubjectMatch {
+  /// Index of the subject in the @ref SubjectGallery.
+  std::size_t subject;
+  int64_t score;
+};
+
+struct FusionOptions {
+  /// Combines the samples of one eye.
+  FusionRule samples = FusionRule::Max;
+  /// Combines the two eyes.
+  FusionRule eyes = FusionRule::Sum;
+  /// Number of best subjects to return.
+  std::size_t top_k = 1;
+  /// Subjects whose fused score stays below this are not returned.
+  int64_t threshold = std::numeric_limits<int64_t>::min();
+  /// Highest score of a single comparison. With early termination scores
+  /// are clipped to it so that the bounds hold; flat scoring never clips.
+  int max_score = std::numeric_limits<int>::max();
+  /// Stops scoring a subject once its fused score can no longer reach the
+  /// threshold or the current top-k. Off gives flat scoring of every sample.
+  bool early_termination = true;
+  /// The search stops as soon as a subject reaches this fused score.
+  int64_t accept_score = std::numeric_limits<int64_t>::max();
+  /// Number of consecutive subjects handed to a worker at once.
+  std::size_t chunk_size = 64;
+};
+
+struct FusionStats {
+  std::size_t comparisons = 0;
+  std::size_t failures = 0;
+  std::size_t subjects = 0;
+  /// Subjects abandoned before all their samples were compared.
+  std::size_t pruned = 0;
+  bool stopped_early = false;
+  double seconds = 0;
+
+  FusionStats &operator+=(const FusionStats &s) {
+    comparisons += s.comparisons;
+    failures += s.failures;
+    subjects += s.subjects;
+    pruned += s.pruned;
+    stopped_early |= s.stopped_early;
+    seconds += s.seconds;
+    return *this;
+  }
+};
+
+inline std::ostream &operator<<(std::ostream &out, const FusionStats &s) {
+  return out << s.comparisons << " comparisons, " << s.pruned << " of "
+             << s.subjects << " subjects pruned, " << s.seconds * 1000
+             << " ms";
+}
+
+/**
+ * @brief 1:N search of a two-eye probe against the subjects of a
+ * @ref SubjectGallery using `ire3_compare`.
+ *
+ * A probe eye is compared with the samples of the same eye only. Its scores
+ * are fused per eye with `FusionOptions::samples`, the eyes with
+ * `FusionOptions::eyes`; an eye missing from the probe or the subject does
+ * not contribute.
+ *
+ * With early termination every comparison first checks an upper bound of
+ * the subject's fused score, where each sample still to compare counts as
+ * `max_score`. Once the bound falls below the threshold or the k-th best
+ * fused score found so far by any worker, the subject can no longer change
+ * the result and its remaining samples are skipped. As long as no
+ * comparison exceeds `max_score` the result is the same as with flat
+ * scoring, only pruned subjects are missing from the fused scores, never
+ * from the top-k.
+ */
+class SubjectMatcher {
+public:
+  SubjectMatcher(ThreadPool &pool, const ire3_settings &settings)
+      : pool(pool), settings(settings) {}
+
+  /**
+   * @brief Finds the best subjects for a probe.
+   *
+   * @param probe deserialized features of the left and right eye, nullptr
+   * for an eye the probe lacks.
+   * @param gallery grouped gallery.
+   * @param options fusion and search options.
+   * @param stats optional output for search statistics.
+   * @return up to `options.top_k` subjects, best first.
+   */
+  std::vector<SubjectMatch> search(const uint8_t *const probe[SUBJECT_EYES],
+                                   const SubjectGallery &gallery,
+                                   const FusionOptions &options,
+                                   FusionStats *stats = nullptr) {
+    auto start = std::chrono::steady_clock::now();
+    std::size_t chunk = std::max<std::size_t>(1, options.chunk_size);
+    std::size_t num_chunks = (gallery.size() + chunk - 1) / chunk;
+
+    std::vector<Worker> workers(pool.size());
+    std::atomic<int64_t> floor{options.threshold};
+    std::atomic<bool> stop{false};
+
+    pool.parallel_for(num_chunks, [&](std::size_t task, std::size_t index) {
+      TRACE_SCOPE("fusion_chunk");
+      Worker &worker = workers[index];
+      ire3_settings s = settings;
+      std::size_t end = std::min(gallery.size(), (task + 1) * chunk);
+      for (std::size_t i = task * chunk; i < end; ++i) {
+        if (stop.load(std::memory_order_relaxed))
+          return;
+        int64_t score = 0;
+        if (!score_subject(probe, gallery, i, options, floor, s, worker,
+                           score))
+          continue;
+        if (score < options.threshold)
+          continue;
+        push_top_k(worker.best, options.top_k, {i, score});
+        if (worker.best.size() == options.top_k)
+          raise(floor, worker.best.front().score);
+        if (score >= options.accept_score)
+          stop.store(true, std::memory_order_relaxed);
+      }
+    });
+
+    std::vector<SubjectMatch> results;
+    FusionStats total;
+    for (auto &worker : workers) {
+      results.insert(results.end(), worker.best.begin(), worker.best.end());
+      total += worker.stats;
+    }
+    std::sort(results.begin(), results.end(), better);
+    if (results.size() > options.top_k)
+      results.resize(options.top_k);
+
+    if (stats) {
+      total.stopped_early = stop.load();
+      total.seconds = std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+      *stats = total;
+    }
+    return results;
+  }
+
+private:
+  // Aligned so that counters of different workers never share a cache line.
+  struct alignas(64) Worker {
+    std::vector<SubjectMatch> best; // min-heap ordered by `better`
+    FusionStats stats;
+  };
+
+  static int64_t fuse(FusionRule rule, int64_t a, int64_t b) {
+    return rule == FusionRule::Max ? std::max(a, b) : a + b;
+  }
+
+  /**
+   * @brief Highest fused score of one eye with `remaining` of its samples
+   * still to compare.
+   */
+  static int64_t eye_bound(const FusionOptions &options, bool started,
+                           int64_t fused, std::size_t remaining) {
+    if (remaining == 0)
+      return fused;
+    int64_t rest = options.samples == FusionRule::Max
+                       ? options.max_score
+                       : (int64_t)remaining * options.max_score;
+    return started ? fuse(options.samples, fused, rest) : rest;
+  }
+
+  /**
+   * @brief Compares the probe with the samples of subject `i`.
+   *
+   * @return false if the subject has nothing to compare, or was abandoned
+   * because it can no longer reach `floor`.
+   */
+  bool score_subject(const uint8_t *const probe[SUBJECT_EYES],
+                     const SubjectGallery &gallery, std::size_t i,
+                     const FusionOptions &options,
+                     const std::atomic<int64_t> &floor, ire3_settings &s,
+                     Worker &worker, int64_t &score) {
+    const SubjectGallery::Subject &subject = gallery.subject(i);
+    int64_t fused[SUBJECT_EYES] = {0, 0};
+    bool started[SUBJECT_EYES] = {false, false};
+    std::size_t remaining[SUBJECT_EYES];
+    bool any = false;
+    for (int e = 0; e < SUBJECT_EYES; ++e) {
+      remaining[e] = probe[e] ? subject.count(e) : 0;
+      any |= remaining[e] > 0;
+    }
+    if (!any)
+      return false;
+    ++worker.stats.subjects;
+
+    for (int e = 0; e < SUBJECT_EYES; ++e) {
+      if (!probe[e])
+        continue;
+      for (std::size_t n = subject.begin[e]; n < subject.begin[e + 1]; ++n) {
+        if (options.early_termination) {
+          int64_t bound = 0;
+          bool first = true;
+          for (int b = 0; b < SUBJECT_EYES; ++b) {
+            if (!started[b] && remaining[b] == 0)
+              continue;
+            int64_t eye =
+                eye_bound(options, started[b], fused[b], remaining[b]);
+            bound = first ? eye : fuse(options.eyes, bound, eye);
+            first = false;
+          }
+          if (bound < floor.load(std::memory_order_relaxed)) {
+            ++worker.stats.pruned;
+            return false;
+          }
+        }
+        --remaining[e];
+        int value = 0;
+        ++worker.stats.comparisons;
+        if (ire3_compare(probe[e], gallery.sample(n), &s, &value) !=
+            IRE3_STATUS_OK) {
+          ++worker.stats.failures;
+          continue;
+        }
+        if (options.early_termination)
+          value = std::min(value, options.max_score);
+        fused[e] = started[e] ? fuse(options.samples, fused[e], value) : value;
+        started[e] = true;
+      }
+    }
+
+    bool first = true;
+    for (int e = 0; e < SUBJECT_EYES; ++e) {
+      if (!started[e])
+        continue;
+      score = first ? fused[e] : fuse(options.eyes, score, fused[e]);
+      first = false;
+    }
+    return !first;
+  }
+
+  static void raise(std::atomic<int64_t> &floor, int64_t value) {
+    int64_t current = floor.load(std::memory_order_relaxed);
+    while (current < value &&
+           !floor.compare_exchange_weak(current, value,
+                                        std::memory_order_relaxed))
+      ;
+  }
+
+  static bool better(const SubjectMatch &a, const SubjectMatch &b) {
+    return a.score != b.score ? a.score > b.score : a.subject < b.subject;
+  }
+
+  static void push_top_k(std::vector<SubjectMatch> &heap, std::size_t k,
+                         const SubjectMatch &m) {
+    if (k == 0)
+      return;
+    if (heap.size() < k) {
+      heap.push_back(m);
+      std::push_heap(heap.begin(), heap.end(), better);
+    } else if (better(m, heap.front())) {
+      std::pop_heap(heap.begin(), heap.end(), better);
+      heap.back() = m;
+      std::push_heap(heap.begin(), heap.end(), better);
+    }
+  }
+
+  ThreadPool &pool;
+  ire3_settings settings;
+};
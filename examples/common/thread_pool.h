@@ -0,0 +1,113 @@
+/// @file thread_pool.h
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed-size pool of worker threads.
+ *
+ * Every job receives the index of the worker that runs it, so callers can
+ * keep per-worker state (working sets, partial results) without locking.
+ */
+class ThreadPool {
+public:
+  using Job = std::function<void(std::size_t worker)>;
+
+  /**
+   * @brief Starts the workers.
+   *
+   * @param num_threads number of workers, 0 means one per hardware thread.
+   */
+  explicit ThreadPool(std::size_t num_threads = 0) {
+    if (num_threads == 0)
+      num_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < num_threads; ++i)
+      workers.emplace_back([this, i] { run(i); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  std::size_t size() const { return workers.size(); }
+
+  /**
+   * @brief Queues a job for asynchronous execution.
+   */
+  void post(Job job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push(std::move(job));
+    }
+    wake.notify_one();
+  }
+
+  /**
+   * @brief Runs `fn(task, worker)` for every task in `[0, num_tasks)` and
+   * waits until all of them are done.
+   *
+   * Tasks are handed out dynamically, so uneven tasks are balanced across
+   * the workers. Must not be called from one of the pool's own workers.
+   */
+  void parallel_for(std::size_t num_tasks,
+                    const std::function<void(std::size_t task,
+                                             std::size_t worker)> &fn) {
+    if (num_tasks == 0)
+      return;
+    std::atomic<std::size_t> next{0};
+    std::size_t running = std::min(num_tasks, size());
+    std::mutex done_mutex;
+    std::condition_variable done;
+
+    for (std::size_t i = 0, n = running; i < n; ++i) {
+      post([&](std::size_t worker) {
+        for (std::size_t task = next++; task < num_tasks; task = next++)
+          fn(task, worker);
+        std::lock_guard<std::mutex> lock(done_mutex);
+        if (--running == 0)
+          done.notify_one();
+      });
+    }
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done.wait(lock, [&] { return running == 0; });
+  }
+
+private:
+  void run(std::size_t index) {
+    for (;;) {
+      Job job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+        if (jobs.empty())
+          return;
+        job = std::move(jobs.front());
+        jobs.pop();
+      }
+      job(index);
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::queue<Job> jobs;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+};
@@ -0,0 +1,273 @@
+/// @file trace.h
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "latency_stats.h"
+
+/**
+ * @brief Events recorded per thread; later events of a full buffer are
+ * dropped and counted.
+ */
+#define TRACE_EVENTS_PER_THREAD (1 << 16)
+
+/**
+ * @brief Opens a scope timed into the trace until the end of the block.
+ *
+ * @param name string literal naming the stage.
+ */
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+/**
+ * @brief Calls `function(...)` inside a trace scope named after the
+ * function and returns its result, e.g.
+ * `auto rc = TRACE_CALL(irm2_on_frame, ctx, pixels, 0);`.
+ */
+#define TRACE_CALL(function, ...)                                              \
+  ([&]() -> decltype(auto) {                                                   \
+    TraceScope trace_scope(#function);                                         \
+    return function(__VA_ARGS__);                                              \
+  }())
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+namespace trace_detail {
+
+using Clock = std::chrono::steady_clock;
+
+struct Event {
+  /// String literal, never copied.
+  const char *name;
+  /// 'X' for a complete scope, 'i' for an instant event.
+  char phase;
+  uint64_t start_ns;
+  uint64_t duration_ns;
+  int64_t value;
+};
+
+/**
+ * @brief Events of one thread. Only the owning thread writes; the count is
+ * published with release semantics, so a dump sees complete events.
+ */
+struct ThreadBuffer {
+  explicit ThreadBuffer(uint32_t id)
+      : id(id), events(TRACE_EVENTS_PER_THREAD) {}
+
+  void push(const Event &event) {
+    std::size_t n = count.load(std::memory_order_relaxed);
+    if (n == events.size()) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    events[n] = event;
+    count.store(n + 1, std::memory_order_release);
+  }
+
+  uint32_t id;
+  std::string name;
+  std::vector<Event> events;
+  std::atomic<std::size_t> count{0};
+  std::atomic<std::size_t> dropped{0};
+};
+
+inline const char *output_path() {
+  const char *path = std::getenv("IRIS_TRACE");
+  return path && *path ? path : nullptr;
+}
+
+/// Read once; when false every trace point costs a single branch.
+inline const bool enabled = output_path() != nullptr;
+
+/**
+ * @brief Writes `text` as a quoted JSON string.
+ */
+inline void write_json_string(std::ostream &out, const char *text) {
+  static const char hex[] = "0123456789abcdef";
+  out << '"';
+  for (const char *c = text; *c; ++c) {
+    unsigned char ch = (unsigned char)*c;
+    if (ch == '"' || ch == '\\')
+      out << '\\' << *c;
+    else if (ch < 0x20)
+      out << "\\u00" << hex[ch >> 4] << hex[ch & 15];
+    else
+      out << *c;
+  }
+  out << '"';
+}
+
+} // namespace trace_detail
+
+/**
+ * @brief Process-wide trace session, enabled by setting the `IRIS_TRACE`
+ * environment variable to the output file name.
+ *
+ * Events go to per-thread buffers without any locking. At exit the session
+ * writes a Chrome trace JSON file (open it in Perfetto or
+ * chrome://tracing) and prints per-stage latency histograms to stderr.
+ */
+class Trace {
+public:
+  static bool enabled() { return trace_detail::enabled; }
+
+  static Trace &instance() {
+    static Trace trace;
+    return trace;
+  }
+
+  ~Trace() {
+    if (!enabled())
+      return;
+    if (!write_chrome_json(trace_detail::output_path()))
+      std::cerr << "Can not write trace " << trace_detail::output_path()
+                << "\n";
+    print_summary(std::cerr);
+  }
+
+  /**
+   * @brief Buffer of the calling thread, registered on first use.
+   */
+  trace_detail::ThreadBuffer &local() {
+    thread_local std::shared_ptr<trace_detail::ThreadBuffer> buffer = [this] {
+      std::lock_guard<std::mutex> lock(mutex);
+      buffers.push_back(std::make_shared<trace_detail::ThreadBuffer>(
+          (uint32_t)buffers.size() + 1));
+      return buffers.back();
+    }();
+    return *buffer;
+  }
+
+  uint64_t now_ns() const {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               trace_detail::Clock::now() - start)
+        .count();
+  }
+
+  /**
+   * @brief Names the calling thread in the trace viewer.
+   */
+  void set_thread_name(const std::string &name) {
+    if (enabled())
+      local().name = name;
+  }
+
+  /**
+   * @brief Writes the events recorded so far as Chrome trace JSON.
+   */
+  bool write_chrome_json(const std::string &path) {
+    std::ofstream out(path);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    const char *separator = "\n";
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &buffer : buffers) {
+      if (!buffer->name.empty()) {
+        out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\","
+            << "\"pid\":1,\"tid\":" << buffer->id << ",\"args\":{\"name\":";
+        trace_detail::write_json_string(out, buffer->name.c_str());
+        out << "}}";
+        separator = ",\n";
+      }
+      std::size_t n = buffer->count.load(std::memory_order_acquire);
+      for (std::size_t i = 0; i < n; ++i) {
+        const auto &event = buffer->events[i];
+        out << separator << "{\"name\":";
+        trace_detail::write_json_string(out, event.name);
+        out << ",\"ph\":\"" << event.phase << "\",\"pid\":1,\"tid\":"
+            << buffer->id << ",\"ts\":" << event.start_ns / 1000.0;
+        if (event.phase == 'X')
+          out << ",\"dur\":" << event.duration_ns / 1000.0;
+        else
+          out << ",\"s\":\"t\",\"args\":{\"value\":" << event.value << "}";
+        out << "}";
+        separator = ",\n";
+      }
+    }
+    out << "\n]}\n";
+    return (bool)out;
+  }
+
+  /**
+   * @brief Prints a latency histogram per scope name and the number of
+   * instant events.
+   */
+  void print_summary(std::ostream &out) {
+    std::map<std::string, LatencyStats> scopes;
+    std::map<std::string, std::size_t> instants;
+    std::size_t dropped = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (const auto &buffer : buffers) {
+        std::size_t n = buffer->count.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < n; ++i) {
+          const auto &event = buffer->events[i];
+          if (event.phase == 'X')
+            scopes[event.name].add(event.duration_ns / 1e6);
+          else
+            ++instants[event.name];
+        }
+        dropped += buffer->dropped.load(std::memory_order_relaxed);
+      }
+    }
+    out << "Trace summary (" << dropped << " events dropped):\n";
+    for (const auto &scope : scopes)
+      out << "  " << scope.first << ": " << scope.second << "\n";
+    for (const auto &instant : instants)
+      out << "  " << instant.first << ": " << instant.second << " events\n";
+  }
+
+private:
+  Trace() = default;
+
+  trace_detail::Clock::time_point start = trace_detail::Clock::now();
+  std::mutex mutex;
+  std::vector<std::shared_ptr<trace_detail::ThreadBuffer>> buffers;
+};
+
+/**
+ * @brief Records the time between its construction and destruction.
+ */
+class TraceScope {
+public:
+  explicit TraceScope(const char *name) : name(name) {
+    if (Trace::enabled())
+      start = Trace::instance().now_ns();
+  }
+
+  ~TraceScope() {
+    if (!Trace::enabled())
+      return;
+    Trace &trace = Trace::instance();
+    uint64_t end = trace.now_ns();
+    trace.local().push({name, 'X', start, end - start, 0});
+  }
+
+  TraceScope(const TraceScope &) = delete;
+  TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+  const char *name;
+  uint64_t start = 0;
+};
+
+/**
+ * @brief Records an instant event with a value, e.g. a score reported by an
+ * engine callback.
+ */
+inline void trace_instant(const char *name, int64_t value) {
+  if (!Trace::enabled())
+    return;
+  Trace &trace = Trace::instance();
+  trace.local().push({name, 'i', trace.now_ns(), 0, value});
+}
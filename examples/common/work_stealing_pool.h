@@ -0,0 +1,142 @@
+/// @file work_stealing_pool.h
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Thread pool with one task deque per worker.
+ *
+ * A worker runs the newest task of its own deque and, when that is empty,
+ * steals the oldest task of another worker. Tasks of very different cost
+ * (e.g. extraction of easy and hard images) therefore never leave workers
+ * idle while others still have a backlog.
+ */
+class WorkStealingPool {
+public:
+  using Task = std::function<void(std::size_t worker)>;
+
+  /**
+   * @param num_threads number of workers, 0 means one per hardware thread.
+   */
+  explicit WorkStealingPool(std::size_t num_threads = 0) {
+    if (num_threads == 0)
+      num_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < num_threads; ++i)
+      queues.emplace_back(new Queue);
+    for (std::size_t i = 0; i < num_threads; ++i)
+      workers.emplace_back([this, i] { run(i); });
+  }
+
+  ~WorkStealingPool() {
+    wait_idle();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+  std::size_t size() const { return workers.size(); }
+
+  /**
+   * @brief Queues a task. Tasks are spread round-robin over the workers.
+   */
+  void submit(Task task) {
+    std::size_t target = next_queue++ % queues.size();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      std::lock_guard<std::mutex> queue_lock(queues[target]->mutex);
+      queues[target]->tasks.push_back(std::move(task));
+      ++pending;
+      ++queued;
+    }
+    wake.notify_one();
+  }
+
+  /**
+   * @brief Blocks until every submitted task has finished.
+   */
+  void wait_idle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return pending == 0; });
+  }
+
+  /// Number of tasks taken from another worker's deque.
+  std::size_t steals() const { return stolen.load(); }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  bool pop(std::size_t index, Task &task) {
+    {
+      Queue &own = *queues[index];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (!own.tasks.empty()) {
+        task = std::move(own.tasks.back());
+        own.tasks.pop_back();
+        --queued;
+        return true;
+      }
+    }
+    for (std::size_t i = 1; i < queues.size(); ++i) {
+      Queue &victim = *queues[(index + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.tasks.empty()) {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        --queued;
+        ++stolen;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void run(std::size_t index) {
+    for (;;) {
+      Task task;
+      if (pop(index, task)) {
+        task(index);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0)
+          idle.notify_all();
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this] { return stopping || queued > 0; });
+      if (stopping && queued == 0)
+        return;
+    }
+  }
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  std::vector<std::thread> workers;
+  std::atomic<std::size_t> next_queue{0};
+  std::atomic<std::size_t> stolen{0};
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable idle;
+  /// Submitted tasks which have not finished yet.
+  std::size_t pending = 0;
+  /// Tasks still sitting in a deque. Incremented under `mutex` so that a
+  /// worker going to sleep never misses a submission.
+  std::atomic<std::size_t> queued{0};
+  bool stopping = false;
+};
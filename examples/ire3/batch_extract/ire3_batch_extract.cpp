@@ -0,0 +1,236 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "iris_engine_v3.h"
+#include "buffer_pool.h"
+#include "gallery_file.h"
+#include "image_source.h"
+#include "input_list.h"
+#include "ire3_features.h"
+#include "latency_stats.h"
+#include "trace.h"
+#include "work_stealing_pool.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ms(Clock::time_point from, Clock::time_point to) {
+  return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+/**
+ * @brief Mapped image travelling from an I/O thread to an extraction worker.
+ */
+struct DecodedImage {
+  std::size_t index;
+  MappedImage image;
+  Clock::time_point decoded;
+};
+
+/**
+ * @brief Touches every page of the image so that the extraction worker does
+ * not stall on disk reads.
+ */
+static unsigned prefault(const ImageView &view) {
+  unsigned sum = 0;
+  std::size_t size = (std::size_t)view.stride * view.height;
+  for (std::size_t i = 0; i < size; i += 4096)
+    sum += view.pixels[i];
+  return sum;
+}
+
+/**
+ * @brief Buffers and statistics owned by one extraction worker.
+ */
+struct alignas(64) Worker {
+  Ire3Extractor extractor;
+  LatencyStats wait;
+  LatencyStats extract;
+  LatencyStats write;
+};
+
+/**
+ * @brief Extracts the features of every image and writes them into a single
+ * gallery file.
+ *
+ * I/O threads map the images, fault their pages in and hand them to a
+ * work-stealing pool of extraction workers, each of which owns one working
+ * set. At most a few images per worker are kept in flight to bound memory.
+ *
+ * @param inputs images to process.
+ * @param output gallery file name.
+ * @param num_workers number of extraction workers, 0 for all cores.
+ * @param num_io number of decoding threads.
+ * @return true if the gallery was written.
+ */
+bool batch_extract(const std::vector<InputImage> &inputs,
+                   const std::string &output, std::size_t num_workers,
+                   std::size_t num_io) {
+  ire3_settings settings = {sizeof(settings), 150, 4};
+
+  GalleryFileWriter writer;
+  if (!writer.open(output, 0)) {
+    std::cerr << "Can not create " << output << "\n";
+    return false;
+  }
+  std::mutex writer_mutex;
+  std::vector<std::size_t> written; // input index of every gallery record
+  std::atomic<std::size_t> failed{0};
+
+  WorkStealingPool pool(num_workers);
+  std::vector<Worker> workers(pool.size());
+
+  std::size_t max_in_flight = 4 * pool.size();
+  std::size_t in_flight = 0;
+  std::mutex flight_mutex;
+  std::condition_variable flight;
+
+  auto extract = [&](const std::shared_ptr<DecodedImage> &image,
+                     std::size_t index) {
+    Worker &worker = workers[index];
+    auto start = Clock::now();
+    worker.wait.add(elapsed_ms(image->decoded, start));
+    // Allocated once per worker, on the worker's own thread.
+    auto rc = worker.extractor ? IRE3_STATUS_OK
+                               : worker.extractor.init(settings);
+    if (rc == IRE3_STATUS_OK) {
+      TRACE_SCOPE("ire3_extract_features");
+      rc = worker.extractor.extract(image->image.view());
+    }
+    auto extracted = Clock::now();
+    worker.extract.add(elapsed_ms(start, extracted));
+    image->image = MappedImage();
+    {
+      std::lock_guard<std::mutex> lock(flight_mutex);
+      --in_flight;
+    }
+    flight.notify_one();
+
+    if (rc != IRE3_STATUS_OK) {
+      std::cerr << "Extraction fails for " << inputs[image->index].path
+                << ": " << std::hex << rc << std::dec << "\n";
+      ++failed;
+      return;
+    }
+    TRACE_SCOPE("write_features");
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    if (writer.add_ire3_features(worker.extractor.features(),
+                                 worker.extractor.features_size(),
+                                 inputs[image->index].id))
+      written.push_back(image->index);
+    else
+      ++failed;
+    worker.write.add(elapsed_ms(extracted, Clock::now()));
+  };
+
+  auto start = Clock::now();
+  std::atomic<std::size_t> next_input{0};
+  std::vector<LatencyStats> decode(num_io);
+  std::vector<std::thread> io_threads;
+  for (std::size_t t = 0; t < num_io; ++t) {
+    io_threads.emplace_back([&, t] {
+      Trace::instance().set_thread_name("io " + std::to_string(t));
+      for (std::size_t i = next_input++; i < inputs.size(); i = next_input++) {
+        {
+          std::unique_lock<std::mutex> lock(flight_mutex);
+          flight.wait(lock, [&] { return in_flight < max_in_flight; });
+          ++in_flight;
+        }
+        auto decode_start = Clock::now();
+        TRACE_SCOPE("decode");
+        auto image = std::make_shared<DecodedImage>();
+        image->index = i;
+        if (!image->image.open_pgm(inputs[i].path)) {
+          std::cerr << "Can not read " << inputs[i].path << ": "
+                    << image->image.error() << "\n";
+          ++failed;
+          {
+            std::lock_guard<std::mutex> lock(flight_mutex);
+            --in_flight;
+          }
+          flight.notify_one();
+          continue;
+        }
+        volatile unsigned touched = prefault(image->image.view());
+        (void)touched;
+        image->decoded = Clock::now();
+        decode[t].add(elapsed_ms(decode_start, image->decoded));
+        pool.submit([&extract, image](std::size_t worker) {
+          extract(image, worker);
+        });
+      }
+    });
+  }
+  for (auto &thread : io_threads)
+    thread.join();
+  pool.wait_idle();
+
+  bool ok = writer.finish();
+  double seconds = elapsed_ms(start, Clock::now()) / 1000;
+  if (!ok) {
+    std::cerr << "Can not write " << output << "\n";
+    return false;
+  }
+
+  // Gallery records are stored in completion order, the list maps them back
+  // to the input images.
+  std::ofstream list(output + ".list");
+  for (std::size_t r = 0; r < written.size(); ++r)
+    list << r << " " << inputs[written[r]].path << " " << inputs[written[r]].id
+         << "\n";
+
+  LatencyStats decode_total, wait, extract_total, write;
+  for (const auto &d : decode)
+    decode_total.merge(d);
+  for (const auto &w : workers) {
+    wait.merge(w.wait);
+    extract_total.merge(w.extract);
+    write.merge(w.write);
+  }
+  std::cout << "Images: " << written.size() << " written, " << failed
+            << " failed\n";
+  std::cout << "Workers: " << pool.size() << " extraction, " << num_io
+            << " I/O, " << pool.steals() << " steals\n";
+  std::cout << "Time: " << seconds << " s, "
+            << (seconds > 0 ? written.size() / seconds : 0) << " images/s\n";
+  std::cout << "Decode:  " << decode_total << "\n";
+  std::cout << "Queue:   " << wait << "\n";
+  std::cout << "Extract: " << extract_total << "\n";
+  std::cout << "Write:   " << write << "\n";
+  return true;
+}
+
+/**
+ * @brief Entry point of the example.
+ *
+ * Requires a directory with `.pgm` eye crops (or a manifest listing them)
+ * and the output gallery file name. Optionally takes the number of
+ * extraction and I/O threads.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 3 || argc > 5) {
+    std::cerr << "Usage: " << argv[0]
+              << " input_dir|manifest output_gallery [workers] [io_threads]\n";
+    return 1;
+  }
+  std::size_t num_workers = argc > 3 ? std::stoul(argv[3]) : 0;
+  std::size_t num_io = argc > 4 ? std::max(1ul, std::stoul(argv[4])) : 2;
+
+  auto inputs = list_inputs(argv[1]);
+  if (inputs.empty()) {
+    std::cerr << "No input images found.\n";
+    return 1;
+  }
+  std::cout << "ire_batch_extract of " << inputs.size() << " images started\n";
+  bool ok = batch_extract(inputs, argv[2], num_workers, num_io);
+  std::cout << "ire_batch_extract ended\n";
+  return ok ? 0 : 1;
+}
@@ -5,6 +5,9 @@
 
 #include "utils.h"
 #include "iris_engine_v3.h"
+#include "buffer_pool.h"
+#include "image_source.h"
+#include "trace.h"
 
 #define CHECK(expr, rc)                                                        \
   do {                                                                         \
@@ -13,8 +16,6 @@
     }                                                                          \
   } while (0)
 
-#define BUFFER_SIZE (1000 * 1000)
-
 /**
  * @brief Predefined image width for this example.
  *
@@ -49,39 +50,41 @@ void enroll_identify(uint8_t *image, int width, int height) {
       NULL; // Pointer to the deserialized (decrypted) feature structure
   ire3_eye_info eye_info; // The structure to hold the eye information
   ire3_settings settings = {sizeof(settings), 150, 4};
+  // Buffers come from the thread's pool and go back to it on return, so
+  // repeated calls reuse them instead of allocating.
+  BufferPool &pool = BufferPool::local();
 
   CHECK(ire3_get_max_features_size(&size) == IRE3_STATUS_OK, IRE3_STATUS_FAIL);
-  features = (uint8_t *)malloc(size);
+  PooledBuffer features_buffer = pool.acquire(size);
+  features = features_buffer.data();
 
   CHECK(ire3_get_extraction_working_set_size(&set_size, &settings) ==
             IRE3_STATUS_OK,
         IRE3_STATUS_FAIL);
-  working_set = (uint8_t *)malloc(set_size);
+  PooledBuffer working_set_buffer = pool.acquire(set_size);
+  working_set = working_set_buffer.data();
 
   CHECK(ire3_get_deserialized_features_size(&des_size) == IRE3_STATUS_OK,
         IRE3_STATUS_FAIL);
-  des_ftr = (uint8_t *)malloc(des_size);
+  PooledBuffer des_ftr_buffer = pool.acquire(des_size);
+  des_ftr = des_ftr_buffer.data();
 
-  CHECK(ire3_extract_features(image, width, height, features, size,
-                              &feature_size, &eye_info, sizeof(ire3_eye_info),
-                              (void *)working_set, set_size,
-                              &settings) == IRE3_STATUS_OK,
+  CHECK(TRACE_CALL(ire3_extract_features, image, width, height, features,
+                   size, &feature_size, &eye_info, sizeof(ire3_eye_info),
+                   (void *)working_set, set_size,
+                   &settings) == IRE3_STATUS_OK,
         IRE3_STATUS_FAIL);
 
-  CHECK(ire3_deserialize_features(features, feature_size, des_ftr, des_size) ==
-            IRE3_STATUS_OK,
+  CHECK(TRACE_CALL(ire3_deserialize_features, features, feature_size, des_ftr,
+                   des_size) == IRE3_STATUS_OK,
         IRE3_STATUS_FAIL);
 
   // Compare the extracted feature of the image to itself as a test
-  CHECK(ire3_compare(des_ftr, des_ftr, &settings, &score) == IRE3_STATUS_OK,
+  CHECK(TRACE_CALL(ire3_compare, des_ftr, des_ftr, &settings, &score) ==
+            IRE3_STATUS_OK,
         IRE3_STATUS_FAIL);
 
   printf("The score is: %d\n", score);
-
-  free(features);
-  free(working_set);
-  free(des_ftr);
-  free(image);
 }
 
 /**
@@ -96,13 +99,15 @@ int main(int argc, char *argv[]) {
     return 1;
   }
   std::string file(argv[1]);
-  std::vector<uint8_t> buffer(BUFFER_SIZE);
-  uint8_t *pixels = buffer.data();
-  unsigned int width = WIDTH;   // Width of frame or image in pixels
-  unsigned int height = HEIGHT; // Height of frame or image in pixels
-  unsigned int depth = 0;
-  read_pgm(file.c_str(), &pixels, &width, &height, &depth);
+  // The pixels are used in place from the mapped file.
+  MappedImage image;
+  if (!image.open_pgm(file)) {
+    std::cerr << "Can not read input file: " << image.error() << "\n";
+    return 1;
+  }
   std::cout << "ire_enroll -> ire_identify started\n";
-  enroll_identify(pixels, width, height);
+  enroll_identify(image.view().pixels, image.view().width,
+                  image.view().height);
   std::cout << "ire_enroll -> ire_identify ended\n";
+  std::cout << BufferPool::local().stats() << "\n";
 }
\ No newline at end of file
@@ -2,10 +2,10 @@
 #include <string>
 #include <iostream>
 
-#include "utils.h"
 #include "iris_engine_v3.h"
-
-#define BUFFER_SIZE (1000 * 1000)
+#include "async_writer.h"
+#include "buffer_pool.h"
+#include "image_source.h"
 
 /**
  * @brief Predefined image width for this example.
@@ -25,9 +25,10 @@
  * @param width image width,
  * @param height image height,
  * @param name_prefix prefix to save the output files.
+ * @param writer saves the output files on its own thread.
  */
 void ire_kind7(uint8_t *pixels, int width, int height,
-               const std::string &name_prefix) {
+               const std::string &name_prefix, AsyncWriter &writer) {
   size_t max_features_size, working_set_size;
   ire3_settings settings = {sizeof(ire3_settings), 200, 6};
   auto rc = ire3_get_max_features_size(&max_features_size);
@@ -40,14 +41,15 @@ void ire_kind7(uint8_t *pixels, int width, int height,
 #define A_WIDTH 320
 #define A_HEIGHT 240
 
-  uint8_t kind7[A_WIDTH * A_HEIGHT];
-  uint8_t kind3[A_WIDTH * A_HEIGHT];
+  // The images are handed over to the writer once extracted.
+  PooledBuffer kind7 = BufferPool::local().acquire(A_WIDTH * A_HEIGHT);
+  PooledBuffer kind3 = BufferPool::local().acquire(A_WIDTH * A_HEIGHT);
   ire3_eye_info eye_info = {0};
   ire3_out_images images;
   images.out_image_width = A_WIDTH;
   images.out_image_height = A_HEIGHT;
-  images.kind7_pixels = kind7;
-  images.kind3_pixels = kind3;
+  images.kind7_pixels = kind7.data();
+  images.kind3_pixels = kind3.data();
 
   ire3_extract_features_with_images(pixels, width, height, features, max_features_size,
                         NULL, &eye_info, sizeof(eye_info), working_set,
@@ -56,34 +58,41 @@ void ire_kind7(uint8_t *pixels, int width, int height,
   std::cerr << "Occlusion = " << eye_info.percent_occlusion << "%\n";
   auto name = name_prefix;
   name.replace(name.find(".pgm"), 4, "_ire3_kind3.pgm");
-  write_pgm(name.c_str(), images.kind3_pixels, images.out_image_width,
-            images.out_image_height);
+  writer.write_pgm(name, std::move(kind3), images.out_image_width,
+                   images.out_image_height);
   name = name_prefix;
   name.replace(name.find(".pgm"), 4, "_ire3_kind7.pgm");
-  write_pgm(name.c_str(), images.kind7_pixels, images.out_image_width,
-            images.out_image_height);
+  writer.write_pgm(name, std::move(kind7), images.out_image_width,
+                   images.out_image_height);
 }
 
 /**
  * @brief Entry point of the example. Saves output files alongside the input
- * file.
+ * file, or appends them to a container file given as second argument.
  *
  * Requires the `.pgm` binary file with image of size @ref WIDTH x @ref HEIGHT
  * as an input.
  */
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
-    std::cerr << "Exactly one argument is needed: filename\n";
+  if (argc != 2 && argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " filename [container]\n";
     return 1;
   }
   std::string file(argv[1]);
-  std::vector<uint8_t> buffer(BUFFER_SIZE);
-  uint8_t *pixels = buffer.data();
-  unsigned int width = WIDTH;   // Width of frame or image in pixels
-  unsigned int height = HEIGHT; // Height of frame or image in pixels
-  unsigned int depth = 0;
-  read_pgm(file.c_str(), &pixels, &width, &height, &depth);
+  // The pixels are used in place from the mapped file.
+  MappedImage image;
+  if (!image.open_pgm(file)) {
+    std::cerr << "Can not read input file: " << image.error() << "\n";
+    return 1;
+  }
   std::cout << "ire_enroll_get_kind3/7 started\n";
-  ire_kind7(pixels, width, height, file);
+  AsyncWriterOptions writer_options;
+  if (argc == 3)
+    writer_options.container = argv[2];
+  AsyncWriter writer(writer_options);
+  ire_kind7(image.view().pixels, image.view().width, image.view().height,
+            file, writer);
   std::cout << "ire_enroll_get_kind3/7 ended\n";
+  writer.close();
+  std::cout << writer.stats() << "\n";
 }
@@ -0,0 +1,172 @@
+#include <iostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#include "utils.h"
+#include "iris_engine_v3.h"
+#include "gallery_loader.h"
+#include "image_source.h"
+#include "ire3_gallery_matcher.h"
+#include "thread_pool.h"
+
+#define CHECK(expr, rc)                                                        \
+  do {                                                                         \
+    if (!(expr)) {                                                             \
+      printf("Error: 0x%08x\n", rc);                                           \
+      return false;                                                            \
+    }                                                                          \
+  } while (0)
+
+/**
+ * @brief Predefined image width for this example.
+ *
+ */
+#define WIDTH (640)
+/**
+ * @brief Predefined image height for this example.
+ *
+ */
+#define HEIGHT (480)
+
+/**
+ * @brief Extracts and deserializes the features of a single eye crop.
+ *
+ * @param image pointer to image pixels,
+ * @param width image width,
+ * @param height image height,
+ * @param settings extraction settings,
+ * @param des_ftr output for the deserialized features.
+ * @return true on success.
+ */
+bool extract_probe(uint8_t *image, int width, int height,
+                   ire3_settings &settings, std::vector<uint8_t> &des_ftr) {
+  size_t size = 0, set_size = 0, feature_size = 0, des_size = 0;
+  ire3_eye_info eye_info;
+
+  CHECK(ire3_get_max_features_size(&size) == IRE3_STATUS_OK, IRE3_STATUS_FAIL);
+  CHECK(ire3_get_extraction_working_set_size(&set_size, &settings) ==
+            IRE3_STATUS_OK,
+        IRE3_STATUS_FAIL);
+  CHECK(ire3_get_deserialized_features_size(&des_size) == IRE3_STATUS_OK,
+        IRE3_STATUS_FAIL);
+  std::vector<uint8_t> features(size);
+  std::vector<uint8_t> working_set(set_size);
+  des_ftr.resize(des_size);
+
+  CHECK(ire3_extract_features(image, width, height, features.data(), size,
+                              &feature_size, &eye_info, sizeof(ire3_eye_info),
+                              working_set.data(), set_size,
+                              &settings) == IRE3_STATUS_OK,
+        IRE3_STATUS_FAIL);
+  CHECK(ire3_deserialize_features(features.data(), feature_size,
+                                  des_ftr.data(), des_size) == IRE3_STATUS_OK,
+        IRE3_STATUS_FAIL);
+  return true;
+}
+
+/**
+ * @brief Builds a synthetic gallery by replicating the probe features, which
+ * is enough to measure the matching throughput of the host.
+ *
+ * @param probe deserialized probe features,
+ * @param gallery_size number of gallery records,
+ * @param records output for the gallery records.
+ */
+void replicate_gallery(const std::vector<uint8_t> &probe,
+                       std::size_t gallery_size,
+                       std::vector<uint8_t> &records) {
+  records.resize(gallery_size * probe.size());
+  for (std::size_t i = 0; i < gallery_size; ++i)
+    memcpy(&records[i * probe.size()], probe.data(), probe.size());
+}
+
+/**
+ * @brief Demonstrates 1:N search of a probe against a gallery.
+ *
+ * @param probe deserialized probe features,
+ * @param gallery gallery records,
+ * @param settings comparison settings,
+ * @param pool matching threads,
+ * @param options search options.
+ */
+void gallery_match(const std::vector<uint8_t> &probe,
+                   const FeatureGalleryView &gallery,
+                   const ire3_settings &settings, ThreadPool &pool,
+                   const SearchOptions &options) {
+  GalleryMatcher matcher(pool, settings);
+  SearchStats stats;
+  auto results = matcher.search(probe.data(), gallery, options, &stats);
+
+  for (const auto &r : results)
+    std::cout << "Record " << r.index << ": score " << r.score << "\n";
+  std::cout << "Threads: " << pool.size() << "\n";
+  std::cout << "Comparisons: " << stats.comparisons
+            << (stats.stopped_early ? " (stopped early)" : "") << "\n";
+  std::cout << "Failed comparisons: " << stats.failures << "\n";
+  std::cout << "Search time: " << stats.seconds * 1000 << " ms\n";
+  std::cout << "Matches per second: " << (uint64_t)stats.matches_per_second()
+            << "\n";
+}
+
+/**
+ * @brief Entry point of the example.
+ *
+ * Requires the `.pgm` binary file with image of size @ref WIDTH x @ref HEIGHT
+ * and either a gallery file or the size of a synthetic gallery as an input.
+ * Optionally takes the number of threads, the number of results, the score
+ * which stops the search and a snapshot file of the deserialized gallery,
+ * which makes the next runs map the gallery instead of deserializing it.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 3 || argc > 7) {
+    std::cerr << "Usage: " << argv[0]
+              << " filename gallery_file|gallery_size [threads] [top_k] "
+                 "[stop_score] [snapshot]\n";
+    return 1;
+  }
+  std::string file(argv[1]);
+  std::string gallery(argv[2]);
+  std::size_t num_threads = argc > 3 ? std::stoul(argv[3]) : 0;
+  SearchOptions options;
+  if (argc > 4)
+    options.top_k = std::stoul(argv[4]);
+  if (argc > 5)
+    options.stop_score = std::stoi(argv[5]);
+  GalleryLoadOptions load_options;
+  if (argc > 6)
+    load_options.snapshot = argv[6];
+
+  MappedImage image;
+  if (!image.open_pgm(file)) {
+    std::cerr << "Can not read input file: " << image.error() << "\n";
+    return 1;
+  }
+  std::cout << "ire_gallery_match started\n";
+  ire3_settings settings = {sizeof(settings), 150, 4};
+  std::vector<uint8_t> probe, records;
+  if (!extract_probe(image.view().pixels, image.view().width,
+                     image.view().height, settings, probe))
+    return 1;
+  ThreadPool pool(num_threads);
+  LoadedGallery loaded;
+  FeatureGalleryView view;
+  if (gallery.find_first_not_of("0123456789") == std::string::npos) {
+    replicate_gallery(probe, std::stoul(gallery), records);
+    // Deserialized features are fixed size, so the gallery is one
+    // contiguous block which the workers scan sequentially.
+    view = {records.data(), probe.size(), records.size() / probe.size()};
+  } else {
+    GalleryLoadStats load_stats;
+    if (!loaded.load(gallery, pool, load_options, &load_stats)) {
+      std::cerr << "Can not load gallery: " << loaded.error() << "\n";
+      return 1;
+    }
+    std::cout << "Gallery of " << loaded.size() << " records " << load_stats
+              << "\n";
+    view = loaded.view();
+  }
+  gallery_match(probe, view, settings, pool, options);
+  std::cout << "ire_gallery_match ended\n";
+}
@@ -0,0 +1,164 @@
+/// @file ire3_match_client.cpp
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "iris_engine_v3.h"
+#include "buffer_pool.h"
+#include "image_source.h"
+#include "latency_stats.h"
+#include "match_protocol.h"
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Extracts the serialized probe features of an eye crop.
+ *
+ * @return true on success.
+ */
+bool extract_features(const ImageView &image, std::vector<uint8_t> &features) {
+  ire3_settings settings = {sizeof(settings), 150, 4};
+  size_t size = 0, set_size = 0, feature_size = 0;
+  ire3_eye_info eye_info;
+  if (ire3_get_max_features_size(&size) != IRE3_STATUS_OK ||
+      ire3_get_extraction_working_set_size(&set_size, &settings) !=
+          IRE3_STATUS_OK)
+    return false;
+  PooledBuffer working_set = BufferPool::local().acquire(set_size);
+  features.resize(size);
+  auto rc = ire3_extract_features(image.pixels, image.width, image.height,
+                                  features.data(), size, &feature_size,
+                                  &eye_info, sizeof(eye_info),
+                                  working_set.data(), set_size, &settings);
+  if (rc != IRE3_STATUS_OK) {
+    std::cerr << "Probe extraction fails: " << std::hex << rc << std::dec
+              << "\n";
+    return false;
+  }
+  features.resize(feature_size);
+  return true;
+}
+
+/**
+ * @brief Connects to the daemon.
+ *
+ * @return the socket or -1.
+ */
+int connect_to(const std::string &path) {
+  sockaddr_un address;
+  int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (!make_address(path, address) ||
+      ::connect(fd, (sockaddr *)&address, sizeof(address)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/**
+ * @brief Sends one request and reads its response.
+ *
+ * @return false on a connection error.
+ */
+bool request(int fd, const std::vector<uint8_t> &features, uint32_t top_k,
+             MatchResponse &response, std::vector<MatchEntry> &entries) {
+  MatchRequest header = {MATCH_REQUEST_MAGIC, top_k,
+                         (uint32_t)features.size()};
+  if (!write_all(fd, &header, sizeof(header)) ||
+      !write_all(fd, features.data(), features.size()) ||
+      !read_all(fd, &response, sizeof(response)) ||
+      response.magic != MATCH_RESPONSE_MAGIC ||
+      response.count > MATCH_MAX_TOP_K)
+    return false;
+  entries.resize(response.count);
+  return read_all(fd, entries.data(), entries.size() * sizeof(MatchEntry));
+}
+
+/**
+ * @brief Entry point of the load generator.
+ *
+ * Requires the daemon socket and a probe `.pgm` eye crop. Optionally takes
+ * the number of concurrent connections, the number of requests per
+ * connection and the number of matches to ask for. Every connection sends
+ * its next request as soon as the previous one is answered.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 3 || argc > 6) {
+    std::cerr << "Usage: " << argv[0]
+              << " socket probe [connections] [requests] [top_k]\n";
+    return 1;
+  }
+  std::string socket_path = argv[1];
+  std::size_t connections = argc > 3 ? std::stoul(argv[3]) : 8;
+  std::size_t requests = argc > 4 ? std::stoul(argv[4]) : 100;
+  uint32_t top_k = argc > 5 ? (uint32_t)std::stoul(argv[5]) : 5;
+  std::signal(SIGPIPE, SIG_IGN);
+
+  MappedImage image;
+  if (!image.open_pgm(argv[2])) {
+    std::cerr << "Can not read input file: " << image.error() << "\n";
+    return 1;
+  }
+  std::vector<uint8_t> features;
+  if (!extract_features(image.view(), features))
+    return 1;
+
+  // Shows the answer to a single request before loading the daemon.
+  int fd = connect_to(socket_path);
+  MatchResponse response;
+  std::vector<MatchEntry> entries;
+  if (fd < 0 || !request(fd, features, top_k, response, entries)) {
+    std::cerr << "Can not query the daemon at " << socket_path << "\n";
+    return 1;
+  }
+  ::close(fd);
+  std::cout << "Status " << std::hex << response.status << std::dec << ", "
+            << entries.size() << " matches:";
+  for (const auto &entry : entries)
+    std::cout << " id " << entry.id << " (" << entry.score << ")";
+  std::cout << "\n";
+
+  std::vector<LatencyStats> latencies(connections);
+  std::atomic<std::size_t> failures{0};
+  std::vector<std::thread> threads;
+  auto start = Clock::now();
+  for (std::size_t c = 0; c < connections; ++c)
+    threads.emplace_back([&, c] {
+      int fd = connect_to(socket_path);
+      MatchResponse response;
+      std::vector<MatchEntry> entries;
+      for (std::size_t r = 0; r < requests; ++r) {
+        auto sent = Clock::now();
+        if (fd < 0 || !request(fd, features, top_k, response, entries)) {
+          failures += requests - r;
+          break;
+        }
+        latencies[c].add(
+            std::chrono::duration<double, std::milli>(Clock::now() - sent)
+                .count());
+      }
+      if (fd >= 0)
+        ::close(fd);
+    });
+  for (auto &thread : threads)
+    thread.join();
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  LatencyStats latency;
+  for (const auto &l : latencies)
+    latency.merge(l);
+  std::cout << "Requests: " << latency.count() << " answered, " << failures
+            << " failed over " << connections << " connections\n";
+  std::cout << "Throughput: "
+            << (seconds > 0 ? latency.count() / seconds : 0)
+            << " requests/s\n";
+  std::cout << "Latency: " << latency << "\n";
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,345 @@
+/// @file ire3_match_daemon.cpp
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+
+#include "iris_engine_v3.h"
+#include "gallery_loader.h"
+#include "ire3_gallery_matcher.h"
+#include "match_protocol.h"
+#include "thread_pool.h"
+
+static std::atomic<bool> stopping{false};
+
+static void on_signal(int) { stopping = true; }
+
+/**
+ * @brief Coalesces the probes of concurrent requests into batches which
+ * are matched in one scan of the gallery.
+ *
+ * Requests arriving while a batch is being matched form the next batch, so
+ * batches grow with the load without delaying a lone request. `max_wait`
+ * optionally holds a batch back to collect more probes.
+ */
+class Batcher {
+public:
+  Batcher(GalleryMatcher &matcher, const FeatureGalleryView &gallery,
+          std::size_t max_batch, std::chrono::microseconds max_wait)
+      : matcher(matcher), gallery(gallery),
+        max_batch(std::max<std::size_t>(1, max_batch)), max_wait(max_wait),
+        thread([this] { run(); }) {}
+
+  ~Batcher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopped = true;
+    }
+    queued.notify_all();
+    thread.join();
+  }
+
+  /**
+   * @brief Matches one probe; blocks until its batch is done.
+   */
+  std::vector<MatchResult> match(const uint8_t *probe, std::size_t top_k) {
+    Pending pending = {probe, top_k};
+    std::unique_lock<std::mutex> lock(mutex);
+    queue.push_back(&pending);
+    queued.notify_one();
+    finished.wait(lock, [&] { return pending.done; });
+    return std::move(pending.result);
+  }
+
+  void print_stats(std::ostream &out) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    out << "Requests: " << requests << " in " << batches << " batches, mean "
+        << (batches ? (double)requests / batches : 0) << ", max "
+        << largest_batch << " probes per batch\n";
+    out << "Matching: " << busy_seconds << " s busy, "
+        << (busy_seconds > 0 ? comparisons / busy_seconds : 0)
+        << " comparisons/s\n";
+  }
+
+private:
+  struct Pending {
+    const uint8_t *probe;
+    std::size_t top_k;
+    std::vector<MatchResult> result;
+    bool done = false;
+  };
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      queued.wait(lock, [&] { return stopped || !queue.empty(); });
+      if (queue.empty())
+        return;
+      if (max_wait.count() > 0)
+        queued.wait_for(lock, max_wait,
+                        [&] { return stopped || queue.size() >= max_batch; });
+      std::vector<Pending *> batch;
+      while (!queue.empty() && batch.size() < max_batch) {
+        batch.push_back(queue.front());
+        queue.pop_front();
+      }
+      lock.unlock();
+
+      std::vector<const uint8_t *> probes;
+      SearchOptions options;
+      options.top_k = 0;
+      for (Pending *pending : batch) {
+        probes.push_back(pending->probe);
+        options.top_k = std::max(options.top_k, pending->top_k);
+      }
+      SearchStats stats;
+      auto results = matcher.search_batch(probes, gallery, options, &stats);
+
+      lock.lock();
+      for (std::size_t i = 0; i < batch.size(); ++i) {
+        results[i].resize(std::min(results[i].size(), batch[i]->top_k));
+        batch[i]->result = std::move(results[i]);
+        batch[i]->done = true;
+      }
+      requests += batch.size();
+      ++batches;
+      largest_batch = std::max(largest_batch, batch.size());
+      comparisons += stats.comparisons;
+      busy_seconds += stats.seconds;
+      finished.notify_all();
+    }
+  }
+
+  GalleryMatcher &matcher;
+  FeatureGalleryView gallery;
+  std::size_t max_batch;
+  std::chrono::microseconds max_wait;
+
+  mutable std::mutex mutex;
+  std::condition_variable queued, finished;
+  std::deque<Pending *> queue;
+  bool stopped = false;
+  std::size_t requests = 0, batches = 0, largest_batch = 0;
+  std::size_t comparisons = 0;
+  double busy_seconds = 0;
+  std::thread thread;
+};
+
+/**
+ * @brief Answers the requests of one client connection until it closes; the
+ * caller closes `fd`.
+ */
+void serve(int fd, Batcher &batcher, const LoadedGallery &gallery,
+           std::size_t des_size) {
+  std::vector<uint8_t> features, probe(des_size);
+  std::vector<MatchEntry> entries;
+  MatchRequest request;
+  while (read_all(fd, &request, sizeof(request))) {
+    if (request.magic != MATCH_REQUEST_MAGIC ||
+        request.features_size > MATCH_MAX_FEATURES_SIZE)
+      break;
+    features.resize(request.features_size);
+    if (!read_all(fd, features.data(), features.size()))
+      break;
+    MatchResponse response = {MATCH_RESPONSE_MAGIC, IRE3_STATUS_OK, 0};
+    entries.clear();
+    response.status = ire3_deserialize_features(
+        features.data(), features.size(), probe.data(), des_size);
+    if (response.status == IRE3_STATUS_OK) {
+      auto top_k = std::min<std::size_t>(request.top_k, MATCH_MAX_TOP_K);
+      for (const auto &match : batcher.match(probe.data(), top_k))
+        entries.push_back(
+            {gallery.id(match.index), match.score, (uint32_t)match.index});
+      response.count = (uint32_t)entries.size();
+    }
+    if (!write_all(fd, &response, sizeof(response)) ||
+        !write_all(fd, entries.data(), entries.size() * sizeof(MatchEntry)))
+      break;
+  }
+}
+
+/**
+ * @brief Connection threads of the daemon.
+ *
+ * A connection closes its socket and marks itself finished when its client
+ * goes away; the accept loop joins finished connections, so neither threads
+ * nor descriptors pile up in a long running daemon.
+ */
+class Connections {
+public:
+  ~Connections() {
+    close_all();
+    for (auto &client : clients)
+      client.thread.join();
+  }
+
+  void start(int fd, Batcher &batcher, const LoadedGallery &gallery,
+             std::size_t des_size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    clients.emplace_back();
+    Client &client = clients.back();
+    client.fd = fd;
+    client.thread = std::thread([this, &client, &batcher, &gallery, fd,
+                                 des_size] {
+      serve(fd, batcher, gallery, des_size);
+      std::lock_guard<std::mutex> lock(mutex);
+      // Closed under the lock: once `fd` is -1 the number may belong to
+      // another descriptor and is never touched again.
+      ::close(fd);
+      client.fd = -1;
+    });
+  }
+
+  /**
+   * @brief Joins the threads of the connections that closed.
+   */
+  void reap() {
+    std::list<Client> finished;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto it = clients.begin(); it != clients.end();) {
+        auto next = std::next(it);
+        if (it->fd < 0)
+          finished.splice(finished.end(), clients, it);
+        it = next;
+      }
+    }
+    for (auto &client : finished)
+      client.thread.join();
+  }
+
+  /**
+   * @brief Wakes up the connection threads blocked in read.
+   */
+  void close_all() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &client : clients)
+      if (client.fd >= 0)
+        ::shutdown(client.fd, SHUT_RDWR);
+  }
+
+private:
+  struct Client {
+    int fd = -1;
+    std::thread thread;
+  };
+
+  std::mutex mutex;
+  std::list<Client> clients;
+};
+
+/**
+ * @brief Accepts clients until SIGINT or SIGTERM, one thread per
+ * connection.
+ *
+ * @return false if the socket can not be set up.
+ */
+bool listen_and_serve(const std::string &path, Batcher &batcher,
+                      const LoadedGallery &gallery, std::size_t des_size) {
+  sockaddr_un address;
+  int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0 || !make_address(path, address)) {
+    std::cerr << "Can not create socket " << path << "\n";
+    if (listener >= 0)
+      ::close(listener);
+    return false;
+  }
+  ::unlink(path.c_str());
+  if (::bind(listener, (sockaddr *)&address, sizeof(address)) != 0 ||
+      ::listen(listener, 128) != 0) {
+    std::cerr << "Can not listen on " << path << ": " << strerror(errno)
+              << "\n";
+    ::close(listener);
+    return false;
+  }
+  std::cout << "Listening on " << path << "\n";
+
+  Connections connections;
+  while (!stopping) {
+    connections.reap();
+    pollfd waiting = {listener, POLLIN, 0};
+    if (::poll(&waiting, 1, 200) <= 0)
+      continue;
+    int fd = ::accept(listener, nullptr, nullptr);
+    if (fd >= 0)
+      connections.start(fd, batcher, gallery, des_size);
+  }
+  ::close(listener);
+  ::unlink(path.c_str());
+  return true;
+}
+
+/**
+ * @brief Entry point of the matching daemon.
+ *
+ * Requires a gallery file with ire3 features, e.g. written by
+ * ire3_batch_extract. Optionally takes the socket path, the number of
+ * matching threads, the largest batch, the time in microseconds a batch
+ * may wait for more probes and a snapshot file of the deserialized gallery.
+ * Runs until SIGINT or SIGTERM.
+ *
+ * The gallery is deserialized by all matching threads. With a snapshot the
+ * deserialized records are saved on the first start and mapped on the
+ * following ones, as long as the gallery and the ire3 library are
+ * unchanged.
+ */
+int main(int argc, char *argv[]) {
+  auto start = std::chrono::steady_clock::now();
+  if (argc < 2 || argc > 7) {
+    std::cerr << "Usage: " << argv[0]
+              << " gallery_file [socket] [threads] [max_batch] "
+                 "[max_wait_us] [snapshot]\n";
+    return 1;
+  }
+  std::string socket_path = argc > 2 ? argv[2] : MATCH_SOCKET_PATH;
+  std::size_t num_threads = argc > 3 ? std::stoul(argv[3]) : 0;
+  std::size_t max_batch = argc > 4 ? std::stoul(argv[4]) : 64;
+  std::chrono::microseconds max_wait(argc > 5 ? std::stol(argv[5]) : 0);
+  GalleryLoadOptions load_options;
+  if (argc > 6)
+    load_options.snapshot = argv[6];
+
+  std::signal(SIGINT, on_signal);
+  std::signal(SIGTERM, on_signal);
+  std::signal(SIGPIPE, SIG_IGN);
+
+  size_t des_size = 0;
+  if (ire3_get_deserialized_features_size(&des_size) != IRE3_STATUS_OK) {
+    std::cerr << "Can not query the deserialized features size.\n";
+    return 1;
+  }
+  ThreadPool pool(num_threads);
+  LoadedGallery gallery;
+  GalleryLoadStats load_stats;
+  if (!gallery.load(argv[1], pool, load_options, &load_stats)) {
+    std::cerr << "Can not load gallery: " << gallery.error() << "\n";
+    return 1;
+  }
+  std::cout << "Gallery of " << gallery.size() << " records " << load_stats
+            << "\n";
+  std::cout << "Ready after "
+            << std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start)
+                   .count()
+            << " s\n";
+
+  ire3_settings settings = {sizeof(settings), 150, 4};
+  GalleryMatcher matcher(pool, settings);
+  bool ok;
+  {
+    Batcher batcher(matcher, gallery.view(), max_batch, max_wait);
+    ok = listen_and_serve(socket_path, batcher, gallery, des_size);
+    batcher.print_stats(std::cout);
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+/// @file match_protocol.h
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * @brief Default socket path of the matching daemon.
+ */
+#define MATCH_SOCKET_PATH "/tmp/ire3_match.sock"
+
+#define MATCH_REQUEST_MAGIC (0x514D5249u)  // "IRMQ"
+#define MATCH_RESPONSE_MAGIC (0x524D5249u) // "IRMR"
+
+/**
+ * @brief Largest serialized feature set a request may carry.
+ */
+#define MATCH_MAX_FEATURES_SIZE (1 << 20)
+
+/**
+ * @brief Largest number of matches a request may ask for.
+ */
+#define MATCH_MAX_TOP_K (100)
+
+// Both ends run on the same host, fields are in native byte order.
+
+/**
+ * @brief Request header, followed by `features_size` bytes of serialized
+ * ire3 probe features.
+ */
+struct MatchRequest {
+  uint32_t magic;
+  uint32_t top_k;
+  uint32_t features_size;
+};
+
+/**
+ * @brief Response header, followed by `count` @ref MatchEntry records, best
+ * first.
+ */
+struct MatchResponse {
+  uint32_t magic;
+  /// IRE3_STATUS_OK or the failing status.
+  int32_t status;
+  uint32_t count;
+};
+
+struct MatchEntry {
+  /// Id stored with the features in the gallery file.
+  uint32_t id;
+  int32_t score;
+  /// Record number in the gallery file.
+  uint32_t index;
+};
+
+/**
+ * @brief Reads exactly `size` bytes.
+ *
+ * @return false on error or end of stream.
+ */
+inline bool read_all(int fd, void *data, std::size_t size) {
+  auto *p = static_cast<uint8_t *>(data);
+  while (size > 0) {
+    ssize_t n = ::read(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= (std::size_t)n;
+  }
+  return true;
+}
+
+/**
+ * @brief Writes exactly `size` bytes.
+ */
+inline bool write_all(int fd, const void *data, std::size_t size) {
+  auto *p = static_cast<const uint8_t *>(data);
+  while (size > 0) {
+    ssize_t n = ::write(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= (std::size_t)n;
+  }
+  return true;
+}
+
+/**
+ * @brief Fills a Unix socket address.
+ *
+ * @return false if the path does not fit.
+ */
+inline bool make_address(const std::string &path, sockaddr_un &address) {
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path))
+    return false;
+  std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+  return true;
+}
@@ -0,0 +1,238 @@
+/// @file ire3_quality_gate.cpp
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "iris_engine_v3.h"
+#include "buffer_pool.h"
+#include "frame_quality.h"
+#include "image_source.h"
+#include "input_list.h"
+#include "latency_stats.h"
+
+/**
+ * @brief Engine sharpness below which a frame is considered useless, unless
+ * given on the command line.
+ */
+#define DEFAULT_MIN_SHARPNESS (50)
+
+/**
+ * @brief Share of useful frames the gate may reject, in percent, unless given
+ * on the command line.
+ */
+#define DEFAULT_FALSE_REJECT_PERCENT (1.0)
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ms(Clock::time_point from, Clock::time_point to) {
+  return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+/**
+ * @brief Gate measures and engine outcome for one image.
+ */
+struct Sample {
+  FrameQuality quality;
+  double measure_ms = 0;
+  double extract_ms = 0;
+  bool extracted = false;
+  int sharpness = 0;
+  /// The engine extracted features of acceptable sharpness.
+  bool useful = false;
+};
+
+/**
+ * @brief Measures every image with the gate and runs the engine on it.
+ *
+ * @return false if the engine buffers can not be set up.
+ */
+bool collect(const std::vector<InputImage> &inputs, int min_sharpness,
+             std::vector<Sample> &samples) {
+  ire3_settings settings = {sizeof(settings), 150, 4};
+  size_t max_features_size = 0, working_set_size = 0;
+  if (ire3_get_max_features_size(&max_features_size) != IRE3_STATUS_OK ||
+      ire3_get_extraction_working_set_size(&working_set_size, &settings) !=
+          IRE3_STATUS_OK) {
+    std::cerr << "Can not query ire3 buffer sizes.\n";
+    return false;
+  }
+  PooledBuffer features = BufferPool::local().acquire(max_features_size);
+  PooledBuffer working_set = BufferPool::local().acquire(working_set_size);
+
+  for (const auto &input : inputs) {
+    MappedImage image;
+    if (!image.open_pgm(input.path)) {
+      std::cerr << "Can not read " << input.path << ": " << image.error()
+                << "\n";
+      continue;
+    }
+    const ImageView &view = image.view();
+    Sample sample;
+    auto start = Clock::now();
+    sample.quality = measure_quality(view);
+    auto measured = Clock::now();
+    size_t feature_size = 0;
+    ire3_eye_info eye_info = {0};
+    auto rc = ire3_extract_features(
+        view.pixels, view.width, view.height, features.data(),
+        max_features_size, &feature_size, &eye_info, sizeof(eye_info),
+        working_set.data(), working_set_size, &settings);
+    sample.measure_ms = elapsed_ms(start, measured);
+    sample.extract_ms = elapsed_ms(measured, Clock::now());
+    sample.extracted = rc == IRE3_STATUS_OK;
+    sample.sharpness = eye_info.sharpness;
+    sample.useful = sample.extracted && eye_info.sharpness >= min_sharpness;
+    samples.push_back(sample);
+  }
+  return true;
+}
+
+/**
+ * @brief Value below which the given share of the values lies.
+ */
+static double quantile(std::vector<double> values, double share) {
+  if (values.empty())
+    return 0;
+  std::sort(values.begin(), values.end());
+  auto rank = (std::size_t)(share * values.size());
+  return values[std::min(rank, values.size() - 1)];
+}
+
+/**
+ * @brief Picks the focus and motion limits so that each rejects at most
+ * `false_reject` of the useful frames.
+ *
+ * Exposure limits are kept at their defaults: they only catch frames no
+ * engine could use.
+ */
+QualityThresholds calibrate(const std::vector<const Sample *> &samples,
+                            double false_reject) {
+  QualityThresholds thresholds;
+  std::vector<double> focus, anisotropy;
+  for (const Sample *sample : samples)
+    if (sample->useful) {
+      focus.push_back(sample->quality.focus);
+      anisotropy.push_back(sample->quality.anisotropy);
+    }
+  if (focus.empty())
+    return thresholds;
+  thresholds.min_focus = quantile(focus, false_reject);
+  thresholds.max_anisotropy = quantile(anisotropy, 1 - false_reject);
+  return thresholds;
+}
+
+/**
+ * @brief Pearson correlation of log focus and engine sharpness over the
+ * extracted frames; tells how well the gate tracks the engine.
+ */
+double correlation(const std::vector<const Sample *> &samples) {
+  double n = 0, sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+  for (const Sample *sample : samples) {
+    if (!sample->extracted)
+      continue;
+    double x = std::log1p(sample->quality.focus), y = sample->sharpness;
+    n += 1;
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    syy += y * y;
+    sxy += x * y;
+  }
+  double vx = n * sxx - sx * sx, vy = n * syy - sy * sy;
+  return vx > 0 && vy > 0 ? (n * sxy - sx * sy) / std::sqrt(vx * vy) : 0;
+}
+
+/**
+ * @brief Runs the gate over the samples and reports the engine calls it
+ * saves and the useful frames it loses.
+ */
+void evaluate(const std::vector<const Sample *> &samples,
+              const QualityThresholds &thresholds) {
+  std::size_t verdicts[5] = {0};
+  std::size_t saved = 0, lost = 0, missed = 0, useless = 0;
+  double gate_ms = 0, saved_ms = 0;
+  LatencyStats measure, extract;
+  for (const Sample *sample : samples) {
+    auto verdict = judge_quality(sample->quality, thresholds);
+    ++verdicts[(int)verdict];
+    measure.add(sample->measure_ms);
+    extract.add(sample->extract_ms);
+    gate_ms += sample->measure_ms;
+    useless += !sample->useful;
+    if (verdict == QualityVerdict::Pass) {
+      missed += !sample->useful;
+      continue;
+    }
+    saved_ms += sample->extract_ms;
+    if (sample->useful)
+      ++lost;
+    else
+      ++saved;
+  }
+
+  std::cout << "Frames: " << samples.size() << ", useless for the engine: "
+            << useless << "\n";
+  std::cout << "Gate verdicts:";
+  for (int v = 0; v < 5; ++v)
+    std::cout << " " << to_string((QualityVerdict)v) << "=" << verdicts[v];
+  std::cout << "\n";
+  std::cout << "Engine calls saved: " << saved + lost << " ("
+            << saved << " useless, " << lost << " useful frames lost), "
+            << missed << " useless frames still sent to the engine\n";
+  std::cout << "Gate:    " << measure << "\n";
+  std::cout << "Extract: " << extract << "\n";
+  std::cout << "Time: " << gate_ms << " ms spent in the gate, " << saved_ms
+            << " ms of extraction avoided, net "
+            << saved_ms - gate_ms << " ms\n";
+}
+
+/**
+ * @brief Entry point of the example.
+ *
+ * Requires a directory with `.pgm` eye images (or a manifest listing them).
+ * Optionally takes the engine sharpness below which a frame is useless and
+ * the percentage of useful frames the gate may reject.
+ *
+ * Every image is measured by the gate and extracted by the engine. The gate
+ * limits are calibrated on the even images against the engine's sharpness
+ * and evaluated on the odd ones.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 4) {
+    std::cerr << "Usage: " << argv[0]
+              << " input_dir|manifest [min_sharpness] [false_reject_%]\n";
+    return 1;
+  }
+  int min_sharpness = argc > 2 ? std::stoi(argv[2]) : DEFAULT_MIN_SHARPNESS;
+  double false_reject =
+      (argc > 3 ? std::stod(argv[3]) : DEFAULT_FALSE_REJECT_PERCENT) / 100;
+
+  auto inputs = list_inputs(argv[1]);
+  if (inputs.empty()) {
+    std::cerr << "No input images found.\n";
+    return 1;
+  }
+  std::cout << "ire_quality_gate of " << inputs.size() << " images started\n";
+  std::vector<Sample> samples;
+  if (!collect(inputs, min_sharpness, samples))
+    return 1;
+
+  std::vector<const Sample *> calibration, evaluation;
+  for (std::size_t i = 0; i < samples.size(); ++i)
+    (i % 2 ? evaluation : calibration).push_back(&samples[i]);
+  if (evaluation.empty())
+    evaluation = calibration;
+
+  auto thresholds = calibrate(calibration, false_reject);
+  std::cout << "Calibrated on " << calibration.size()
+            << " frames: min focus " << thresholds.min_focus
+            << ", max anisotropy " << thresholds.max_anisotropy
+            << ", focus/sharpness correlation " << correlation(calibration)
+            << "\n";
+  evaluate(evaluation, thresholds);
+  std::cout << "ire_quality_gate ended\n";
+  return 0;
+}
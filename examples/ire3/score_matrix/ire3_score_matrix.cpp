@@ -0,0 +1,474 @@
+/// @file ire3_score_matrix.cpp
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "iris_engine_v3.h"
+#include "feature_cache.h"
+#include "gallery_file.h"
+#include "gallery_loader.h"
+#include "ire3_gallery_matcher.h"
+#include "mapped_file.h"
+#include "score_matrix_format.h"
+#include "thread_pool.h"
+
+using Clock = std::chrono::steady_clock;
+
+/// Cache budget for the features of one row block and one column block.
+#define SCORE_MATRIX_CACHE_BYTES (512 * 1024)
+/// Smallest tile edge, in records.
+#define SCORE_MATRIX_MIN_TILE (16)
+/// Time between checkpoints.
+#define SCORE_MATRIX_CHECKPOINT_SECONDS (10)
+/// Bins of the score histograms.
+#define SCORE_MATRIX_BINS (65536)
+
+/**
+ * @brief Hash of the ids and serialized features of a gallery; identifies
+ * the matrix a checkpoint belongs to, whatever the file is called.
+ */
+uint64_t content_hash(const GalleryFile &file, ThreadPool &pool) {
+  std::size_t n = file.feature_count();
+  std::vector<uint64_t> hashes(n);
+  pool.parallel_for(n, [&](std::size_t i, std::size_t) {
+    hashes[i] = hash_bytes(file.ire3_features(i), file.ire3_features_size(i));
+  });
+  uint64_t hash = n;
+  for (std::size_t i = 0; i < n; ++i)
+    hash = hash * 0x100000001B3ull ^ hashes[i] ^ file.feature_id(i);
+  return hash;
+}
+
+static bool seek(FILE *file, uint64_t offset) {
+#ifdef _WIN32
+  return _fseeki64(file, (long long)offset, SEEK_SET) == 0;
+#else
+  return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+/**
+ * @brief Output file of a matrix being computed and its checkpoint.
+ *
+ * Tiles are written in any order at their final position. The checkpoint
+ * (`<output>.ckpt`) lists the finished tiles; it is only replaced after the
+ * scores it lists were flushed to disk, so an interrupted run resumes from
+ * the last checkpoint.
+ */
+class MatrixWriter {
+public:
+  ~MatrixWriter() {
+    if (file)
+      fclose(file);
+  }
+
+  /**
+   * @brief Opens the output, resuming from a matching checkpoint.
+   *
+   * @return true on success.
+   */
+  bool open(const std::string &output, const ScoreMatrixHeader &matrix,
+            const std::vector<uint32_t> &ids, uint32_t matrix_tile,
+            std::size_t num_tiles) {
+    path = output;
+    header = matrix;
+    tile = matrix_tile;
+    done.assign(num_tiles, 0);
+    last_checkpoint = Clock::now();
+    uint64_t size =
+        header.scores_offset +
+        score_count(header.count, header.upper) * header.score_bytes;
+    std::error_code error;
+    if (load_checkpoint() &&
+        std::filesystem::file_size(path, error) == size && !error) {
+      file = fopen(path.c_str(), "r+b");
+      if (file)
+        return true;
+    }
+    std::fill(done.begin(), done.end(), 0);
+    file = fopen(path.c_str(), "w+b");
+    if (!file)
+      return false;
+    // The file gets its final size at once, tiles are written in place.
+    static const uint8_t zero = 0;
+    return fwrite(&header, sizeof(header), 1, file) == 1 &&
+           fwrite(ids.data(), sizeof(uint32_t), ids.size(), file) ==
+               ids.size() &&
+           seek(file, size - 1) && fwrite(&zero, 1, 1, file) == 1;
+  }
+
+  bool is_done(std::size_t t) const { return done[t] != 0; }
+
+  std::size_t resumed() const {
+    return (std::size_t)std::count(done.begin(), done.end(), 1);
+  }
+
+  /**
+   * @brief Writes row segments of a finished tile and marks it done.
+   *
+   * @param segments (score index, byte offset in `data`, score count) of
+   * every row.
+   */
+  bool write(std::size_t t, const std::vector<uint8_t> &data,
+             const std::vector<std::array<uint64_t, 3>> &segments) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto &segment : segments)
+      if (!seek(file, header.scores_offset + segment[0] * header.score_bytes) ||
+          fwrite(data.data() + segment[1], header.score_bytes, segment[2],
+                 file) != segment[2])
+        return false;
+    done[t] = 1;
+    if (Clock::now() - last_checkpoint >
+        std::chrono::seconds(SCORE_MATRIX_CHECKPOINT_SECONDS))
+      return checkpoint();
+    return true;
+  }
+
+  /**
+   * @brief Flushes the scores, then records the finished tiles.
+   */
+  bool checkpoint() {
+    last_checkpoint = Clock::now();
+    if (fflush(file) != 0)
+      return false;
+#ifndef _WIN32
+    fsync(fileno(file));
+#endif
+    std::string temp = path + ".ckpt.tmp";
+    {
+      std::ofstream out(temp, std::ios::binary);
+      uint64_t count = done.size();
+      out.write((const char *)&header, sizeof(header));
+      out.write((const char *)&tile, sizeof(tile));
+      out.write((const char *)&count, sizeof(count));
+      out.write((const char *)done.data(), done.size());
+      if (!out)
+        return false;
+    }
+    std::error_code error;
+    std::filesystem::rename(temp, path + ".ckpt", error);
+    return !error;
+  }
+
+  /**
+   * @brief Flushes the complete matrix and drops the checkpoint.
+   */
+  bool finish() {
+    std::lock_guard<std::mutex> lock(mutex);
+    bool ok = fflush(file) == 0 && fclose(file) == 0;
+    file = nullptr;
+    std::error_code error;
+    std::filesystem::remove(path + ".ckpt", error);
+    return ok;
+  }
+
+private:
+  bool load_checkpoint() {
+    std::ifstream in(path + ".ckpt", std::ios::binary);
+    ScoreMatrixHeader saved;
+    uint32_t saved_tile = 0;
+    uint64_t count = 0;
+    if (!in.read((char *)&saved, sizeof(saved)) ||
+        !in.read((char *)&saved_tile, sizeof(saved_tile)) ||
+        !in.read((char *)&count, sizeof(count)) ||
+        std::memcmp(&saved, &header, sizeof(header)) != 0 ||
+        saved_tile != tile || count != done.size())
+      return false;
+    return (bool)in.read((char *)done.data(), done.size());
+  }
+
+  std::string path;
+  ScoreMatrixHeader header;
+  uint32_t tile = 0;
+  FILE *file = nullptr;
+  std::mutex mutex;
+  std::vector<uint8_t> done;
+  Clock::time_point last_checkpoint;
+};
+
+/**
+ * @brief Computes every tile of the matrix not finished by an earlier run.
+ *
+ * A tile compares a block of `tile` rows with a block of `tile` columns, so
+ * the features of both blocks stay in the cache while every pair is
+ * compared.
+ *
+ * @return number of comparisons, or -1 on a write error.
+ */
+long long compute(const FeatureGalleryView &view,
+                  const ScoreMatrixHeader &header, uint32_t tile,
+                  ThreadPool &pool, MatrixWriter &writer,
+                  std::size_t &clipped, std::size_t &failures) {
+  std::size_t n = view.count;
+  std::size_t blocks = (n + tile - 1) / tile;
+  std::vector<std::pair<uint32_t, uint32_t>> tiles;
+  for (uint32_t a = 0; a < blocks; ++a)
+    for (uint32_t b = header.upper ? a : 0; b < blocks; ++b)
+      tiles.push_back({a, b});
+
+  struct alignas(64) Worker {
+    std::vector<uint8_t> data;
+    std::vector<std::array<uint64_t, 3>> segments;
+    std::size_t comparisons = 0, clipped = 0, failures = 0;
+  };
+  std::vector<Worker> workers(pool.size());
+  std::atomic<bool> write_failed{false};
+  ire3_settings settings = {sizeof(settings), 150, 4};
+
+  pool.parallel_for(tiles.size(), [&](std::size_t t, std::size_t index) {
+    if (writer.is_done(t) || write_failed)
+      return;
+    Worker &worker = workers[index];
+    worker.data.clear();
+    worker.segments.clear();
+    ire3_settings s = settings;
+    std::size_t row_end = std::min(n, (tiles[t].first + 1) * (std::size_t)tile);
+    std::size_t col_begin = tiles[t].second * (std::size_t)tile;
+    std::size_t col_end = std::min(n, col_begin + tile);
+    for (std::size_t i = tiles[t].first * (std::size_t)tile; i < row_end;
+         ++i) {
+      std::size_t j = header.upper ? std::max(col_begin, i + 1) : col_begin;
+      if (j >= col_end)
+        continue;
+      worker.segments.push_back({score_index(i, j, n, header.upper),
+                                 worker.data.size(), col_end - j});
+      const uint8_t *row = view.record(i);
+      for (; j < col_end; ++j) {
+        int score = 0;
+        if (ire3_compare(row, view.record(j), &s, &score) != IRE3_STATUS_OK)
+          ++worker.failures;
+        ++worker.comparisons;
+        if (header.score_bytes == 2) {
+          int16_t narrow = (int16_t)std::min(std::max(score, -32768), 32767);
+          worker.clipped += narrow != score;
+          uint8_t *p = &*worker.data.insert(worker.data.end(), 2, 0);
+          std::memcpy(p, &narrow, 2);
+        } else {
+          int32_t wide = score;
+          uint8_t *p = &*worker.data.insert(worker.data.end(), 4, 0);
+          std::memcpy(p, &wide, 4);
+        }
+      }
+    }
+    if (!writer.write(t, worker.data, worker.segments))
+      write_failed = true;
+  });
+
+  long long comparisons = 0;
+  for (const auto &worker : workers) {
+    comparisons += worker.comparisons;
+    clipped += worker.clipped;
+    failures += worker.failures;
+  }
+  return write_failed ? -1 : comparisons;
+}
+
+/**
+ * @brief Genuine and impostor score distributions and the DET curve of a
+ * matrix. Pairs with the same id are genuine, self comparisons are skipped.
+ *
+ * @return false if the matrix can not be read.
+ */
+bool summarize(const std::string &output) {
+  MappedFile file;
+  if (!file.open(output) || file.size() < sizeof(ScoreMatrixHeader))
+    return false;
+  ScoreMatrixHeader header;
+  std::memcpy(&header, file.data(), sizeof(header));
+  uint64_t n = header.count;
+  const uint8_t *ids_data = file.data() + sizeof(header);
+  const uint8_t *scores = file.data() + header.scores_offset;
+  auto id = [&](uint64_t i) {
+    uint32_t value;
+    std::memcpy(&value, ids_data + i * 4, 4);
+    return value;
+  };
+  auto score = [&](uint64_t k) -> int64_t {
+    if (header.score_bytes == 2) {
+      int16_t value;
+      std::memcpy(&value, scores + k * 2, 2);
+      return value;
+    }
+    int32_t value;
+    std::memcpy(&value, scores + k * 4, 4);
+    return value;
+  };
+  auto for_each_pair = [&](const auto &visit) {
+    for (uint64_t i = 0; i < n; ++i)
+      for (uint64_t j = header.upper ? i + 1 : 0; j < n; ++j)
+        if (i != j)
+          visit(id(i) == id(j), score(score_index(i, j, n, header.upper)));
+  };
+
+  int64_t low = INT64_MAX, high = INT64_MIN;
+  for_each_pair([&](bool, int64_t s) {
+    low = std::min(low, s);
+    high = std::max(high, s);
+  });
+  if (low > high) {
+    std::cout << "No pairs to summarize.\n";
+    return true;
+  }
+  int64_t width = (high - low) / SCORE_MATRIX_BINS + 1;
+  std::size_t bins = (std::size_t)((high - low) / width + 1);
+  std::vector<uint64_t> genuine(bins), impostor(bins);
+  double genuine_sum = 0, impostor_sum = 0;
+  for_each_pair([&](bool same, int64_t s) {
+    (same ? genuine : impostor)[(std::size_t)((s - low) / width)]++;
+    (same ? genuine_sum : impostor_sum) += (double)s;
+  });
+  uint64_t g = 0, m = 0;
+  for (std::size_t b = 0; b < bins; ++b) {
+    g += genuine[b];
+    m += impostor[b];
+  }
+  std::cout << "Genuine pairs:  " << g << ", mean score "
+            << (g ? genuine_sum / g : 0) << "\n";
+  std::cout << "Impostor pairs: " << m << ", mean score "
+            << (m ? impostor_sum / m : 0) << "\n";
+  if (!g || !m)
+    return true;
+
+  // Higher scores are better matches: a pair is accepted at threshold t if
+  // its score is >= t. Thresholds sweep from high to low.
+  const double targets[] = {1e-2, 1e-3, 1e-4, 1e-5, 1e-6};
+  double fnmr_at[5] = {1, 1, 1, 1, 1};
+  double eer = -1;
+  uint64_t accepted_genuine = 0, accepted_impostor = 0;
+  std::ofstream det(output + ".det.csv");
+  det << "threshold,fmr,fnmr\n";
+  for (std::size_t b = bins; b-- > 0;) {
+    accepted_genuine += genuine[b];
+    accepted_impostor += impostor[b];
+    double fmr = (double)accepted_impostor / m;
+    double fnmr = (double)(g - accepted_genuine) / g;
+    if (genuine[b] || impostor[b])
+      det << low + (int64_t)b * width << "," << fmr << "," << fnmr << "\n";
+    for (int k = 0; k < 5; ++k)
+      if (fmr <= targets[k])
+        fnmr_at[k] = fnmr;
+    if (eer < 0 && fmr >= fnmr)
+      eer = (fmr + fnmr) / 2;
+  }
+  std::cout << "EER: " << eer * 100 << "%\n";
+  for (int k = 0; k < 5; ++k)
+    if (targets[k] * m >= 1)
+      std::cout << "FNMR @ FMR " << targets[k] << ": " << fnmr_at[k] * 100
+                << "%\n";
+  std::cout << "DET curve written to " << output << ".det.csv\n";
+  return true;
+}
+
+/**
+ * @brief Entry point of the tool.
+ *
+ * Requires a gallery file with ire3 features, e.g. written by
+ * ire3_batch_extract (its ids are the subjects), and the output file name.
+ * Optionally takes `full` or `upper` (default), the number of threads, the
+ * tile edge in records (0 to fit the cache), the bytes per score (2 or
+ * 4) and a snapshot file of the deserialized gallery, see
+ * @ref LoadedGallery. An interrupted run started again with the same
+ * arguments resumes from its last checkpoint.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 3 || argc > 8) {
+    std::cerr << "Usage: " << argv[0]
+              << " gallery_file output [full|upper] [threads] [tile] "
+                 "[score_bytes] [snapshot]\n";
+    return 1;
+  }
+  std::string output = argv[2];
+  bool upper = argc <= 3 || std::string(argv[3]) != "full";
+  std::size_t num_threads = argc > 4 ? std::stoul(argv[4]) : 0;
+  std::size_t tile = argc > 5 ? std::stoul(argv[5]) : 0;
+  int score_bytes = argc > 6 ? std::stoi(argv[6]) : 2;
+  if (score_bytes != 2 && score_bytes != 4) {
+    std::cerr << "Scores are stored in 2 or 4 bytes.\n";
+    return 1;
+  }
+  GalleryLoadOptions load_options;
+  if (argc > 7)
+    load_options.snapshot = argv[7];
+
+  GalleryFile file;
+  if (!file.open(argv[1]) || file.feature_count() == 0) {
+    std::cerr << "Can not open gallery " << argv[1] << "\n";
+    return 1;
+  }
+  ThreadPool pool(num_threads);
+  LoadedGallery records;
+  GalleryLoadStats load_stats;
+  if (!records.load(argv[1], pool, load_options, &load_stats)) {
+    std::cerr << "Can not load gallery " << argv[1] << ": "
+              << records.error() << "\n";
+    return 1;
+  }
+  const FeatureGalleryView &view = records.view();
+  std::size_t n = view.count;
+  std::vector<uint32_t> ids(n);
+  for (std::size_t i = 0; i < n; ++i)
+    ids[i] = records.id(i);
+  if (tile == 0)
+    tile = std::max<std::size_t>(SCORE_MATRIX_MIN_TILE,
+                                 SCORE_MATRIX_CACHE_BYTES / 2 /
+                                     view.record_size);
+  std::cout << n << " records " << load_stats << ", tiles of " << tile
+            << " x " << tile << "\n";
+
+  ScoreMatrixHeader header = {};
+  std::memcpy(header.magic, SCORE_MATRIX_MAGIC, 4);
+  header.version = SCORE_MATRIX_VERSION;
+  header.count = (uint32_t)n;
+  header.upper = upper;
+  header.score_bytes = (uint8_t)score_bytes;
+  header.scores_offset = (sizeof(header) + n * 4 + 63) / 64 * 64;
+  header.gallery_hash = content_hash(file, pool);
+
+  std::size_t blocks = (n + tile - 1) / tile;
+  MatrixWriter writer;
+  if (!writer.open(output, header, ids, (uint32_t)tile,
+                   upper ? blocks * (blocks + 1) / 2 : blocks * blocks)) {
+    std::cerr << "Can not create " << output << "\n";
+    return 1;
+  }
+  if (writer.resumed())
+    std::cout << "Resuming, " << writer.resumed() << " tiles already done\n";
+
+  std::size_t clipped = 0, failures = 0;
+  auto start = Clock::now();
+  long long comparisons =
+      compute(view, header, (uint32_t)tile, pool, writer, clipped, failures);
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  if (comparisons < 0 || !writer.finish()) {
+    std::cerr << "Can not write " << output << "\n";
+    return 1;
+  }
+  std::cout << comparisons << " comparisons in " << seconds << " s on "
+            << pool.size() << " threads: "
+            << (seconds > 0 ? comparisons / seconds : 0)
+            << " comparisons/s\n";
+  if (failures)
+    std::cout << failures << " comparisons failed and scored 0\n";
+  if (clipped)
+    std::cout << clipped
+              << " scores do not fit in 2 bytes and were clipped, use 4\n";
+  if (!summarize(output)) {
+    std::cerr << "Can not read " << output << "\n";
+    return 1;
+  }
+  return 0;
+}
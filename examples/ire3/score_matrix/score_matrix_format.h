@@ -0,0 +1,50 @@
+/// @file score_matrix_format.h
+#pragma once
+
+#include <cstddef>
+#include <stdint.h>
+
+/**
+ * @brief File magic of a score matrix.
+ */
+#define SCORE_MATRIX_MAGIC "IRSM"
+#define SCORE_MATRIX_VERSION (1)
+
+/**
+ * @brief Header of a score matrix file, followed by `count` uint32 ids and
+ * the scores at `scores_offset`.
+ *
+ * Scores are signed little-endian integers of `score_bytes` bytes stored
+ * row by row. A full matrix has `count * count` scores. An upper matrix
+ * has only the pairs `i < j`: row `i` holds the scores of columns
+ * `i + 1 .. count - 1`. The header fields are in native byte order.
+ */
+struct ScoreMatrixHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t count;
+  /// 1 for the upper triangle without the diagonal, 0 for a full matrix.
+  uint8_t upper;
+  /// 2 or 4.
+  uint8_t score_bytes;
+  uint16_t reserved;
+  uint64_t scores_offset;
+  /// Hash of the gallery the scores were computed from.
+  uint64_t gallery_hash;
+};
+
+/**
+ * @brief Number of scores of a matrix.
+ */
+inline uint64_t score_count(uint64_t count, bool upper) {
+  return upper ? count * (count - (count > 0)) / 2 : count * count;
+}
+
+/**
+ * @brief Position of the score of the pair `(i, j)`, `i < j` for an upper
+ * matrix.
+ */
+inline uint64_t score_index(uint64_t i, uint64_t j, uint64_t count,
+                            bool upper) {
+  return upper ? i * (2 * count - i - 1) / 2 + (j - i - 1) : i * count + j;
+}
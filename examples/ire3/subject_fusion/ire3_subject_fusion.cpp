@@ -0,0 +1,284 @@
+/// @file ire3_subject_fusion.cpp
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "iris_engine_v3.h"
+#include "gallery_loader.h"
+#include "ire3_gallery_matcher.h"
+#include "subject_matcher.h"
+#include "thread_pool.h"
+
+/**
+ * @brief Subject and eye of record `i` of the gallery.
+ *
+ * @param eye_in_id whether the lowest bit of the ids is the eye.
+ */
+static void subject_eye(const LoadedGallery &records, std::size_t i,
+                        bool eye_in_id, uint32_t &subject, int &eye) {
+  uint32_t id = records.id(i);
+  subject = eye_in_id ? id >> 1 : id;
+  eye = eye_in_id ? (int)(id & 1) : 0;
+}
+
+/**
+ * @brief Two-eye probe held out of the gallery.
+ */
+struct Probe {
+  uint32_t subject;
+  const uint8_t *eyes[SUBJECT_EYES] = {nullptr, nullptr};
+};
+
+/**
+ * @brief Holds out the last sample of every eye with at least two samples
+ * of up to `count` subjects spread over the gallery; the other records go
+ * into `gallery`.
+ */
+std::vector<Probe> hold_out(const LoadedGallery &records, bool eye_in_id,
+                            std::size_t count, SubjectGallery &gallery) {
+  const FeatureGalleryView &view = records.view();
+  std::vector<uint32_t> subjects(view.count);
+  std::vector<int> eyes(view.count);
+  for (std::size_t i = 0; i < view.count; ++i)
+    subject_eye(records, i, eye_in_id, subjects[i], eyes[i]);
+  SubjectGallery all(view);
+  for (std::size_t i = 0; i < view.count; ++i)
+    all.add(i, subjects[i], eyes[i]);
+  all.finish();
+
+  std::vector<std::size_t> candidates;
+  for (std::size_t s = 0; s < all.size(); ++s)
+    for (int e = 0; e < SUBJECT_EYES; ++e)
+      if (all.subject(s).count(e) >= 2) {
+        candidates.push_back(s);
+        break;
+      }
+  count = std::min(count, candidates.size());
+
+  std::vector<bool> held(view.count, false);
+  std::vector<Probe> probes;
+  for (std::size_t p = 0; p < count; ++p) {
+    const auto &subject =
+        all.subject(candidates[p * candidates.size() / count]);
+    Probe probe;
+    probe.subject = subject.id;
+    for (int e = 0; e < SUBJECT_EYES; ++e) {
+      if (subject.count(e) < 2)
+        continue;
+      std::size_t last = subject.begin[e + 1] - 1;
+      probe.eyes[e] = all.sample(last);
+      held[(probe.eyes[e] - view.data) / view.record_size] = true;
+    }
+    probes.push_back(probe);
+  }
+  for (std::size_t i = 0; i < view.count; ++i)
+    if (!held[i])
+      gallery.add(i, subjects[i], eyes[i]);
+  gallery.finish();
+  return probes;
+}
+
+/**
+ * @brief Totals of one way of identifying all probes.
+ */
+struct Outcome {
+  FusionStats stats;
+  std::size_t correct = 0;
+  std::vector<int64_t> decisions; // subject id per probe, -1 for none
+};
+
+static void report(const char *name, const Outcome &outcome,
+                   std::size_t probes) {
+  std::cout << name << outcome.stats << ", "
+            << (double)outcome.stats.comparisons / probes
+            << " comparisons per probe, " << outcome.correct << " of "
+            << probes << " identified correctly\n";
+}
+
+/**
+ * @brief Flat template scoring: every probe eye is searched among the
+ * samples of that eye and the best single template decides.
+ */
+Outcome flat_templates(const std::vector<Probe> &probes,
+                       const SubjectGallery &gallery,
+                       const ire3_settings &settings, ThreadPool &pool) {
+  std::vector<const uint8_t *> samples[SUBJECT_EYES];
+  std::vector<uint32_t> owners[SUBJECT_EYES];
+  for (std::size_t s = 0; s < gallery.size(); ++s)
+    for (int e = 0; e < SUBJECT_EYES; ++e)
+      for (std::size_t n = gallery.subject(s).begin[e];
+           n < gallery.subject(s).begin[e + 1]; ++n) {
+        samples[e].push_back(gallery.sample(n));
+        owners[e].push_back(gallery.subject(s).id);
+      }
+
+  GalleryMatcher matcher(pool, settings);
+  SearchOptions options;
+  options.top_k = 1;
+  Outcome outcome;
+  for (const auto &probe : probes) {
+    int64_t decision = -1;
+    int best = 0;
+    for (int e = 0; e < SUBJECT_EYES; ++e) {
+      if (!probe.eyes[e])
+        continue;
+      SearchStats stats;
+      auto results = matcher.search(probe.eyes[e], samples[e],
+                                    gallery.view().record_size, options,
+                                    &stats);
+      outcome.stats.comparisons += stats.comparisons;
+      outcome.stats.failures += stats.failures;
+      outcome.stats.seconds += stats.seconds;
+      if (!results.empty() && (decision < 0 || results[0].score > best)) {
+        best = results[0].score;
+        decision = owners[e][results[0].index];
+      }
+    }
+    outcome.decisions.push_back(decision);
+    outcome.correct += decision == (int64_t)probe.subject;
+  }
+  return outcome;
+}
+
+/**
+ * @brief Subject level scoring of all probes with `options`.
+ */
+Outcome fused_subjects(const std::vector<Probe> &probes,
+                       const SubjectGallery &gallery,
+                       const ire3_settings &settings, ThreadPool &pool,
+                       const FusionOptions &options) {
+  SubjectMatcher matcher(pool, settings);
+  Outcome outcome;
+  for (const auto &probe : probes) {
+    FusionStats stats;
+    auto results = matcher.search(probe.eyes, gallery, options, &stats);
+    outcome.stats += stats;
+    int64_t decision =
+        results.empty() ? -1 : gallery.subject(results[0].subject).id;
+    outcome.decisions.push_back(decision);
+    outcome.correct += decision == (int64_t)probe.subject;
+  }
+  return outcome;
+}
+
+static bool parse_rule(const std::string &name, FusionRule &rule) {
+  if (name != "max" && name != "sum")
+    return false;
+  rule = name == "max" ? FusionRule::Max : FusionRule::Sum;
+  return true;
+}
+
+/**
+ * @brief Entry point of the tool.
+ *
+ * Requires a gallery file with ire3 features whose ids are
+ * `2 * subject + eye` (0 left, 1 right), e.g. written by ire3_batch_extract
+ * from a manifest; with `subject` ids every record counts as the same eye.
+ * Optionally takes the number of probes, the fusion rules of the eyes and of
+ * the samples of one eye (`sum,max` by default), the fused score a subject
+ * needs to be identified, the number of threads, the id scheme, the
+ * highest score of one comparison and a snapshot file of the deserialized
+ * gallery, see @ref LoadedGallery.
+ *
+ * The last sample of every eye of the probe subjects is held out as probe.
+ * Each probe is identified three times: by the best single template, by
+ * fused subject scores over all samples and by fused scores with early
+ * termination. The comparison counts and times show what early
+ * termination saves. By default the highest score is that of a probe
+ * compared with itself, a bound no comparison exceeds, and both fused runs
+ * must take the same decisions. A lower value, e.g. a high percentile of
+ * the genuine scores of ire3_score_matrix, prunes far more subjects at the
+ * risk of changing some decisions, which are then counted.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 9) {
+    std::cerr << "Usage: " << argv[0]
+              << " gallery_file [probes] [eyes,samples] [threshold] "
+                 "[threads] [subject_eye|subject] [max_score] [snapshot]\n";
+    return 1;
+  }
+  std::size_t num_probes = argc > 2 ? std::stoul(argv[2]) : 100;
+  FusionOptions options;
+  if (argc > 3) {
+    std::string rules = argv[3];
+    auto comma = rules.find(',');
+    if (comma == std::string::npos ||
+        !parse_rule(rules.substr(0, comma), options.eyes) ||
+        !parse_rule(rules.substr(comma + 1), options.samples)) {
+      std::cerr << "Rules are max or sum, e.g. sum,max.\n";
+      return 1;
+    }
+  }
+  if (argc > 4)
+    options.threshold = std::stoll(argv[4]);
+  std::size_t num_threads = argc > 5 ? std::stoul(argv[5]) : 0;
+  bool eye_in_id = argc <= 6 || std::string(argv[6]) != "subject";
+  int max_score = argc > 7 ? std::stoi(argv[7]) : 0;
+  GalleryLoadOptions load_options;
+  if (argc > 8)
+    load_options.snapshot = argv[8];
+
+  ThreadPool pool(num_threads);
+  LoadedGallery records;
+  GalleryLoadStats load_stats;
+  if (!records.load(argv[1], pool, load_options, &load_stats)) {
+    std::cerr << "Can not load gallery " << argv[1] << ": "
+              << records.error() << "\n";
+    return 1;
+  }
+  if (records.size() == 0) {
+    std::cerr << "Gallery " << argv[1] << " has no features.\n";
+    return 1;
+  }
+  std::cout << "Gallery " << load_stats << "\n";
+  SubjectGallery gallery(records.view());
+  auto probes = hold_out(records, eye_in_id, num_probes, gallery);
+  if (probes.empty()) {
+    std::cerr << "No subject has two samples of an eye to hold one out.\n";
+    return 1;
+  }
+  std::cout << gallery.size() << " subjects, " << gallery.sample_count()
+            << " samples, " << probes.size() << " probes, " << pool.size()
+            << " threads\n";
+
+  // Bound of a single score for early termination: nothing matches closer
+  // than a feature set matches itself.
+  ire3_settings settings = {sizeof(settings), 150, 4};
+  bool exact = max_score <= 0;
+  for (const auto &probe : probes)
+    for (int e = 0; exact && e < SUBJECT_EYES; ++e) {
+      int score = 0;
+      if (probe.eyes[e] &&
+          ire3_compare(probe.eyes[e], probe.eyes[e], &settings, &score) ==
+              IRE3_STATUS_OK)
+        max_score = std::max(max_score, score);
+    }
+  options.max_score = max_score;
+  std::cout << "Highest score: " << max_score
+            << (exact ? " (self comparison)" : " (given)") << "\n";
+
+  Outcome flat = flat_templates(probes, gallery, settings, pool);
+  options.early_termination = false;
+  Outcome fused = fused_subjects(probes, gallery, settings, pool, options);
+  options.early_termination = true;
+  Outcome pruned = fused_subjects(probes, gallery, settings, pool, options);
+
+  report("Best template:          ", flat, probes.size());
+  report("Fused, all samples:     ", fused, probes.size());
+  report("Fused, early terminated:", pruned, probes.size());
+  if (fused.stats.comparisons)
+    std::cout << "Early termination saves "
+              << 100.0 * (fused.stats.comparisons -
+                          pruned.stats.comparisons) /
+                     fused.stats.comparisons
+              << "% of the comparisons\n";
+  std::size_t changed = 0;
+  for (std::size_t p = 0; p < probes.size(); ++p)
+    changed += pruned.decisions[p] != fused.decisions[p];
+  if (changed) {
+    std::cerr << "Early termination changed " << changed << " decisions.\n";
+    return exact ? 1 : 0;
+  }
+  return 0;
+}
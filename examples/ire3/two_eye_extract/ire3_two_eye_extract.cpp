@@ -0,0 +1,141 @@
+/// @file ire3_two_eye_extract.cpp
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "iris_engine_v3.h"
+#include "eye_roi.h"
+#include "image_source.h"
+#include "ire3_features.h"
+#include "latency_stats.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Predefined frame width for this example.
+ */
+#define WIDTH (2336)
+/**
+ * @brief Predefined frame height for this example.
+ */
+#define HEIGHT (769)
+
+static double elapsed_ms(Clock::time_point from, Clock::time_point to) {
+  return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+/**
+ * @brief Entry point of the example.
+ *
+ * Requires a binary file with consecutive RAW two-eye frames of size
+ * @ref WIDTH x @ref HEIGHT, as taken by the irm2 examples.
+ *
+ * Every frame goes through @ref EyeRoiDetector, which finds both eye
+ * regions on a 1/8 scale copy or around the eyes of the previous frame, and
+ * the two @ref EYE_ROI_WIDTH x @ref EYE_ROI_HEIGHT crops are handed to
+ * `ire3_extract_features`, first one after the other on this thread, then
+ * concurrently with one extractor per eye. The per-frame latencies of both
+ * show what the concurrent extraction saves.
+ */
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " frames\n";
+    return 1;
+  }
+  std::error_code error;
+  auto file_size = std::filesystem::file_size(argv[1], error);
+  std::size_t num_frames =
+      error ? 0 : file_size / ((std::size_t)WIDTH * HEIGHT);
+  MappedImage recording;
+  if (num_frames == 0 ||
+      !recording.open_raw(argv[1], WIDTH, HEIGHT * (int)num_frames)) {
+    std::cerr << "Can not read input file: "
+              << (num_frames ? recording.error() : "no complete frame")
+              << "\n";
+    return 1;
+  }
+  if (std::thread::hardware_concurrency() < 2)
+    std::cerr << "Single hardware thread, the eyes can not be extracted "
+                 "concurrently.\n";
+
+  ire3_settings settings = {sizeof(settings), 150, 4};
+  std::array<Ire3Extractor, 2> extractors;
+  for (auto &extractor : extractors) {
+    int rc = extractor.init(settings);
+    if (rc != IRE3_STATUS_OK) {
+      std::cerr << "Extractor init fails: " << std::hex << rc << "\n";
+      return 1;
+    }
+  }
+
+  ThreadPool pool(2);
+  EyeRoiDetector detector;
+  LatencyStats detection, sequential, concurrent;
+  std::size_t extracted = 0;
+  for (std::size_t f = 0; f < num_frames; ++f) {
+    TRACE_SCOPE("frame");
+    ImageView frame =
+        recording.view().crop(0, (int)(f * HEIGHT), WIDTH, HEIGHT);
+    auto start = Clock::now();
+    int found;
+    {
+      TRACE_SCOPE("detect");
+      found = detector.detect(frame);
+    }
+    detection.add(elapsed_ms(start, Clock::now()));
+    const auto &rois = detector.rois();
+    std::cout << "Frame " << f << ":";
+    for (const auto &roi : rois)
+      std::cout << " eye at (" << roi.center_x << ", " << roi.center_y
+                << ") contrast " << roi.contrast
+                << (roi.found ? "" : " not found");
+    std::cout << "\n";
+    if (found != 2)
+      continue;
+
+    std::array<int, 2> rc;
+    start = Clock::now();
+    for (int e = 0; e < 2; ++e) {
+      TRACE_SCOPE("extract_sequential");
+      rc[e] = extractors[0].extract(detector.crop(frame, e));
+    }
+    sequential.add(elapsed_ms(start, Clock::now()));
+
+    std::array<ire3_eye_info, 2> eye_info;
+    start = Clock::now();
+    pool.parallel_for(2, [&](std::size_t e, std::size_t) {
+      TRACE_SCOPE("extract_concurrent");
+      rc[e] = extractors[e].extract(detector.crop(frame, (int)e),
+                                    &eye_info[e]);
+    });
+    concurrent.add(elapsed_ms(start, Clock::now()));
+
+    for (int e = 0; e < 2; ++e) {
+      if (rc[e] != IRE3_STATUS_OK) {
+        std::cout << "  eye " << e << ": extraction fails: " << std::hex
+                  << rc[e] << std::dec << "\n";
+        continue;
+      }
+      ++extracted;
+      std::cout << "  eye " << e << ": " << extractors[e].features_size()
+                << " bytes of features, sharpness " << eye_info[e].sharpness
+                << "\n";
+    }
+  }
+
+  std::cout << extracted << " eyes extracted from " << num_frames
+            << " frames, " << detector.full_searches << " full searches, "
+            << detector.tracked << " tracked, " << detector.lost
+            << " lost\n";
+  std::cout << "Eye detection:          " << detection << "\n";
+  std::cout << "Sequential extraction:  " << sequential << "\n";
+  std::cout << "Concurrent extraction:  " << concurrent << "\n";
+  if (concurrent.count() && concurrent.mean() > 0)
+    std::cout << "Speedup: " << sequential.mean() / concurrent.mean() << "\n";
+  return 0;
+}
@@ -0,0 +1,182 @@
+/// @file ire3_verify_cache.cpp
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "iris_engine_v3.h"
+#include "buffer_pool.h"
+#include "feature_cache.h"
+#include "gallery_file.h"
+#include "image_source.h"
+#include "thread_pool.h"
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Extracts and deserializes the probe features of an eye crop.
+ *
+ * @return true on success.
+ */
+bool extract_probe(const ImageView &image, const ire3_settings &settings,
+                   std::vector<uint8_t> &des_ftr) {
+  size_t size = 0, set_size = 0, feature_size = 0, des_size = 0;
+  ire3_eye_info eye_info;
+  if (ire3_get_max_features_size(&size) != IRE3_STATUS_OK ||
+      ire3_get_extraction_working_set_size(&set_size, &settings) !=
+          IRE3_STATUS_OK ||
+      ire3_get_deserialized_features_size(&des_size) != IRE3_STATUS_OK)
+    return false;
+  PooledBuffer features = BufferPool::local().acquire(size);
+  PooledBuffer working_set = BufferPool::local().acquire(set_size);
+  des_ftr.resize(des_size);
+  auto rc = ire3_extract_features(image.pixels, image.width, image.height,
+                                  features.data(), size, &feature_size,
+                                  &eye_info, sizeof(eye_info),
+                                  working_set.data(), set_size, &settings);
+  if (rc == IRE3_STATUS_OK)
+    rc = ire3_deserialize_features(features.data(), feature_size,
+                                   des_ftr.data(), des_size);
+  if (rc != IRE3_STATUS_OK) {
+    std::cerr << "Probe extraction fails: " << std::hex << rc << std::dec
+              << "\n";
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Claimed identities of a verification workload in which a few
+ * enrolled users are much more frequent than the rest (Zipf distribution).
+ *
+ * @param num_users number of enrolled users.
+ * @param num_requests number of verifications.
+ * @param skew Zipf exponent, 0 for uniform.
+ */
+std::vector<uint32_t> make_requests(std::size_t num_users,
+                                    std::size_t num_requests, double skew) {
+  std::vector<double> cdf(num_users);
+  double sum = 0;
+  for (std::size_t r = 0; r < num_users; ++r)
+    cdf[r] = sum += 1 / std::pow(r + 1.0, skew);
+  // Popularity rank -> user, so that the hot users are spread over the
+  // gallery.
+  std::vector<uint32_t> users(num_users);
+  std::iota(users.begin(), users.end(), 0);
+  std::mt19937_64 random(7);
+  std::shuffle(users.begin(), users.end(), random);
+  std::uniform_real_distribution<double> uniform(0, sum);
+  std::vector<uint32_t> requests(num_requests);
+  for (auto &request : requests) {
+    auto rank = std::lower_bound(cdf.begin(), cdf.end(), uniform(random)) -
+                cdf.begin();
+    request = users[std::min<std::size_t>(rank, num_users - 1)];
+  }
+  return requests;
+}
+
+/**
+ * @brief Runs 1:1 verifications of the probe against the claimed gallery
+ * entries, either deserializing every claimed entry or going through the
+ * cache.
+ *
+ * @param cache cache to use, nullptr to deserialize every time.
+ * @return verifications per second.
+ */
+double verify(ThreadPool &pool, const GalleryFile &gallery,
+              const std::vector<uint8_t> &probe,
+              const std::vector<uint32_t> &requests,
+              const ire3_settings &settings, FeatureCache *cache,
+              std::size_t &failures) {
+  std::vector<std::vector<uint8_t>> buffers(
+      pool.size(), std::vector<uint8_t>(probe.size()));
+  std::atomic<std::size_t> failed{0};
+  auto start = Clock::now();
+  pool.parallel_for(requests.size(), [&](std::size_t i, std::size_t worker) {
+    uint32_t user = requests[i];
+    const uint8_t *features = gallery.ire3_features(user);
+    std::size_t size = gallery.ire3_features_size(user);
+    FeatureCache::Handle entry;
+    const uint8_t *enrolled = buffers[worker].data();
+    if (cache) {
+      entry = cache->get(features, size);
+      enrolled = entry ? entry->data() : nullptr;
+    } else if (ire3_deserialize_features(features, size,
+                                         buffers[worker].data(),
+                                         probe.size()) != IRE3_STATUS_OK) {
+      enrolled = nullptr;
+    }
+    ire3_settings s = settings;
+    int score = 0;
+    if (!enrolled ||
+        ire3_compare(probe.data(), enrolled, &s, &score) != IRE3_STATUS_OK)
+      ++failed;
+  });
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  failures = failed;
+  return seconds > 0 ? requests.size() / seconds : 0;
+}
+
+/**
+ * @brief Entry point of the example.
+ *
+ * Requires a probe `.pgm` eye crop and a gallery file with ire3 features,
+ * e.g. written by ire3_batch_extract. Optionally takes the number of
+ * verifications, the cache size in MB, the number of threads and the Zipf
+ * exponent of the claimed identities.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 3 || argc > 7) {
+    std::cerr << "Usage: " << argv[0]
+              << " probe gallery_file [requests] [cache_mb] [threads] "
+                 "[skew]\n";
+    return 1;
+  }
+  std::size_t num_requests = argc > 3 ? std::stoul(argv[3]) : 100000;
+  std::size_t cache_mb = argc > 4 ? std::stoul(argv[4]) : 64;
+  std::size_t num_threads = argc > 5 ? std::stoul(argv[5]) : 0;
+  double skew = argc > 6 ? std::stod(argv[6]) : 1.0;
+
+  MappedImage image;
+  if (!image.open_pgm(argv[1])) {
+    std::cerr << "Can not read input file: " << image.error() << "\n";
+    return 1;
+  }
+  GalleryFile gallery;
+  if (!gallery.open(argv[2]) || gallery.feature_count() == 0) {
+    std::cerr << "Can not open gallery " << argv[2] << "\n";
+    return 1;
+  }
+  std::cout << "ire_verify_cache started\n";
+  ire3_settings settings = {sizeof(settings), 150, 4};
+  std::vector<uint8_t> probe;
+  if (!extract_probe(image.view(), settings, probe))
+    return 1;
+
+  auto requests = make_requests(gallery.feature_count(), num_requests, skew);
+  ThreadPool pool(num_threads);
+  std::size_t failures = 0;
+  double uncached = verify(pool, gallery, probe, requests, settings, nullptr,
+                           failures);
+  std::cout << "Without cache: " << uncached << " verifications/s, "
+            << failures << " failures\n";
+
+  FeatureCache cache(cache_mb << 20);
+  double cached =
+      verify(pool, gallery, probe, requests, settings, &cache, failures);
+  std::cout << "With cache:    " << cached << " verifications/s, "
+            << failures << " failures\n";
+  std::cout << cache.stats() << "\n";
+  std::cout << "Speedup: " << (uncached > 0 ? cached / uncached : 0)
+            << "x over " << requests.size() << " verifications of "
+            << gallery.feature_count() << " users on " << pool.size()
+            << " threads\n";
+  std::cout << "ire_verify_cache ended\n";
+  return 0;
+}
@@ -0,0 +1,353 @@
+/// @file async_sessions_example.cpp
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "iris_engine_v3.h"
+#include "iris_mobile_v2.h"
+#include "image_source.h"
+#include "ire3_features.h"
+#include "irm2_session.h"
+#include "latency_stats.h"
+#include "session_tasks.h"
+#include "trace.h"
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Predefined frame width for this example.
+ */
+#define WIDTH (2336)
+/**
+ * @brief Predefined frame height for this example.
+ */
+#define HEIGHT (769)
+
+/**
+ * @brief Size of the eye crops handed to ire3, one per half of the frame.
+ */
+#define CROP_WIDTH (640)
+#define CROP_HEIGHT (480)
+
+static double ms_since(Clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+/**
+ * @brief What a session reports to the UI after every frame.
+ */
+struct Update {
+  std::size_t session;
+  irm2_ui_hints hints;
+  irm2_enrollment_info progress;
+};
+
+/**
+ * @brief Updates posted by the sessions and drained by the UI thread.
+ */
+class UiQueue {
+public:
+  void post(const Update &update) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.push_back(update);
+  }
+
+  void drain(std::vector<Update> &updates) {
+    updates.clear();
+    std::lock_guard<std::mutex> lock(mutex);
+    updates.swap(pending);
+  }
+
+private:
+  std::mutex mutex;
+  std::vector<Update> pending;
+};
+
+/**
+ * @brief Totals of one session.
+ */
+struct Outcome {
+  int rc = 0;
+  std::size_t frames = 0;
+  std::size_t enrollments = 0;
+  std::size_t extractions = 0;
+  /// From handing a frame to the engine to having its hints.
+  LatencyStats latency;
+};
+
+/**
+ * @brief Crop of eye `eye` of a frame: the center of one half.
+ */
+static ImageView eye_crop(const ImageView &frame, int eye) {
+  int half = frame.width / 2;
+  return frame.crop(eye * half + (half - CROP_WIDTH) / 2,
+                    (frame.height - CROP_HEIGHT) / 2, CROP_WIDTH,
+                    CROP_HEIGHT);
+}
+
+/**
+ * @brief One coroutine session: enrolls over and over from `rounds` frames
+ * and extracts the ire3 features of both eyes of every frame.
+ */
+Task<void> enroll_async(SessionExecutor &executor, AsyncIre3Extractor &ire3,
+                        const Irm2Config &config,
+                        const std::vector<ImageView> &frames,
+                        std::size_t id, std::size_t rounds, UiQueue &ui,
+                        Outcome &outcome) {
+  AsyncIrm2Enrollment session(executor);
+  outcome.rc = co_await session.init(config);
+  for (std::size_t r = 0; outcome.rc == 0 && r < rounds; ++r) {
+    const ImageView &frame = frames[(id + r) % frames.size()];
+    auto start = Clock::now();
+    Irm2FrameResult result = co_await session.next_frame(frame);
+    outcome.latency.add(ms_since(start));
+    ++outcome.frames;
+    ui.post({id, result.hints, result.progress});
+    for (int eye = 0; eye < 2; ++eye) {
+      Ire3ExtractResult features = co_await ire3.extract(eye_crop(frame, eye));
+      outcome.extractions += features.rc == IRE3_STATUS_OK;
+    }
+    if (result.progress.step_progress < 100)
+      continue;
+    if (result.progress.overall_progress < 100) {
+      co_await session.continue_enrollment();
+      continue;
+    }
+    Irm2Template iris_template;
+    if (co_await session.get_template(iris_template) == 0)
+      ++outcome.enrollments;
+    outcome.rc = co_await session.init(config);
+  }
+}
+
+/**
+ * @brief The same session as @ref enroll_async with blocking calls, run on
+ * a thread of its own.
+ */
+void enroll_blocking(const ire3_settings &settings, const Irm2Config &config,
+                     const std::vector<ImageView> &frames, std::size_t id,
+                     std::size_t rounds, UiQueue &ui, Outcome &outcome) {
+  Irm2Enrollment session;
+  Ire3Extractor extractor;
+  outcome.rc = extractor.init(settings);
+  if (outcome.rc == IRE3_STATUS_OK)
+    outcome.rc = session.init(config);
+  for (std::size_t r = 0; outcome.rc == 0 && r < rounds; ++r) {
+    const ImageView &frame = frames[(id + r) % frames.size()];
+    auto start = Clock::now();
+    Update update = {id};
+    {
+      TRACE_SCOPE("blocking_frame");
+      session.on_frame(frame);
+      session.ui_hints(update.hints);
+      session.progress(update.progress);
+    }
+    outcome.latency.add(ms_since(start));
+    ++outcome.frames;
+    ui.post(update);
+    FeatureSet features;
+    for (int eye = 0; eye < 2; ++eye)
+      outcome.extractions +=
+          extractor.extract(eye_crop(frame, eye), features) ==
+          IRE3_STATUS_OK;
+    if (update.progress.step_progress < 100)
+      continue;
+    if (update.progress.overall_progress < 100) {
+      session.continue_enrollment();
+      continue;
+    }
+    Irm2Template iris_template;
+    if (session.get_template(iris_template) == 0)
+      ++outcome.enrollments;
+    outcome.rc = session.init(config);
+  }
+}
+
+/**
+ * @brief What the UI thread saw of a run.
+ */
+struct UiStats {
+  std::size_t updates = 0;
+  /// Enrollments the UI showed as complete.
+  std::size_t completed = 0;
+  double longest_ms = 0;
+};
+
+/**
+ * @brief The UI thread: tracks the overall progress of every session until
+ * all sessions are done and counts the enrollments it saw complete. It
+ * never calls the engine, so the longest iteration is how long it was kept
+ * from redrawing.
+ */
+static UiStats ui_loop(UiQueue &ui, const std::atomic<std::size_t> &running,
+                       std::size_t num_sessions) {
+  UiStats stats;
+  std::vector<Update> batch;
+  std::vector<int> overall(num_sessions, 0);
+  for (bool last = false; !last;) {
+    last = running.load() == 0;
+    auto start = Clock::now();
+    ui.drain(batch);
+    for (const Update &update : batch) {
+      int progress = update.progress.overall_progress;
+      if (progress >= 100 && overall[update.session] < 100)
+        ++stats.completed;
+      overall[update.session] = progress;
+    }
+    stats.updates += batch.size();
+    stats.longest_ms = std::max(stats.longest_ms, ms_since(start));
+    if (!last)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return stats;
+}
+
+static void report(const char *name, std::size_t threads,
+                   const std::vector<Outcome> &outcomes, double seconds,
+                   const UiStats &ui) {
+  Outcome total;
+  std::size_t failed = 0;
+  for (const auto &outcome : outcomes) {
+    total.frames += outcome.frames;
+    total.enrollments += outcome.enrollments;
+    total.extractions += outcome.extractions;
+    total.latency.merge(outcome.latency);
+    failed += outcome.rc != 0;
+  }
+  std::cout << name << outcomes.size() << " sessions on " << threads
+            << " threads: " << total.frames << " frames in " << seconds * 1000
+            << " ms, " << total.frames / seconds << " frames/s, "
+            << total.extractions << " extractions, " << total.enrollments
+            << " enrollments";
+  if (failed)
+    std::cout << ", " << failed << " sessions failed";
+  std::cout << "\n  frame latency " << total.latency << "\n  UI thread: "
+            << ui.updates << " updates, " << ui.completed
+            << " enrollments shown, longest iteration " << ui.longest_ms
+            << " ms\n";
+}
+
+/**
+ * @brief Runs `num_sessions` coroutine sessions multiplexed on
+ * `num_threads` workers.
+ *
+ * @param quiet skip the report, for the warm-up.
+ */
+void run_async(const std::vector<ImageView> &frames, std::size_t num_sessions,
+               std::size_t num_threads, std::size_t rounds,
+               bool quiet = false) {
+  Irm2Config config = Irm2Config::for_frames(frames[0]);
+  ire3_settings settings = {sizeof(settings), 150, 4};
+  SessionExecutor executor(num_threads);
+  AsyncIre3Extractor ire3(executor, settings);
+  UiQueue ui;
+  std::vector<Outcome> outcomes(num_sessions);
+  std::atomic<std::size_t> running{num_sessions};
+
+  auto start = Clock::now();
+  for (std::size_t i = 0; i < num_sessions; ++i)
+    executor.spawn(enroll_async(executor, ire3, config, frames, i, rounds, ui,
+                                outcomes[i]),
+                   [&running] { --running; });
+  UiStats ui_stats = ui_loop(ui, running, num_sessions);
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  if (!quiet)
+    report("Coroutines:        ", executor.size(), outcomes, seconds,
+           ui_stats);
+}
+
+/**
+ * @brief Runs `num_sessions` sessions on a thread each.
+ *
+ * @param quiet skip the report, for the warm-up.
+ */
+void run_threads(const std::vector<ImageView> &frames,
+                 std::size_t num_sessions, std::size_t rounds,
+                 bool quiet = false) {
+  Irm2Config config = Irm2Config::for_frames(frames[0]);
+  ire3_settings settings = {sizeof(settings), 150, 4};
+  UiQueue ui;
+  std::vector<Outcome> outcomes(num_sessions);
+  std::atomic<std::size_t> running{num_sessions};
+
+  auto start = Clock::now();
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < num_sessions; ++i)
+    threads.emplace_back([&, i] {
+      Trace::instance().set_thread_name("session " + std::to_string(i));
+      enroll_blocking(settings, config, frames, i, rounds, ui, outcomes[i]);
+      --running;
+    });
+  UiStats ui_stats = ui_loop(ui, running, num_sessions);
+  for (auto &thread : threads)
+    thread.join();
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  if (!quiet)
+    report("Thread per session:", num_sessions, outcomes, seconds, ui_stats);
+}
+
+/**
+ * @brief Entry point of the example.
+ *
+ * Requires a binary file with consecutive RAW frames of size @ref WIDTH x
+ * @ref HEIGHT. Optionally takes the number of sessions, the number of
+ * worker threads of the coroutine sessions and the number of frames fed to
+ * every session.
+ *
+ * Every session enrolls both eyes of the frames, starting over once an
+ * enrollment completes, and extracts the ire3 features of both eyes of
+ * every frame. The sessions run twice: as coroutines awaiting
+ * `next_frame` and `extract` on a few workers, and with blocking calls on
+ * a thread per session. In both runs the main thread plays the UI and only
+ * collects the hints the sessions post; the comparison shows the
+ * throughput and frame latency of both designs and how long the UI thread
+ * was ever held up. A short untimed pass of both designs runs first, so
+ * neither timed run pays for faulting in the recording and the engine.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 5) {
+    std::cerr << "Usage: " << argv[0]
+              << " frames [sessions] [threads] [rounds]\n";
+    return 1;
+  }
+  std::size_t num_sessions = argc > 2 ? std::stoul(argv[2]) : 64;
+  std::size_t num_threads =
+      argc > 3 ? std::stoul(argv[3])
+               : std::max(1u, std::thread::hardware_concurrency());
+  std::size_t rounds = argc > 4 ? std::stoul(argv[4]) : 30;
+  num_sessions = std::max<std::size_t>(1, num_sessions);
+  num_threads = std::max<std::size_t>(1, num_threads);
+
+  std::error_code error;
+  auto file_size = std::filesystem::file_size(argv[1], error);
+  std::size_t num_frames =
+      error ? 0 : file_size / ((std::size_t)WIDTH * HEIGHT);
+  MappedImage recording;
+  if (num_frames == 0 ||
+      !recording.open_raw(argv[1], WIDTH, HEIGHT * (int)num_frames)) {
+    std::cerr << "Can not read input file: "
+              << (num_frames ? recording.error() : "no complete frame")
+              << "\n";
+    return 1;
+  }
+  std::vector<ImageView> frames;
+  for (std::size_t f = 0; f < num_frames; ++f)
+    frames.push_back(recording.view().crop(0, (int)f * HEIGHT, WIDTH, HEIGHT));
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::size_t warm_up = std::min(rounds, frames.size());
+  run_async(frames, num_sessions, num_threads, warm_up, true);
+  run_threads(frames, num_sessions, warm_up, true);
+  run_async(frames, num_sessions, num_threads, rounds);
+  run_threads(frames, num_sessions, rounds);
+  return 0;
+}
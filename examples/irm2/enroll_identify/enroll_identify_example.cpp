@@ -3,27 +3,35 @@
 #include <iomanip>
 #include <vector>
 #include <cstring>
-#include <fstream>
 
 #include "iris_mobile_v2.h"
 #include "utils.h"
+#include "buffer_pool.h"
+#include "image_source.h"
+#include "trace.h"
 
 void on_score(void *user_context, int i_template, int score) {
+  trace_instant("on_score", score);
   std::cerr << "Scores for template " << i_template << ": " << score << "\n";
 }
 
 class Context {
 public:
-  explicit Context(std::size_t size) : size(size) {
-    memory = (uint8_t *)malloc(size);
-  }
-  ~Context() { free(memory); }
+  explicit Context(std::size_t size)
+      : buffer(BufferPool::local().acquire(size)), size(size) {}
+
+  Context(const Context &) = delete;
+  Context &operator=(const Context &) = delete;
 
+  PooledBuffer buffer;
   std::size_t size;
-  uint8_t *memory = nullptr;
 };
 
-#define BUFFER_SIZE (1000 * 1000)
+/**
+ * @brief Bound on the frames of the enrollment and of the identification;
+ * the loops would never end on input the engine can not use.
+ */
+#define MAX_FRAMES (300)
 
 /**
  * @brief Demonstrates the simple enroll/identify pipeline for 2 eyes.
@@ -58,21 +66,30 @@ void enroll_identify(uint8_t *pixels, int width, int height) {
       (int)width // stride
   };
 
-  auto rc = irm2_init_enrollment(enrollment_context.memory,
+  auto rc = irm2_init_enrollment(enrollment_context.buffer.data(),
                                  enrollment_context.size, num_eyes, &s);
 
   // The enrollment loop evaluates N steps, every step is
   // a loop which performs until counting the `num_updates`
   // successfull template updates to ensure the consistent enrollment.
+  int frames = 0;
   for (;;) {
     for (int i = 0;; ++i) {
+      if (++frames > MAX_FRAMES) {
+        std::cerr << "Enrollment does not converge in " << MAX_FRAMES
+                  << " frames\n";
+        return;
+      }
       // Process single frame.
       auto on_frame_rc =
-          irm2_on_frame(enrollment_context.memory, pixels, rotation);
-      auto hints_rc = irm2_get_ui_hints(enrollment_context.memory, &ui_hints,
-                                        sizeof(ui_hints));
-      auto enr_info_rc = irm2_get_enrollment_info(enrollment_context.memory,
-                                                  &enr_info, sizeof(enr_info));
+          TRACE_CALL(irm2_on_frame, enrollment_context.buffer.data(), pixels,
+                     rotation);
+      auto hints_rc =
+          TRACE_CALL(irm2_get_ui_hints, enrollment_context.buffer.data(),
+                     &ui_hints, sizeof(ui_hints));
+      auto enr_info_rc =
+          TRACE_CALL(irm2_get_enrollment_info, enrollment_context.buffer.data(),
+                     &enr_info, sizeof(enr_info));
 
       std::cout << "Iteration: " << std::dec << i << ": " << std::hex
                 << "on frame returns " << on_frame_rc << "\n";
@@ -86,17 +103,20 @@ void enroll_identify(uint8_t *pixels, int width, int height) {
     }
     if (enr_info.overall_progress == 100)
       break;
-    irm2_continue_enrollment(enrollment_context.memory);
+    irm2_continue_enrollment(enrollment_context.buffer.data());
   }
 
   // Get the template
   uint8_t iris_template[IRM2_TEMPLATE_SIZE];
-  irm2_get_template(enrollment_context.memory, iris_template,
+  irm2_get_template(enrollment_context.buffer.data(), iris_template,
                     IRM2_TEMPLATE_SIZE);
+  // Hand the enrollment context back to the pool, the identification context
+  // below has the same size and reuses it.
+  enrollment_context.buffer.reset();
 
   Context identification_context(IRM2_GET_CONTEXT_SIZE(1, width, height));
   const uint8_t *iris_template_pointer[] = {&iris_template[0]};
-  rc = irm2_init_identification(identification_context.memory,
+  rc = irm2_init_identification(identification_context.buffer.data(),
                                 identification_context.size,
                                 iris_template_pointer, 1, 100, &s);
   if (rc) {
@@ -105,12 +125,18 @@ void enroll_identify(uint8_t *pixels, int width, int height) {
   }
 
   for (int i = 0;; ++i) {
+    if (i == MAX_FRAMES) {
+      std::cerr << "No identification result in " << MAX_FRAMES
+                << " frames\n";
+      return;
+    }
     // Process single frame.
-    auto on_frame_rc =
-        irm2_on_frame(identification_context.memory, pixels, rotation);
+    auto on_frame_rc = TRACE_CALL(
+        irm2_on_frame, identification_context.buffer.data(), pixels, rotation);
     int template_id = -1;
-    auto result_rc = irm2_get_identification_result(
-        identification_context.memory, &template_id);
+    auto result_rc =
+        TRACE_CALL(irm2_get_identification_result,
+                   identification_context.buffer.data(), &template_id);
     std::cout << "on frame returns: " << std::hex << on_frame_rc
               << " result returns: " << result_rc
               << "; result template: " << std::dec << template_id << "\n";
@@ -144,18 +170,15 @@ int main(int argc, char *argv[]) {
     return 1;
   }
   std::string file(argv[1]);
-  unsigned int width = WIDTH;   // Width of frame or image in pixels
-  unsigned int height = HEIGHT; // Height of frame or image in pixels
-  unsigned int depth = 0;
-
-  std::vector<char> buf(width * height);
-  std::ifstream in(file, std::ios_base::in | std::ios_base::binary);
-  if (!in.is_open()) {
-    std::cerr << "Can not open input file.\n";
+  // The frame is used in place from the mapped file.
+  MappedImage image;
+  if (!image.open_raw(file, WIDTH, HEIGHT)) {
+    std::cerr << "Can not read input file: " << image.error() << "\n";
     return 1;
   }
-  in.read(buf.data(), width * height);
 
-  enroll_identify((uint8_t *)buf.data(), width, height);
+  enroll_identify(image.view().pixels, image.view().width,
+                  image.view().height);
+  std::cout << BufferPool::local().stats() << "\n";
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,225 @@
+/// @file frame_pipeline_example.cpp
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "iris_mobile_v2.h"
+#include "frame_change.h"
+#include "frame_ring.h"
+#include "irm2_session.h"
+#include "latency_stats.h"
+#include "trace.h"
+#include "utils.h"
+
+void on_score(void *user_context, int i_template, int score) {
+  trace_instant("on_score", score);
+  std::cerr << "Scores for template " << i_template << ": " << score << "\n";
+}
+
+/**
+ * @brief Predefined image width for this example.
+ *
+ */
+#define WIDTH (2336)
+/**
+ * @brief Predefined image height for this example.
+ *
+ */
+#define HEIGHT (769)
+
+/**
+ * @brief Rows of the ring buffers are padded to a cache line multiple.
+ */
+#define STRIDE ((WIDTH + 63) / 64 * 64)
+
+/**
+ * @brief Stand-in camera: reads consecutive RAW frames from a file or stdin
+ * into the ring, optionally paced at a fixed frame rate.
+ *
+ * @param in source stream.
+ * @param ring destination ring.
+ * @param fps frame rate, 0 to read as fast as possible.
+ * @param loops number of passes over a seekable file.
+ * @param stop set by the consumer when it needs no more frames.
+ */
+void capture(FILE *in, FrameRing &ring, double fps, int loops,
+             const std::atomic<bool> &stop) {
+  auto period = std::chrono::duration<double>(fps > 0 ? 1 / fps : 0);
+  auto next = std::chrono::steady_clock::now();
+  Trace::instance().set_thread_name("camera");
+  for (int loop = 0; loop < loops; ++loop) {
+    if (loop > 0 && fseek(in, 0, SEEK_SET) != 0)
+      break;
+    while (!stop) {
+      Frame *frame = ring.begin_write();
+      bool ok = true;
+      {
+        TRACE_SCOPE("read_frame");
+        for (int y = 0; ok && y < frame->height; ++y)
+          ok = fread(frame->pixels + (std::size_t)y * frame->stride,
+                     frame->width, 1, in) == 1;
+      }
+      if (!ok) {
+        ring.cancel_write(frame);
+        break;
+      }
+      if (fps > 0) {
+        next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            period);
+        std::this_thread::sleep_until(next);
+      }
+      ring.end_write(frame);
+    }
+  }
+  ring.close();
+}
+
+/**
+ * @brief Runs enrollment followed by identification on the frames of the
+ * ring as fast as the engine allows.
+ *
+ * Frames that barely differ from the last processed one are not passed to
+ * the engine; the previous hints and result still hold for them.
+ *
+ * @param ring source of frames.
+ * @param change sensitivity of the unchanged frame detection.
+ * @return false if the stream ended before an identification result.
+ */
+bool process(FrameRing &ring, const FrameChangeSettings &change) {
+  Irm2Config config;
+  config.width = WIDTH;
+  config.height = HEIGHT;
+  config.stride = STRIDE; // stride of the ring buffers
+  config.on_score = on_score;
+  uint32_t rotation = 0;
+  Irm2Enrollment enrollment;
+  Irm2Identification identification;
+  Irm2Template iris_template;
+  const uint8_t *iris_template_pointer[] = {iris_template.data()};
+  irm2_enrollment_info enr_info = {0};
+  irm2_ui_hints ui_hints = {0};
+  bool enrolled = false;
+  bool identified = false;
+
+  auto rc = enrollment.init(config);
+  if (rc) {
+    std::cerr << "Enrollment init fails: " << std::hex << rc << "\n";
+    return false;
+  }
+
+  Trace::instance().set_thread_name("process");
+  FrameChangeDetector detector(change);
+  LatencyStats queued, latency;
+  while (Frame *frame = ring.begin_read()) {
+    TRACE_SCOPE("frame");
+    ImageView view = {frame->pixels, frame->width, frame->height,
+                      frame->stride};
+    auto start = std::chrono::steady_clock::now();
+    queued.add(std::chrono::duration<double, std::milli>(start - frame->arrival)
+                   .count());
+    bool changed;
+    {
+      TRACE_SCOPE("frame_change");
+      changed = detector.changed(view);
+    }
+    if (!changed) {
+      // Nothing to do, ui_hints and enr_info are those of the last frame.
+    } else if (!enrolled) {
+      TRACE_CALL(enrollment.on_frame, view, rotation);
+      TRACE_CALL(enrollment.ui_hints, ui_hints);
+      TRACE_CALL(enrollment.progress, enr_info);
+      if (enr_info.step_progress == 100) {
+        if (enr_info.overall_progress == 100) {
+          enrollment.get_template(iris_template);
+          rc = identification.init(config, iris_template_pointer, 1, 100);
+          if (rc) {
+            std::cerr << "Identification init fails: " << std::hex << rc
+                      << "\n";
+            ring.end_read(frame);
+            return false;
+          }
+          enrolled = true;
+          std::cout << "Enrolled at frame " << frame->sequence << "\n";
+        } else {
+          enrollment.continue_enrollment();
+        }
+        // The engine moved on, the next frame is new work whatever it shows.
+        detector.reset();
+      }
+    } else {
+      auto on_frame_rc = TRACE_CALL(identification.on_frame, view, rotation);
+      if (on_frame_rc == 0) {
+        int template_id = -1;
+        TRACE_CALL(identification.identification_result, template_id);
+        std::cout << "Identified template " << template_id << " at frame "
+                  << frame->sequence << "\n";
+        identified = true;
+      }
+    }
+    latency.add(std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - frame->arrival)
+                    .count());
+    ring.end_read(frame);
+    if (identified)
+      break;
+  }
+
+  auto stats = ring.get_stats();
+  std::cout << "Frames: " << stats.produced << " captured, " << stats.consumed
+            << " processed, " << stats.dropped_stale << " dropped stale, "
+            << stats.dropped_overrun << " dropped on overrun\n";
+  std::cout << "Queue age:         " << queued << "\n";
+  std::cout << "Arrival -> result: " << latency << "\n";
+  std::cout << detector.stats() << "\n";
+  return identified;
+}
+
+/**
+ * @brief Entry point of the example.
+ *
+ * Requires a binary file with consecutive RAW frames of size @ref WIDTH x
+ * @ref HEIGHT, or `-` to read them from stdin. Optionally takes the camera
+ * frame rate (0 for unpaced), the number of passes over the file, the number
+ * of ring slots, the frame policy (`latest` or `fifo`) and the grey level
+ * change of a block that makes a frame new work (0 to process every frame).
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 7) {
+    std::cerr << "Usage: " << argv[0]
+              << " frames|- [fps] [loops] [slots] [latest|fifo] "
+                 "[change_threshold]\n";
+    return 1;
+  }
+  std::string file(argv[1]);
+  double fps = argc > 2 ? std::stod(argv[2]) : 30;
+  int loops = argc > 3 ? std::stoi(argv[3]) : 1;
+  std::size_t slots = argc > 4 ? std::stoul(argv[4]) : 4;
+  auto policy = argc > 5 && std::string(argv[5]) == "fifo"
+                    ? FrameRing::Policy::Fifo
+                    : FrameRing::Policy::Latest;
+  FrameChangeSettings change;
+  if (argc > 6)
+    change.block_threshold = std::stoi(argv[6]);
+
+  FILE *in = file == "-" ? stdin : fopen(file.c_str(), "rb");
+  if (!in) {
+    std::cerr << "Can not open input file.\n";
+    return 1;
+  }
+
+  FrameRing ring(slots, WIDTH, HEIGHT, STRIDE, policy);
+  std::atomic<bool> stop{false};
+  std::thread camera(capture, in, std::ref(ring), fps, in == stdin ? 1 : loops,
+                     std::cref(stop));
+  bool ok = process(ring, change);
+  // The camera stops at the next frame boundary.
+  stop = true;
+  camera.join();
+  if (in != stdin)
+    fclose(in);
+  return ok ? 0 : 1;
+}
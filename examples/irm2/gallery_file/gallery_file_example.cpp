@@ -0,0 +1,200 @@
+/// @file gallery_file_example.cpp
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include "iris_mobile_v2.h"
+#include "buffer_pool.h"
+#include "gallery_file.h"
+#include "image_source.h"
+#include "utils.h"
+
+void on_score(void *user_context, int i_template, int score) {
+  std::cerr << "Scores for template " << i_template << ": " << score << "\n";
+}
+
+class Context {
+public:
+  explicit Context(std::size_t size)
+      : buffer(BufferPool::local().acquire(size)), size(size) {}
+
+  Context(const Context &) = delete;
+  Context &operator=(const Context &) = delete;
+
+  PooledBuffer buffer;
+  std::size_t size;
+};
+
+/**
+ * @brief Bound on the frames of the enrollment and of the identification;
+ * the loops would never end on input the engine can not use.
+ */
+#define MAX_FRAMES (300)
+
+/**
+ * @brief Enrolls both eyes of the frame and stores `copies` copies of the
+ * template in a new gallery file.
+ *
+ * @param pixels is the poiter to the image pixels.
+ * @param s engine settings.
+ * @param gallery output gallery file name.
+ * @param copies number of gallery records to write.
+ * @return true on success.
+ */
+bool enroll_to_gallery(uint8_t *pixels, const irm2_settings &s,
+                       const std::string &gallery, uint32_t copies) {
+  Context ctx(IRM2_GET_CONTEXT_SIZE(1, s.width, s.height));
+  irm2_enrollment_info enr_info = {0};
+  uint32_t num_eyes = 2;
+  uint32_t rotation = 0;
+
+  auto rc = irm2_init_enrollment(ctx.buffer.data(), ctx.size, num_eyes, &s);
+  if (rc) {
+    std::cerr << "Enrollment init fails: " << std::hex << rc << "\n";
+    return false;
+  }
+  int frames = 0;
+  for (;;) {
+    do {
+      if (++frames > MAX_FRAMES) {
+        std::cerr << "Enrollment does not converge in " << MAX_FRAMES
+                  << " frames\n";
+        return false;
+      }
+      irm2_on_frame(ctx.buffer.data(), pixels, rotation);
+      irm2_get_enrollment_info(ctx.buffer.data(), &enr_info, sizeof(enr_info));
+    } while (enr_info.step_progress != 100);
+    if (enr_info.overall_progress == 100)
+      break;
+    irm2_continue_enrollment(ctx.buffer.data());
+  }
+
+  uint8_t iris_template[IRM2_TEMPLATE_SIZE];
+  irm2_get_template(ctx.buffer.data(), iris_template, IRM2_TEMPLATE_SIZE);
+
+  GalleryFileWriter writer;
+  if (!writer.open(gallery, IRM2_TEMPLATE_SIZE))
+    return false;
+  for (uint32_t i = 0; i < copies; ++i)
+    writer.add_irm2_template(iris_template, i);
+  return writer.finish();
+}
+
+/**
+ * @brief Identifies the frame against the templates of a mapped gallery.
+ *
+ * The templates are used in place, nothing is copied to the heap.
+ *
+ * @param pixels is the poiter to the image pixels.
+ * @param s engine settings.
+ * @param gallery gallery file name.
+ */
+void identify_from_gallery(uint8_t *pixels, const irm2_settings &s,
+                           const std::string &gallery) {
+  auto start = std::chrono::steady_clock::now();
+  GalleryFile file;
+  if (!file.open(gallery)) {
+    std::cerr << "Can not open gallery " << gallery << "\n";
+    return;
+  }
+  if (file.template_size() != IRM2_TEMPLATE_SIZE) {
+    std::cerr << "Gallery template size does not match the library.\n";
+    return;
+  }
+  file.will_need();
+  auto templates = file.irm2_template_pointers();
+  auto mapped = std::chrono::steady_clock::now();
+  std::cout << "Gallery of " << templates.size() << " templates mapped in "
+            << std::chrono::duration<double, std::milli>(mapped - start).count()
+            << " ms\n";
+
+  Context identification_context(IRM2_GET_CONTEXT_SIZE(1, s.width, s.height));
+  auto rc = irm2_init_identification(
+      identification_context.buffer.data(), identification_context.size,
+      templates.data(), (int)templates.size(), 100, &s);
+  if (rc) {
+    std::cerr << "Identification init fails: " << std::hex << rc << "\n";
+    return;
+  }
+  std::cout << "Identification ready in "
+            << std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << " ms\n";
+
+  for (int i = 0;; ++i) {
+    if (i == MAX_FRAMES) {
+      std::cerr << "No identification result in " << MAX_FRAMES
+                << " frames\n";
+      return;
+    }
+    auto on_frame_rc =
+        irm2_on_frame(identification_context.buffer.data(), pixels, 0);
+    int template_id = -1;
+    auto result_rc = irm2_get_identification_result(
+        identification_context.buffer.data(), &template_id);
+    if (on_frame_rc == 0) {
+      std::cout << "Iteration " << i << ": result returns " << std::hex
+                << result_rc << std::dec << "; result template: "
+                << template_id << " (id "
+                << (template_id >= 0 ? (int)file.template_id(template_id) : -1)
+                << ")\n";
+      break;
+    }
+  }
+}
+
+/**
+ * @brief Predefined image width for this example.
+ *
+ */
+#define WIDTH (2336)
+/**
+ * @brief Predefined image height for this example.
+ *
+ */
+#define HEIGHT (769)
+
+/**
+ * @brief Entry point of the example.
+ *
+ * Requires the binary file with RAW frame of size @ref WIDTH x @ref HEIGHT and
+ * the gallery file name. If the gallery does not exist yet it is created by
+ * enrolling the frame, optionally with the given number of template copies.
+ * Subsequent runs only map the gallery.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 3 || argc > 4) {
+    std::cerr << "Usage: " << argv[0] << " frame gallery [copies]\n";
+    return 1;
+  }
+  std::string file(argv[1]);
+  std::string gallery(argv[2]);
+  uint32_t copies = argc > 3 ? std::stoul(argv[3]) : 1;
+  MappedImage image;
+  if (!image.open_raw(file, WIDTH, HEIGHT)) {
+    std::cerr << "Can not read input file: " << image.error() << "\n";
+    return 1;
+  }
+  const ImageView &frame = image.view();
+  uint8_t *pixels = frame.pixels;
+
+  irm2_settings s = {
+      sizeof(s), frame.width, frame.height, 3500, 160, NULL,
+      on_score,  NULL,        NULL, IRM2_FLAG_NONE, NULL,
+      frame.stride // stride
+  };
+
+  if (!std::ifstream(gallery).good()) {
+    std::cout << "Creating gallery " << gallery << "\n";
+    if (!enroll_to_gallery(pixels, s, gallery, copies)) {
+      std::cerr << "Can not create gallery.\n";
+      return 1;
+    }
+  }
+  identify_from_gallery(pixels, s, gallery);
+  std::cout << BufferPool::local().stats() << "\n";
+  return 0;
+}
@@ -0,0 +1,147 @@
+/// @file gallery_manager_example.cpp
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "iris_mobile_v2.h"
+#include "gallery_file.h"
+#include "image_source.h"
+#include "irm2_gallery_manager.h"
+#include "latency_stats.h"
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Predefined frame width for this example.
+ */
+#define WIDTH (2336)
+/**
+ * @brief Predefined frame height for this example.
+ */
+#define HEIGHT (769)
+
+double elapsed_ms(Clock::time_point from, Clock::time_point to) {
+  return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+/**
+ * @brief Entry point of the example.
+ *
+ * Requires a gallery file with irm2 templates, e.g. written by
+ * gallery_file_example, and a binary file with consecutive RAW frames of
+ * size @ref WIDTH x @ref HEIGHT. Optionally takes the number of templates
+ * enrolled while identifying, the shard capacity and the delta limit.
+ *
+ * An identification thread processes the frames in a loop while the main
+ * thread enrolls and deletes users; the per-frame latency shows that
+ * updates never stall identification. For comparison, the time to
+ * re-initialize a single context with the whole gallery is what every
+ * enrollment would cost without the manager.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 3 || argc > 6) {
+    std::cerr << "Usage: " << argv[0]
+              << " gallery_file frames [adds] [shard_capacity] "
+                 "[delta_limit]\n";
+    return 1;
+  }
+  std::size_t adds = argc > 3 ? std::stoul(argv[3]) : 500;
+  std::size_t shard_capacity =
+      argc > 4 ? std::stoul(argv[4]) : GALLERY_SHARD_CAPACITY;
+  std::size_t delta_limit = argc > 5 ? std::stoul(argv[5]) : GALLERY_DELTA_LIMIT;
+
+  GalleryFile file;
+  if (!file.open(argv[1]) || file.template_count() == 0 ||
+      file.template_size() != IRM2_TEMPLATE_SIZE) {
+    std::cerr << "Can not open gallery " << argv[1]
+              << " or it has no irm2 templates of this library.\n";
+    return 1;
+  }
+  std::error_code error;
+  auto file_size = std::filesystem::file_size(argv[2], error);
+  std::size_t num_frames =
+      error ? 0 : file_size / ((std::size_t)WIDTH * HEIGHT);
+  MappedImage recording;
+  if (num_frames == 0 ||
+      !recording.open_raw(argv[2], WIDTH, HEIGHT * (int)num_frames)) {
+    std::cerr << "Can not read input file: "
+              << (num_frames ? recording.error() : "no complete frame")
+              << "\n";
+    return 1;
+  }
+
+  Irm2Config config;
+  config.width = WIDTH;
+  config.height = HEIGHT;
+
+  // What an enrollment costs without sharding: a new context for the whole
+  // gallery, during which identification has no context to run on.
+  auto templates = file.irm2_template_pointers();
+  Irm2Identification single;
+  auto start = Clock::now();
+  int rc = single.init(config, templates.data(), (int)templates.size(), 100);
+  double reinit_ms = elapsed_ms(start, Clock::now());
+  if (rc) {
+    std::cerr << "Identification init fails: " << std::hex << rc << "\n";
+    return 1;
+  }
+
+  ThreadPool pool;
+  Irm2GalleryManager gallery(config, 100, &pool, shard_capacity, delta_limit);
+  start = Clock::now();
+  for (std::size_t i = 0; i < file.template_count(); ++i)
+    gallery.add(file.irm2_template(i), file.template_id(i));
+  if ((rc = gallery.flush()) != 0) {
+    std::cerr << "Gallery shards can not be built: " << std::hex << rc
+              << "\n";
+    return 1;
+  }
+  std::cout << "Loaded in " << elapsed_ms(start, Clock::now()) << " ms. "
+            << gallery.stats() << "\n";
+
+  std::atomic<bool> stop{false};
+  std::size_t identified = 0;
+  LatencyStats latency;
+  std::thread identification([&] {
+    for (std::size_t f = 0; !stop; f = (f + 1) % num_frames) {
+      ImageView frame =
+          recording.view().crop(0, (int)(f * HEIGHT), WIDTH, HEIGHT);
+      uint32_t id = 0;
+      auto before = Clock::now();
+      if (gallery.identify(frame, 0, id) == 0)
+        ++identified;
+      latency.add(elapsed_ms(before, Clock::now()));
+    }
+  });
+
+  // New users are enrolled one by one; every tenth enrollment also deletes
+  // an earlier user.
+  uint32_t next_id = 1000000;
+  start = Clock::now();
+  for (std::size_t i = 0; i < adds; ++i) {
+    gallery.add(file.irm2_template(i % file.template_count()), next_id + i);
+    if (i % 10 == 9)
+      gallery.remove(next_id + i - 5);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  rc = gallery.flush();
+  double update_ms = elapsed_ms(start, Clock::now());
+  stop = true;
+  identification.join();
+  if (rc)
+    std::cerr << "Updates not applied: " << std::hex << rc << std::dec
+              << "\n";
+
+  std::cout << adds << " enrollments applied in " << update_ms << " ms. "
+            << gallery.stats() << "\n";
+  std::cout << "Identification during updates: " << latency.count()
+            << " frames, " << identified << " identified, " << latency
+            << "\n";
+  std::cout << "Full re-initialization of " << templates.size()
+            << " templates: " << reinit_ms << " ms per enrollment\n";
+  return 0;
+}
@@ -6,7 +6,10 @@
 #include "iris_mobile_v2.h"
 #include "iris_mobile_v2_capture.h"
 #include "iris_image_record.h"
-#include "utils.h"
+#include "async_writer.h"
+#include "buffer_pool.h"
+#include "image_source.h"
+#include "kind7_encoder.h"
 
 void on_score(void *user_context, int i_template, int score) {
   std::cout << "Scores for template " << i_template << ": " << score << "\n";
@@ -14,16 +17,22 @@ void on_score(void *user_context, int i_template, int score) {
 
 class Context {
 public:
-  explicit Context(std::size_t size) : size(size) {
-    memory = (uint8_t *)malloc(size);
-  }
-  ~Context() { free(memory); }
+  explicit Context(std::size_t size)
+      : buffer(BufferPool::local().acquire(size)), size(size) {}
+
+  Context(const Context &) = delete;
+  Context &operator=(const Context &) = delete;
 
+  PooledBuffer buffer;
   std::size_t size;
-  uint8_t *memory = nullptr;
 };
 
-#define BUFFER_SIZE (1000 * 1000)
+/**
+ * @brief Bound on the frames of the enrollment and of the capture;
+ * the loops would never end on input the engine can not use.
+ */
+#define MAX_FRAMES (300)
+
 /**
  * @brief Predefined image width for this example.
  *
@@ -72,17 +81,23 @@ void enroll_identify_1_eye(uint8_t *pixels, int width, int height) {
   };
 
   // Initialize enrollment context with all settings.
-  auto rc = irm2_init_enrollment(ctx.memory, ctx.size, num_eyes, &s);
+  auto rc = irm2_init_enrollment(ctx.buffer.data(), ctx.size, num_eyes, &s);
   // TODO propper comment here
+  int frames = 0;
   for (;;) {
     for (int i = 0;; ++i) {
+      if (++frames > MAX_FRAMES) {
+        std::cerr << "Enrollment does not converge in " << MAX_FRAMES
+                  << " frames\n";
+        return;
+      }
       // Process single frame.
-      auto on_frame_rc = irm2_on_frame(ctx.memory, pixels, rotation);
+      auto on_frame_rc = irm2_on_frame(ctx.buffer.data(), pixels, rotation);
 
       auto hints_rc =
-          irm2_get_ui_hints(ctx.memory, &ui_hints, sizeof(ui_hints));
+          irm2_get_ui_hints(ctx.buffer.data(), &ui_hints, sizeof(ui_hints));
       auto info_rc =
-          irm2_get_capture_info(ctx.memory, &enr_info, sizeof(enr_info));
+          irm2_get_capture_info(ctx.buffer.data(), &enr_info, sizeof(enr_info));
 
       std::cout << "Iteration: " << std::dec << i << ": " << std::hex
                 << "on frame returns " << on_frame_rc << "\n";
@@ -96,18 +111,21 @@ void enroll_identify_1_eye(uint8_t *pixels, int width, int height) {
     }
     if (enr_info.overall_progress == 100)
       break;
-    irm2_continue_enrollment(ctx.memory);
+    irm2_continue_enrollment(ctx.buffer.data());
   }
 
   // Get the template
   uint8_t iris_template[IRM2_TEMPLATE_SIZE];
-  irm2_get_template(ctx.memory, iris_template, IRM2_TEMPLATE_SIZE);
+  irm2_get_template(ctx.buffer.data(), iris_template, IRM2_TEMPLATE_SIZE);
+  // Hand the enrollment context back to the pool, the identification context
+  // below has the same size and reuses it.
+  ctx.buffer.reset();
 
   // Initialize identification context with all settings.
   Context identification_context(IRM2_GET_CONTEXT_SIZE(1, width, height));
   const uint8_t *const templates[1] = {iris_template};
   const uint8_t *iris_template_pointer[] = {&iris_template[0]};
-  rc = irm2_init_identification(identification_context.memory,
+  rc = irm2_init_identification(identification_context.buffer.data(),
                                 identification_context.size,
                                 iris_template_pointer, 1, 100, &s);
   if (rc) {
@@ -116,10 +134,11 @@ void enroll_identify_1_eye(uint8_t *pixels, int width, int height) {
   }
 
   // Check one frame
-  auto on_frame_rc = irm2_on_frame(identification_context.memory, pixels, 0);
+  auto on_frame_rc =
+      irm2_on_frame(identification_context.buffer.data(), pixels, 0);
   int template_id = -1;
-  auto result_rc = irm2_get_identification_result(identification_context.memory,
-                                                  &template_id);
+  auto result_rc = irm2_get_identification_result(
+      identification_context.buffer.data(), &template_id);
   std::cout << "on frame returns: " << std::hex << on_frame_rc
             << " result returns: " << result_rc
             << "; result template: " << std::dec << template_id << "\n";
@@ -132,9 +151,11 @@ void enroll_identify_1_eye(uint8_t *pixels, int width, int height) {
  * @param width image width.
  * @param height image height.
  * @param name_prefix prefix to save the files produced by function.
+ * @param writer saves the files without blocking the capture.
  */
 void capture_kind7_jpeg2000(uint8_t *pixels, int width, int height,
-                            const std::string &name_prefix) {
+                            const std::string &name_prefix,
+                            AsyncWriter &writer) {
   // Allocate context of proper size
   Context ctx(IRM2_GET_CAPTURE_CONTEXT_SIZE(width, height));
   // Variables for output information
@@ -170,7 +191,7 @@ void capture_kind7_jpeg2000(uint8_t *pixels, int width, int height,
                               // enrolment consistency.
                               num_updates, -1, -1, -1, -1, -1, -1};
   // Intitializing of the contest for operation.
-  auto rc = irm2_init_capture(ctx.memory, ctx.size, num_eyes, &s, &cs);
+  auto rc = irm2_init_capture(ctx.buffer.data(), ctx.size, num_eyes, &s, &cs);
   if (rc) {
     std::cout << "Capture init fails: " << std::hex << rc << "\n";
     return;
@@ -179,12 +200,18 @@ void capture_kind7_jpeg2000(uint8_t *pixels, int width, int height,
   // The capture loop performs until counting the `num_updates`
   // successfull template updates to ensure the consistent enrollment.
   for (int i = 0;; ++i) {
+    if (i == MAX_FRAMES) {
+      std::cerr << "Capture does not converge in " << MAX_FRAMES
+                << " frames\n";
+      return;
+    }
     // Process single frame.
-    auto on_frame_rc = irm2_on_frame(ctx.memory, pixels, rotation);
+    auto on_frame_rc = irm2_on_frame(ctx.buffer.data(), pixels, rotation);
 
-    auto hints_rc = irm2_get_ui_hints(ctx.memory, &ui_hints, sizeof(ui_hints));
+    auto hints_rc =
+        irm2_get_ui_hints(ctx.buffer.data(), &ui_hints, sizeof(ui_hints));
     auto info_rc =
-        irm2_get_capture_info(ctx.memory, &enr_info, sizeof(enr_info));
+        irm2_get_capture_info(ctx.buffer.data(), &enr_info, sizeof(enr_info));
 
     std::cout << "Iteration: " << std::dec << i << ": " << std::hex
               << "on frame returns " << on_frame_rc << "\n";
@@ -196,113 +223,103 @@ void capture_kind7_jpeg2000(uint8_t *pixels, int width, int height,
       break;
   }
 
-  // Allocate space for result image.
-  uint8_t cropped[IRM2_CROPPED_WIDTH * IRM2_CROPPED_HEIGHT] = {0};
+  // Result images come from the pool and are handed over to the writer, which
+  // saves them on its own thread.
+  const int cropped_size = IRM2_CROPPED_WIDTH * IRM2_CROPPED_HEIGHT;
+  PooledBuffer kind7 = BufferPool::local().acquire(cropped_size);
+  PooledBuffer kind3 = BufferPool::local().acquire(cropped_size);
   // Extract kind 7 type of image
-  rc = irm2_get_kind7_image(ctx.memory, IRM2_EYE_UNDEF, IRM2_CROPPED_WIDTH,
-                            IRM2_CROPPED_HEIGHT, cropped);
-
-  // Save kind 7 image
-  std::string name(name_prefix);
-  name.replace(name.find(".pgm"), 4, "_kind7.pgm");
-  write_pgm(name.c_str(), cropped, IRM2_CROPPED_WIDTH, IRM2_CROPPED_HEIGHT);
+  rc = irm2_get_kind7_image(ctx.buffer.data(), IRM2_EYE_UNDEF,
+                            IRM2_CROPPED_WIDTH, IRM2_CROPPED_HEIGHT,
+                            kind7.data());
 
   // Extract kind 3 type of image
-  rc = irm2_get_kind3_image(ctx.memory, IRM2_EYE_UNDEF, IRM2_CROPPED_WIDTH,
-                            IRM2_CROPPED_HEIGHT, cropped);
+  rc = irm2_get_kind3_image(ctx.buffer.data(), IRM2_EYE_UNDEF,
+                            IRM2_CROPPED_WIDTH, IRM2_CROPPED_HEIGHT,
+                            kind3.data());
 
   // Save kind 3 image
-  name = name_prefix;
+  std::string name(name_prefix);
   name.replace(name.find(".pgm"), 4, "_kind3.pgm");
-  write_pgm(name.c_str(), cropped, IRM2_CROPPED_WIDTH, IRM2_CROPPED_HEIGHT);
+  writer.write_pgm(name, std::move(kind3), IRM2_CROPPED_WIDTH,
+                   IRM2_CROPPED_HEIGHT);
 
   irm2_eye_info eyes[2];
-  irm2_get_eye_info(ctx.memory, eyes, sizeof(irm2_eye_info));
+  irm2_get_eye_info(ctx.buffer.data(), eyes, sizeof(irm2_eye_info));
 
   //-----------------------Packing customized JPEG2000, for more see
-  // iris_image_record.h-----------------
-
-  // prepare the header
-  IirInfo ii;
-  memset(&ii, 0, sizeof(ii));
-  memcpy(ii.ich.FormatId, "IIR\0", 4);
-  ii.IirType = IIR_2011; // NOT_IIR use this to get `nacked` image without
-                         // header for diagnostics later
-
-  ii.NumberOfIrises = 1;
-  ii.NumberOfEyes = 1;
-  ii.EyeLabel = EYE_UNDEF;
-
-  memset(ii.CaptureDateAndTime, 0xff, 9);
-  ii.CaptureDeviceTechnology = 1; // (0x01 ): CMOS/CCD
-  ii.CaptureDeviceVendorID = 0x0057;
-  ii.RepresentationNumber = 1;
-
-  // This should be consistent with fmtname, see below
-  ii.ImageType = Iir2011_IMAGEFORMAT_MONO_JPEG2000;
-  ii.ImageFormat = ii.IirType == IIR_2011
-                       ? Iir2011_IMAGEFORMAT_MONO_JPEG2000
-                       : ii.IirType == IIR_2005
-                             ? Iir2005_IMAGEFORMAT_MONO_JPEG2000
-                             : Iir2005_IMAGEFORMAT_MONO_RAW;
-
-  ii.Width = IRM2_CROPPED_WIDTH;
-  ii.Height = IRM2_CROPPED_HEIGHT;
-  ii.BitDepth = 8; // grayscale
-
-  ii.RollAngle = -1;
-  ii.RollUncertainty = -1;
-
-  // encode
-  char *fmtname = (char *)"jp2";
-  unsigned int n_size_out = 0;
-  std::vector<uint8_t> buf_out(BUFFER_SIZE);
-  uint32_t real_size;
-  auto ret = iirPack(cropped, ii.Width, ii.Height, 8, ii.Width * ii.Height, &ii,
-                     fmtname, 20000, buf_out.data(), &real_size);
+  // iris_image_record.h and kind7_encoder.h-----------------
+
+  // The encoder searches the rate target of iirPack for the largest record
+  // within the budget and decodes it back to check the quality.
+  Kind7EncodeOptions options;
+  options.budget = 20000;
+  Kind7Encoder encoder(options);
+  Kind7Record record;
+  ImageView kind7_view = {kind7.data(), IRM2_CROPPED_WIDTH,
+                          IRM2_CROPPED_HEIGHT, IRM2_CROPPED_WIDTH};
+  bool encoded = encoder.encode(kind7_view, record);
+
+  // Save kind 7 image
+  name = name_prefix;
+  name.replace(name.find(".pgm"), 4, "_kind7.pgm");
+  writer.write_pgm(name, std::move(kind7), IRM2_CROPPED_WIDTH,
+                   IRM2_CROPPED_HEIGHT);
+  if (!encoded) {
+    std::cout << "JPEG2000 packing fails: " << std::hex << record.rc << "\n";
+    return;
+  }
+  std::cout << std::dec << "Record of " << record.size << " bytes after "
+            << record.passes << " passes, PSNR " << record.psnr << " dB\n";
   name = name_prefix;
-  name.replace(name.find(".pgm"), 4, std::string("_kind7.") + fmtname);
-  write_mem2file(name.c_str(), buf_out.data(), real_size);
-
-  // decode
-  memset(&ii, 0, sizeof(ii));
-  std::vector<uint8_t> unpacked(1000 * 1000);
-  uint32_t unpacked_size;
-  ret = iirUnpack(buf_out.data(), real_size, &ii, BUFFER_SIZE, unpacked.data(),
-                  &unpacked_size);
+  name.replace(name.find(".pgm"), 4, "_kind7.jp2");
+  writer.write(name, record.data, record.size);
+
+  // Save the decoded record
   name = name_prefix;
   name.replace(name.find(".pgm"), 4, "_kind7_unpacked.pgm");
-  write_pgm(name.c_str(), unpacked.data(), IRM2_CROPPED_WIDTH,
-            IRM2_CROPPED_HEIGHT);
+  writer.write_pgm(name, record.decoded, IRM2_CROPPED_WIDTH,
+                   IRM2_CROPPED_HEIGHT);
 }
 
 /**
  * @brief Entry point of the example.
  *
  * Requires the `.pgm` binary file with image of size @ref WIDTH x @ref HEIGHT
- * as an input.
+ * as an input. Optionally takes a container file the output files are
+ * appended to instead of being saved alongside the input.
  */
 
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
-    std::cerr << "Exactly one argument is needed: filename\n";
+  if (argc != 2 && argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " filename [container]\n";
     return 1;
   }
   std::string file(argv[1]);
-  std::vector<uint8_t> buffer(BUFFER_SIZE);
-  uint8_t *pixels = buffer.data();
-  unsigned int width = WIDTH;   // Width of frame or image in pixels
-  unsigned int height = HEIGHT; // Height of frame or image in pixels
-  unsigned int depth = 0;
-  read_pgm(file.c_str(), &pixels, &width, &height, &depth);
+  // The pixels are used in place from the mapped file.
+  MappedImage image;
+  if (!image.open_pgm(file)) {
+    std::cerr << "Can not read input file: " << image.error() << "\n";
+    return 1;
+  }
+  uint8_t *pixels = image.view().pixels;
+  int width = image.view().width;   // Width of frame or image in pixels
+  int height = image.view().height; // Height of frame or image in pixels
 
   std::cout << "Enroll and identify started\n";
   enroll_identify_1_eye(pixels, width, height);
   std::cout << "Enroll and identify ended\n\n";
 
   std::cout << "Capture -> kind7 -> identify started\n";
-  capture_kind7_jpeg2000(pixels, width, height, file);
+  AsyncWriterOptions writer_options;
+  if (argc == 3)
+    writer_options.container = argv[2];
+  AsyncWriter writer(writer_options);
+  capture_kind7_jpeg2000(pixels, width, height, file, writer);
   std::cout << "Capture -> kind7 -> identify ended\n";
+  writer.close();
+  std::cout << writer.stats() << "\n";
+  std::cout << BufferPool::local().stats() << "\n";
 
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,168 @@
+/// @file kind7_batch_example.cpp
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+#include "image_source.h"
+#include "input_list.h"
+#include "kind7_encoder.h"
+#include "latency_stats.h"
+#include "thread_pool.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ms(Clock::time_point from, Clock::time_point to) {
+  return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+/**
+ * @brief Encoder and statistics owned by one worker.
+ */
+struct alignas(64) Worker {
+  explicit Worker(const Kind7EncodeOptions &options) : encoder(options) {}
+
+  Kind7Encoder encoder;
+  LatencyStats encode;
+  std::size_t records = 0;
+  std::size_t failed = 0;
+  std::size_t over_budget = 0;
+  std::size_t passes = 0;
+  std::size_t max_passes = 0;
+  uint64_t bytes = 0;
+  uint32_t min_size = UINT32_MAX;
+  double psnr = 0;
+  double min_psnr = 1e9;
+};
+
+/**
+ * @brief Encodes every image into a JPEG2000 IIR record of at most
+ * `options.budget` bytes and reports throughput, sizes and quality.
+ *
+ * @param inputs kind7 images.
+ * @param options budget and search limits.
+ * @param num_threads number of workers, 0 for all cores.
+ * @param output directory for the `.iir` records, empty to discard them.
+ * @return true if every image was encoded within the budget.
+ */
+bool encode_batch(const std::vector<InputImage> &inputs,
+                  const Kind7EncodeOptions &options, std::size_t num_threads,
+                  const std::string &output) {
+  ThreadPool pool(num_threads);
+  std::vector<Worker> workers;
+  workers.reserve(pool.size());
+  for (std::size_t w = 0; w < pool.size(); ++w)
+    workers.emplace_back(options);
+  namespace fs = std::filesystem;
+  if (!output.empty())
+    fs::create_directories(output);
+
+  auto start = Clock::now();
+  pool.parallel_for(inputs.size(), [&](std::size_t i, std::size_t w) {
+    Worker &worker = workers[w];
+    MappedImage image;
+    if (!image.open_pgm(inputs[i].path)) {
+      std::cerr << "Can not read " << inputs[i].path << ": " << image.error()
+                << "\n";
+      ++worker.failed;
+      return;
+    }
+    auto t0 = Clock::now();
+    Kind7Record record;
+    bool ok = worker.encoder.encode(image.view(), record);
+    worker.encode.add(elapsed_ms(t0, Clock::now()));
+    worker.passes += record.passes;
+    worker.max_passes =
+        std::max(worker.max_passes, (std::size_t)record.passes);
+    if (!ok) {
+      if (record.rc)
+        ++worker.failed;
+      else
+        ++worker.over_budget;
+      return;
+    }
+    ++worker.records;
+    worker.bytes += record.size;
+    worker.min_size = std::min(worker.min_size, record.size);
+    worker.psnr += record.psnr;
+    worker.min_psnr = std::min(worker.min_psnr, record.psnr);
+    if (!output.empty()) {
+      auto name = fs::path(output) /
+                  fs::path(inputs[i].path).stem().concat(".iir");
+      write_mem2file(name.string().c_str(), record.data, record.size);
+    }
+  });
+  double seconds = elapsed_ms(start, Clock::now()) / 1000;
+
+  Worker total(options);
+  for (const auto &worker : workers) {
+    total.encode.merge(worker.encode);
+    total.records += worker.records;
+    total.failed += worker.failed;
+    total.over_budget += worker.over_budget;
+    total.passes += worker.passes;
+    total.max_passes = std::max(total.max_passes, worker.max_passes);
+    total.bytes += worker.bytes;
+    total.min_size = std::min(total.min_size, worker.min_size);
+    total.psnr += worker.psnr;
+    total.min_psnr = std::min(total.min_psnr, worker.min_psnr);
+  }
+  std::size_t attempted = total.records + total.over_budget;
+  std::cout << "Records: " << total.records << " encoded, "
+            << total.over_budget << " over budget, " << total.failed
+            << " failed\n";
+  std::cout << "Threads: " << pool.size() << ", time " << seconds << " s, "
+            << (seconds > 0 ? total.records / seconds : 0) << " records/s\n";
+  std::cout << "Encode passes: "
+            << (attempted ? (double)total.passes / attempted : 0)
+            << " per record, at most " << total.max_passes << "\n";
+  if (total.records) {
+    std::cout << "Size: budget " << options.budget << ", mean "
+              << total.bytes / total.records << ", min " << total.min_size
+              << " bytes ("
+              << 100.0 * total.bytes / total.records / options.budget
+              << "% of budget)\n";
+    if (options.verify)
+      std::cout << "PSNR: mean " << total.psnr / total.records << " dB, min "
+                << total.min_psnr << " dB\n";
+  }
+  std::cout << "Encode: " << total.encode << "\n";
+  return total.failed == 0 && total.over_budget == 0;
+}
+
+/**
+ * @brief Entry point of the example.
+ *
+ * Requires a directory with `.pgm` kind7 images (or a manifest listing them,
+ * e.g. the `_kind7.pgm` files of the kind7 example). Optionally takes the
+ * record budget in bytes, the number of threads, an output directory for
+ * the records and `noverify` to skip the PSNR check.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 6) {
+    std::cerr << "Usage: " << argv[0]
+              << " input_dir|manifest [budget] [threads] [output_dir] "
+                 "[noverify]\n";
+    return 1;
+  }
+  Kind7EncodeOptions options;
+  if (argc > 2)
+    options.budget = (uint32_t)std::stoul(argv[2]);
+  std::size_t num_threads = argc > 3 ? std::stoul(argv[3]) : 0;
+  std::string output = argc > 4 ? argv[4] : "";
+  options.verify = !(argc > 5 && std::string(argv[5]) == "noverify");
+
+  auto inputs = list_inputs(argv[1]);
+  if (inputs.empty()) {
+    std::cerr << "No input images found.\n";
+    return 1;
+  }
+  std::cout << "kind7 batch encoding of " << inputs.size()
+            << " images started\n";
+  bool ok = encode_batch(inputs, options, num_threads, output);
+  std::cout << "kind7 batch encoding ended\n";
+  return ok ? 0 : 1;
+}
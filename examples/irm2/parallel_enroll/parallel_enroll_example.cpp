@@ -0,0 +1,263 @@
+/// @file parallel_enroll_example.cpp
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "iris_mobile_v2.h"
+#include "buffer_pool.h"
+#include "image_source.h"
+#include "trace.h"
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Predefined frame width for this example.
+ */
+#define WIDTH (2336)
+/**
+ * @brief Predefined frame height for this example.
+ */
+#define HEIGHT (769)
+
+/**
+ * @brief Default bound on the frames one enrollment may consume; the engine
+ * loops never end on input it can not enroll.
+ */
+#define MAX_ENROLLMENT_FRAMES (300)
+/**
+ * @brief Default frame rate the recording is played back at.
+ */
+#define CAMERA_FPS (30)
+
+void on_score(void *user_context, int i_template, int score) {
+  trace_instant("on_score", score);
+}
+
+double elapsed_ms(Clock::time_point from, Clock::time_point to) {
+  return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+/**
+ * @brief The recording played back as a live camera.
+ *
+ * Frame `n` of the stream is recorded frame `n % frames.size()` and arrives
+ * at `start + n * period`; every context sees the same frames at the same
+ * times and none can read a frame before it arrived.
+ */
+struct CameraStream {
+  const std::vector<ImageView> &frames;
+  Clock::time_point start;
+  Clock::duration period;
+
+  const ImageView &frame(std::size_t n) const {
+    return frames[n % frames.size()];
+  }
+  Clock::time_point arrival(std::size_t n) const {
+    return start + period * (Clock::rep)n;
+  }
+};
+
+/**
+ * @brief Outcome of one enrollment context.
+ */
+struct EnrollmentRun {
+  bool enrolled = false;
+  /// Stopped because another context finished first.
+  bool cancelled = false;
+  std::size_t frames = 0;
+  /// Frames still being processed when the next one arrived.
+  std::size_t late = 0;
+  /// Time from the start of the stream to the template, or to giving up.
+  double ms = 0;
+  std::vector<uint8_t> iris_template;
+};
+
+/**
+ * @brief Runs the enrollment steps of one context over the camera stream.
+ *
+ * The context joins the stream at frame `first` and takes every frame from
+ * there in arrival order, waiting for frames that have not arrived yet. The
+ * same loop as in enroll_identify_example.cpp, but bounded by `max_frames`
+ * and cancellable between frames.
+ *
+ * @param cancel set by the context that enrolls first.
+ */
+EnrollmentRun enroll(const CameraStream &stream, std::size_t first,
+                     const irm2_settings &s, uint32_t num_eyes,
+                     std::size_t max_frames, const std::atomic<bool> &cancel) {
+  EnrollmentRun run;
+  PooledBuffer context =
+      BufferPool::local().acquire(IRM2_GET_CONTEXT_SIZE(1, WIDTH, HEIGHT));
+  auto rc = irm2_init_enrollment(context.data(), context.size(), num_eyes, &s);
+  if (rc) {
+    std::cerr << "Enrollment init fails: " << std::hex << rc << std::dec
+              << "\n";
+    return run;
+  }
+  irm2_enrollment_info enr_info = {0};
+  for (; run.frames < max_frames; ++run.frames) {
+    if (cancel.load(std::memory_order_relaxed)) {
+      run.cancelled = true;
+      break;
+    }
+    std::size_t n = first + run.frames;
+    std::this_thread::sleep_until(stream.arrival(n));
+    if (cancel.load(std::memory_order_relaxed)) {
+      run.cancelled = true;
+      break;
+    }
+    const ImageView &frame = stream.frame(n);
+    TRACE_CALL(irm2_on_frame, context.data(), frame.pixels, 0);
+    TRACE_CALL(irm2_get_enrollment_info, context.data(), &enr_info,
+               sizeof(enr_info));
+    run.late += Clock::now() > stream.arrival(n + 1);
+    if (enr_info.step_progress != 100)
+      continue;
+    if (enr_info.overall_progress == 100) {
+      run.iris_template.resize(IRM2_TEMPLATE_SIZE);
+      irm2_get_template(context.data(), run.iris_template.data(),
+                        IRM2_TEMPLATE_SIZE);
+      run.enrolled = true;
+      ++run.frames;
+      break;
+    }
+    irm2_continue_enrollment(context.data());
+  }
+  run.ms = elapsed_ms(stream.start, Clock::now());
+  return run;
+}
+
+/**
+ * @brief Enrolls with several contexts fed from one camera stream and keeps
+ * the first template.
+ *
+ * Every frame is broadcast to all contexts as it arrives. Context `k` joins
+ * the stream `k * stagger` frames after the first, so the contexts hold
+ * different enrollment histories: one that started on a bad frame does not
+ * hold the others back. The others are cancelled at their next frame
+ * boundary once one enrolled.
+ *
+ * @param winner set to the context that enrolled, -1 if none did.
+ * @param runs outcome of every context.
+ */
+EnrollmentRun enroll_speculative(const CameraStream &stream,
+                                 std::size_t num_contexts, std::size_t stagger,
+                                 const irm2_settings &s, uint32_t num_eyes,
+                                 std::size_t max_frames, int &winner,
+                                 std::vector<EnrollmentRun> &runs) {
+  std::atomic<bool> cancel{false};
+  std::atomic<int> first_enrolled{-1};
+  runs.assign(num_contexts, EnrollmentRun());
+  std::vector<std::thread> threads;
+  for (std::size_t k = 0; k < num_contexts; ++k)
+    threads.emplace_back([&, k] {
+      Trace::instance().set_thread_name("context " + std::to_string(k));
+      runs[k] = enroll(stream, k * stagger, s, num_eyes, max_frames, cancel);
+      int none = -1;
+      if (runs[k].enrolled && first_enrolled.compare_exchange_strong(none, k))
+        cancel = true;
+    });
+  for (auto &thread : threads)
+    thread.join();
+  winner = first_enrolled;
+  return winner >= 0 ? runs[winner] : EnrollmentRun();
+}
+
+/**
+ * @brief Entry point of the example.
+ *
+ * Requires a binary file with consecutive RAW frames of size @ref WIDTH x
+ * @ref HEIGHT. Optionally takes the number of parallel contexts (default:
+ * hardware threads), the bound on frames per enrollment, the camera frame
+ * rate and the frames between the starts of two contexts.
+ *
+ * The recording is played back at the camera rate twice: into a single
+ * context as the baseline, then broadcast to all contexts. Both runs see
+ * the same stream, so the time to the first template compares the serial
+ * and the speculative enrollment of the same user in front of the camera.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 6) {
+    std::cerr << "Usage: " << argv[0]
+              << " frames [contexts] [max_frames] [fps] [stagger]\n";
+    return 1;
+  }
+  std::size_t num_contexts =
+      argc > 2 ? std::stoul(argv[2])
+               : std::max(1u, std::thread::hardware_concurrency());
+  std::size_t max_frames = argc > 3 ? std::stoul(argv[3])
+                                    : MAX_ENROLLMENT_FRAMES;
+  double fps = argc > 4 ? std::stod(argv[4]) : CAMERA_FPS;
+  std::size_t stagger = argc > 5 ? std::stoul(argv[5]) : 1;
+  if (fps <= 0) {
+    std::cerr << "The frame rate must be positive.\n";
+    return 1;
+  }
+  num_contexts = std::max<std::size_t>(1, num_contexts);
+  if (num_contexts > std::thread::hardware_concurrency())
+    std::cerr << "More contexts than hardware threads, the contexts share "
+                 "cores and the speculation costs time.\n";
+
+  std::error_code error;
+  auto file_size = std::filesystem::file_size(argv[1], error);
+  std::size_t num_frames =
+      error ? 0 : file_size / ((std::size_t)WIDTH * HEIGHT);
+  // The recording is mapped as one tall image and cut into frames.
+  MappedImage recording;
+  if (num_frames == 0 ||
+      !recording.open_raw(argv[1], WIDTH, HEIGHT * (int)num_frames)) {
+    std::cerr << "Can not read input file: "
+              << (num_frames ? recording.error() : "no complete frame")
+              << "\n";
+    return 1;
+  }
+  std::vector<ImageView> frames;
+  for (std::size_t f = 0; f < num_frames; ++f)
+    frames.push_back(recording.view().crop(0, (int)f * HEIGHT, WIDTH, HEIGHT));
+
+  irm2_settings s = {
+      sizeof(s), WIDTH,    HEIGHT, 3500, 160, NULL, on_score,
+      NULL,      NULL,     IRM2_FLAG_NONE,    NULL,
+      WIDTH // stride
+  };
+  uint32_t num_eyes = 2;
+
+  auto period = std::chrono::duration_cast<Clock::duration>(
+      std::chrono::duration<double>(1 / fps));
+  std::atomic<bool> never{false};
+  CameraStream serial_stream = {frames, Clock::now(), period};
+  auto serial = enroll(serial_stream, 0, s, num_eyes, max_frames, never);
+  std::cout << "Serial:      " << (serial.enrolled ? "enrolled" : "failed")
+            << " after " << serial.frames << " frames in " << serial.ms
+            << " ms, " << serial.late << " late\n";
+
+  int winner = -1;
+  std::vector<EnrollmentRun> runs;
+  CameraStream stream = {frames, Clock::now(), period};
+  auto parallel = enroll_speculative(stream, num_contexts, stagger, s,
+                                     num_eyes, max_frames, winner, runs);
+  std::cout << "Speculative: " << (parallel.enrolled ? "enrolled" : "failed");
+  if (parallel.enrolled)
+    std::cout << " by context " << winner << " after " << parallel.frames
+              << " frames in " << parallel.ms << " ms";
+  std::cout << " (" << num_contexts << " contexts on a " << num_frames
+            << " frame recording at " << fps << " fps)\n";
+  for (std::size_t k = 0; k < runs.size(); ++k)
+    std::cout << "  context " << k << ": joined at frame " << k * stagger
+              << ", " << runs[k].frames << " frames (" << runs[k].late
+              << " late), "
+              << (runs[k].enrolled    ? "enrolled"
+                  : runs[k].cancelled ? "cancelled"
+                                      : "gave up")
+              << " at " << runs[k].ms << " ms\n";
+  if (serial.enrolled && parallel.enrolled)
+    std::cout << "Time to template: " << serial.ms << " -> " << parallel.ms
+              << " ms (" << (parallel.ms > 0 ? serial.ms / parallel.ms : 0)
+              << "x)\n";
+  return parallel.enrolled ? 0 : 1;
+}
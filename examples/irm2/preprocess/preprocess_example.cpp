@@ -0,0 +1,197 @@
+/// @file preprocess_example.cpp
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "utils.h"
+#include "image_kernels.h"
+#include "mapped_file.h"
+
+/**
+ * @brief Timed repetitions of every stage in benchmark mode.
+ */
+#define REPEATS (20)
+
+/**
+ * @brief Owning image buffer with a row stride padded by `padding` bytes.
+ */
+struct Image {
+  Image(int width, int height, int padding = 0)
+      : pixels((std::size_t)(width + padding) * std::max(height, 1)),
+        view{pixels.data(), width, height, width + padding} {}
+
+  std::vector<uint8_t> pixels;
+  ImageView view;
+};
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsed_ms(Clock::time_point from, Clock::time_point to) {
+  return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+static bool same(const ImageView &a, const ImageView &b) {
+  if (a.width != b.width || a.height != b.height)
+    return false;
+  // Rows of an empty image may be null, which memcmp must not be given.
+  if (a.width == 0)
+    return true;
+  for (int y = 0; y < a.height; ++y)
+    if (std::memcmp(a.row(y), b.row(y), a.width) != 0)
+      return false;
+  return true;
+}
+
+/**
+ * @brief Compares every kernel set of this CPU against the scalar reference
+ * on random images of awkward sizes and strides.
+ *
+ * @return true if all results are bit-exact.
+ */
+bool self_test(int iterations) {
+  const auto &sets = available_image_kernels();
+  const ImageKernels &reference = *sets.front();
+  std::mt19937 random(1);
+  bool ok = true;
+  for (const ImageKernels *kernels : sets) {
+    std::size_t failures = 0, checks = 0;
+    auto check = [&](bool equal, const char *what, int width, int height) {
+      ++checks;
+      if (!equal && failures++ < 10)
+        std::cerr << kernels->name << ": " << what << " differs for " << width
+                  << "x" << height << "\n";
+    };
+    for (int i = 0; i < iterations; ++i) {
+      int width = 1 + random() % 300, height = 1 + random() % 70;
+      int padding = random() % 40;
+      Image src(width, height, padding);
+      for (auto &p : src.pixels)
+        p = (uint8_t)random();
+
+      int raw_width = width & ~3;
+      if (raw_width > 0) {
+        std::ptrdiff_t packed_stride = raw_width * 5 / 4 + padding;
+        std::vector<uint8_t> packed((std::size_t)packed_stride * height);
+        for (auto &p : packed)
+          p = (uint8_t)random();
+        Image expected(raw_width, height), actual(raw_width, height, 3);
+        unpack_raw10(packed.data(), packed_stride, expected.view, reference);
+        unpack_raw10(packed.data(), packed_stride, actual.view, *kernels);
+        check(same(expected.view, actual.view), "raw10", raw_width, height);
+      }
+
+      for (int degrees : {0, 90, 180, 270}) {
+        bool swapped = degrees == 90 || degrees == 270;
+        int w = swapped ? height : width, h = swapped ? width : height;
+        Image expected(w, h), actual(w, h, padding);
+        rotate_image(src.view, expected.view, degrees, reference);
+        rotate_image(src.view, actual.view, degrees, *kernels);
+        check(same(expected.view, actual.view), "rotation", width, height);
+      }
+
+      Image expected(width / 2, height / 2), actual(width / 2, height / 2, 5);
+      downscale_2x(src.view, expected.view, reference);
+      downscale_2x(src.view, actual.view, *kernels);
+      check(same(expected.view, actual.view), "downscale", width, height);
+
+      if (width > 2 && height > 2) {
+        ImageView part = src.view.crop(1, 1, width - 2, height - 2);
+        Image copy(width - 2, height - 2, 7);
+        copy_image(part, copy.view);
+        bool equal = true;
+        for (int y = 0; y < part.height; ++y)
+          for (int x = 0; x < part.width; ++x)
+            equal &= copy.view.row(y)[x] == src.view.row(y + 1)[x + 1];
+        check(equal, "crop", width, height);
+      }
+    }
+    std::cout << kernels->name << ": " << checks - failures << "/" << checks
+              << " bit-exact\n";
+    ok &= failures == 0;
+  }
+  return ok;
+}
+
+/**
+ * @brief Unpacks, rotates and optionally downscales one RAW10 frame with
+ * every kernel set, reports the time of each stage and saves the result.
+ */
+bool preprocess(const std::string &file, int width, int height, int degrees,
+                bool downscale, const std::string &output) {
+  MappedFile packed;
+  std::ptrdiff_t packed_stride = width * 5 / 4;
+  if (width % 4 || !packed.open(file) ||
+      packed.size() < (std::size_t)packed_stride * height) {
+    std::cerr << "Can not read a " << width << "x" << height
+              << " RAW10 frame from " << file << "\n";
+    return false;
+  }
+  bool swapped = degrees == 90 || degrees == 270;
+  Image unpacked(width, height);
+  Image rotated(swapped ? height : width, swapped ? width : height);
+  Image scaled(rotated.view.width / 2, rotated.view.height / 2);
+  const ImageView &result = downscale ? scaled.view : rotated.view;
+
+  std::vector<uint8_t> reference;
+  for (const ImageKernels *kernels : available_image_kernels()) {
+    double best[3] = {1e9, 1e9, 1e9};
+    for (int r = 0; r < REPEATS; ++r) {
+      auto t0 = Clock::now();
+      unpack_raw10(packed.data(), packed_stride, unpacked.view, *kernels);
+      auto t1 = Clock::now();
+      if (!rotate_image(unpacked.view, rotated.view, degrees, *kernels)) {
+        std::cerr << "Unsupported rotation " << degrees << "\n";
+        return false;
+      }
+      auto t2 = Clock::now();
+      if (downscale)
+        downscale_2x(rotated.view, scaled.view, *kernels);
+      auto t3 = Clock::now();
+      best[0] = std::min(best[0], elapsed_ms(t0, t1));
+      best[1] = std::min(best[1], elapsed_ms(t1, t2));
+      best[2] = std::min(best[2], elapsed_ms(t2, t3));
+    }
+    std::vector<uint8_t> pixels(result.pixels,
+                                result.pixels + (std::size_t)result.width *
+                                                    result.height);
+    if (reference.empty())
+      reference = pixels;
+    std::cout << kernels->name << ": unpack " << best[0] << " ms, rotate "
+              << best[1] << " ms, downscale " << best[2] << " ms"
+              << (pixels == reference ? "" : ", MISMATCH") << "\n";
+  }
+  write_pgm(output.c_str(), result.pixels, result.width, result.height);
+  std::cout << "Saved " << result.width << "x" << result.height << " to "
+            << output << "\n";
+  return true;
+}
+
+/**
+ * @brief Entry point of the example.
+ *
+ * With `--self-test [iterations]` checks that the vectorized kernels of the
+ * running CPU match the scalar reference bit for bit. Otherwise requires a
+ * packed RAW10 frame with its width and height, and optionally takes the
+ * clockwise rotation, whether to downscale 2x and the output `.pgm` name.
+ */
+int main(int argc, char *argv[]) {
+  if (argc >= 2 && std::string(argv[1]) == "--self-test")
+    return self_test(argc > 2 ? std::stoi(argv[2]) : 200) ? 0 : 1;
+  if (argc < 4 || argc > 7) {
+    std::cerr << "Usage: " << argv[0]
+              << " raw10_file width height [rotation] [downscale] [output]\n"
+              << "       " << argv[0] << " --self-test [iterations]\n";
+    return 1;
+  }
+  int degrees = argc > 4 ? std::stoi(argv[4]) : 0;
+  bool downscale = argc > 5 && std::stoi(argv[5]) != 0;
+  std::string output = argc > 6 ? argv[6] : "preprocessed.pgm";
+  return preprocess(argv[1], std::stoi(argv[2]), std::stoi(argv[3]), degrees,
+                    downscale, output)
+             ? 0
+             : 1;
+}
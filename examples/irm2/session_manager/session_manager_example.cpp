@@ -0,0 +1,250 @@
+/// @file session_manager_example.cpp
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "iris_engine_v3.h"
+#include "iris_mobile_v2.h"
+#include "image_source.h"
+#include "ire3_features.h"
+#include "irm2_session.h"
+#include "session_manager.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Predefined frame width for this example.
+ */
+#define WIDTH (2336)
+/**
+ * @brief Predefined frame height for this example.
+ */
+#define HEIGHT (769)
+
+/**
+ * @brief Size of the eye crops handed to ire3, one per half of the frame.
+ */
+#define CROP_WIDTH (640)
+#define CROP_HEIGHT (480)
+
+#define MB (1024.0 * 1024.0)
+#define GB ((std::size_t)1 << 30)
+
+/**
+ * @brief Prints the cost of one session type for a few frame geometries.
+ */
+template <class Session>
+void print_footprints(const char *name, const SessionManager &manager,
+                      const ire3_settings &settings) {
+  static const int sizes[][2] = {
+      {640, 480}, {1280, 720}, {1920, 1080}, {WIDTH, HEIGHT}};
+  for (const auto &size : sizes) {
+    Irm2Config config;
+    config.width = size[0];
+    config.height = size[1];
+    auto footprint = session_footprint<Session>(config, settings, CROP_WIDTH,
+                                                CROP_HEIGHT);
+    std::cout << std::setw(9) << name << std::setw(6) << size[0] << "x"
+              << std::setw(4) << size[1] << std::setw(5) << footprint.eyes
+              << std::setw(11) << footprint.context / MB << std::setw(11)
+              << footprint.eyes * footprint.scratch / MB << std::setw(11)
+              << footprint.dedicated() / MB << std::setw(11)
+              << (int)manager.sessions_per(GB, footprint, true)
+              << std::setw(11) << (int)manager.sessions_per(GB, footprint)
+              << "\n";
+  }
+}
+
+/**
+ * @brief An enrollment session and, in dedicated mode, its own extractors.
+ */
+struct Client {
+  SessionManager::Admission admission;
+  Irm2Session<Irm2Mode::Enroll, 2> session;
+  std::vector<Ire3Extractor> extractors;
+  std::size_t extractions = 0;
+};
+
+/**
+ * @brief Crop of eye `eye` of a frame: the center of one half.
+ */
+static ImageView eye_crop(const ImageView &frame, int eye) {
+  int half = frame.width / 2;
+  return frame.crop(eye * half + (half - CROP_WIDTH) / 2,
+                    (frame.height - CROP_HEIGHT) / 2, CROP_WIDTH,
+                    CROP_HEIGHT);
+}
+
+/**
+ * @brief Processes one frame of a client: irm2 first, then the ire3
+ * features of both eyes.
+ */
+static void process(Client &client, SessionManager &manager,
+                    const Irm2Config &config, const ImageView &frame,
+                    bool dedicated) {
+  TRACE_SCOPE("session_frame");
+  client.session.on_frame(frame);
+  irm2_enrollment_info info = {0};
+  client.session.progress(info);
+  if (info.step_progress == 100) {
+    if (info.overall_progress == 100)
+      client.session.init(config, manager.pool());
+    else
+      client.session.continue_enrollment();
+  }
+  // The scratch set is held for the extractions only; between frames the
+  // session keeps nothing but its context.
+  SessionManager::Scratch scratch;
+  if (!dedicated)
+    scratch = manager.borrow();
+  for (int eye = 0; eye < 2; ++eye) {
+    Ire3Extractor &extractor =
+        dedicated ? client.extractors[eye] : scratch.extractor();
+    if ((dedicated || scratch) &&
+        extractor.extract(eye_crop(frame, eye)) == IRE3_STATUS_OK)
+      ++client.extractions;
+  }
+}
+
+/**
+ * @brief Opens as many sessions as the cap allows, up to `num_sessions`,
+ * and feeds every session `rounds` frames.
+ *
+ * @param dedicated give every session its own extractors instead of
+ * lending it shared ones.
+ */
+void run(const std::vector<ImageView> &frames, std::size_t num_sessions,
+         std::size_t num_threads, std::size_t cap, std::size_t rounds,
+         bool dedicated) {
+  SessionManagerOptions options;
+  options.memory_cap = cap;
+  options.scratch_sets = dedicated ? 0 : num_threads;
+  options.crop_width = CROP_WIDTH;
+  options.crop_height = CROP_HEIGHT;
+  SessionManager manager(options);
+  ThreadPool pool(num_threads);
+
+  Irm2Config config;
+  config.width = WIDTH;
+  config.height = HEIGHT;
+  auto footprint = session_footprint<Irm2Session<Irm2Mode::Enroll, 2>>(
+      config, options.extraction, CROP_WIDTH, CROP_HEIGHT);
+
+  std::vector<std::unique_ptr<Client>> clients;
+  for (std::size_t i = 0; i < num_sessions; ++i) {
+    auto client = std::make_unique<Client>();
+    client->admission = manager.admit(footprint, dedicated);
+    if (!client->admission)
+      continue;
+    int rc = client->session.init(config, manager.pool());
+    for (int eye = 0; rc == IRE3_STATUS_OK && dedicated && eye < 2; ++eye) {
+      client->extractors.emplace_back();
+      rc = client->extractors.back().init(options.extraction, manager.pool());
+    }
+    if (rc) {
+      std::cerr << "Session init fails: " << std::hex << rc << std::dec
+                << "\n";
+      continue;
+    }
+    clients.push_back(std::move(client));
+  }
+
+  auto start = Clock::now();
+  for (std::size_t r = 0; r < rounds; ++r)
+    pool.parallel_for(clients.size(), [&](std::size_t i, std::size_t) {
+      process(*clients[i], manager, config, frames[(i + r) % frames.size()],
+              dedicated);
+    });
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::size_t extractions = 0;
+  for (const auto &client : clients)
+    extractions += client->extractions;
+  auto stats = manager.stats();
+  std::cout << (dedicated ? "Dedicated scratch: " : "Shared scratch:    ")
+            << stats << "\n";
+  std::cout << "  " << clients.size() << " sessions, "
+            << manager.sessions_per(GB, footprint, dedicated)
+            << " sessions per GB, " << rounds * clients.size()
+            << " frames and " << extractions << " extractions in "
+            << seconds * 1000 << " ms\n";
+}
+
+/**
+ * @brief Entry point of the example.
+ *
+ * Requires a binary file with consecutive RAW frames of size @ref WIDTH x
+ * @ref HEIGHT. Optionally takes the number of sessions to open, the number
+ * of processing threads, the memory cap in MB and the number of frames fed
+ * to every session.
+ *
+ * Prints the memory a session costs for a few frame geometries and eye
+ * counts, then runs the same enrollment sessions twice under the cap: with
+ * extractors owned by every session, and with extractors lent from a
+ * shared set only while a frame is processed. The second keeps only the
+ * irm2 contexts resident and fits more sessions under the same cap.
+ */
+int main(int argc, char *argv[]) {
+  if (argc < 2 || argc > 6) {
+    std::cerr << "Usage: " << argv[0]
+              << " frames [sessions] [threads] [cap_mb] [rounds]\n";
+    return 1;
+  }
+  std::size_t num_sessions = argc > 2 ? std::stoul(argv[2]) : 64;
+  std::size_t num_threads =
+      argc > 3 ? std::stoul(argv[3])
+               : std::max(1u, std::thread::hardware_concurrency());
+  std::size_t cap = (argc > 4 ? std::stoul(argv[4]) : 1024) * (1 << 20);
+  std::size_t rounds = argc > 5 ? std::stoul(argv[5]) : 10;
+  num_threads = std::max<std::size_t>(1, num_threads);
+
+  std::error_code error;
+  auto file_size = std::filesystem::file_size(argv[1], error);
+  std::size_t num_frames =
+      error ? 0 : file_size / ((std::size_t)WIDTH * HEIGHT);
+  MappedImage recording;
+  if (num_frames == 0 ||
+      !recording.open_raw(argv[1], WIDTH, HEIGHT * (int)num_frames)) {
+    std::cerr << "Can not read input file: "
+              << (num_frames ? recording.error() : "no complete frame")
+              << "\n";
+    return 1;
+  }
+  std::vector<ImageView> frames;
+  for (std::size_t f = 0; f < num_frames; ++f)
+    frames.push_back(recording.view().crop(0, (int)f * HEIGHT, WIDTH, HEIGHT));
+
+  SessionManagerOptions options;
+  options.scratch_sets = num_threads;
+  options.crop_width = CROP_WIDTH;
+  options.crop_height = CROP_HEIGHT;
+  SessionManager sizing(options);
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "Memory per session in MB, sessions per GB with "
+            << num_threads << " shared scratch sets\n";
+  std::cout << "     mode     frame  eyes    context    scratch  dedicated"
+               "   per GB    per GB\n"
+            << "                                                          "
+               "dedicated    shared\n";
+  print_footprints<Irm2Session<Irm2Mode::Enroll, 1>>("enroll", sizing,
+                                                     options.extraction);
+  print_footprints<Irm2Session<Irm2Mode::Enroll, 2>>("enroll", sizing,
+                                                     options.extraction);
+  print_footprints<Irm2Session<Irm2Mode::Identify, 2>>("identify", sizing,
+                                                       options.extraction);
+  print_footprints<Irm2Session<Irm2Mode::Capture, 1>>("capture", sizing,
+                                                      options.extraction);
+  std::cout << "\n";
+
+  run(frames, num_sessions, num_threads, cap, rounds, true);
+  run(frames, num_sessions, num_threads, cap, rounds, false);
+  return 0;
+}